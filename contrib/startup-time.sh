@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Compares the startup time of two colorhug-cmd builds for commands that do
+# not need a device, e.g. before and after a change:
+#
+#   ./contrib/startup-time.sh /tmp/old/src/colorhug-cmd ./src/colorhug-cmd
+#
+# Each command is run RUNS times (default 200) and the median and mean
+# wall-clock time per run are printed in ms.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 colorhug-cmd [colorhug-cmd...]" >&2
+	exit 1
+fi
+RUNS=${RUNS:-200}
+
+tmpdir=$(mktemp -d)
+trap 'rm -rf "$tmpdir"' EXIT
+
+# four bytes at the default runcode address
+printf ':0440000001020304B2\n:00000001FF\n' > "$tmpdir/test.hex"
+
+now_ns () {
+	date +%s%N
+}
+
+time_command () {
+	i=0
+	: > "$tmpdir/times"
+	while [ $i -lt "$RUNS" ]; do
+		start=$(now_ns)
+		"$@" > /dev/null 2>&1 || true
+		end=$(now_ns)
+		echo $((end - start)) >> "$tmpdir/times"
+		i=$((i + 1))
+	done
+	sort -n "$tmpdir/times" | awk '
+		{ t[NR] = $1; sum += $1 }
+		END { printf "median %.2fms\tmean %.2fms\n",
+			t[int((NR + 1) / 2)] / 1e6, sum / NR / 1e6 }'
+}
+
+for cmd in "$@"; do
+	echo "$cmd:"
+	printf "  --help\t\t"
+	time_command "$cmd" --help
+	printf "  inhx32-to-bin\t"
+	time_command "$cmd" inhx32-to-bin "$tmpdir/test.hex" "$tmpdir/test.bin"
+done
@@ -0,0 +1,111 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <colorhug.h>
+
+#include "ch-autorange.h"
+
+/* give up rather than hunting forever on a flickering source */
+#define CH_AUTORANGE_MAX_ATTEMPTS		4
+
+/**
+ * ch_autorange_integral_time:
+ *
+ * Finds the shortest integral time that still gets enough pulses from the
+ * sensor, starting short and jumping straight to the estimated time
+ * rather than doubling. The integral time is left set on the device.
+ *
+ * Devices that do not support setting the integral time are left alone
+ * and @integral_time is set to zero.
+ **/
+gboolean
+ch_autorange_integral_time (ChDeviceQueue *device_queue,
+			    GUsbDevice *device,
+			    guint16 *integral_time,
+			    GCancellable *cancellable,
+			    GError **error)
+{
+	guint i;
+	guint32 pulses = 0;
+	guint64 tmp;
+	guint16 integral_time_tmp = CH_AUTORANGE_INTEGRAL_TIME_MIN;
+
+	g_return_val_if_fail (CH_IS_DEVICE_QUEUE (device_queue), FALSE);
+	g_return_val_if_fail (integral_time != NULL, FALSE);
+
+	/* only the original ColorHug counts pulses */
+	if (ch_device_get_mode (device) != CH_DEVICE_MODE_FIRMWARE) {
+		*integral_time = 0;
+		return TRUE;
+	}
+
+	for (i = 0; i < CH_AUTORANGE_MAX_ATTEMPTS; i++) {
+		ch_device_queue_set_integral_time (device_queue,
+						   device,
+						   integral_time_tmp);
+		ch_device_queue_set_multiplier (device_queue,
+						device,
+						CH_FREQ_SCALE_100);
+		ch_device_queue_set_color_select (device_queue,
+						  device,
+						  CH_COLOR_SELECT_WHITE);
+		ch_device_queue_take_reading_raw (device_queue,
+						  device,
+						  &pulses);
+		if (!ch_device_queue_process (device_queue,
+					      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					      cancellable,
+					      error))
+			return FALSE;
+		g_debug ("integral time 0x%04x gave %u pulses",
+			 integral_time_tmp, pulses);
+		if (pulses >= CH_AUTORANGE_PULSES_MIN ||
+		    integral_time_tmp == CH_INTEGRAL_TIME_VALUE_MAX)
+			break;
+
+		/* aim a quarter above the minimum to allow for noise */
+		if (pulses == 0) {
+			tmp = CH_INTEGRAL_TIME_VALUE_MAX;
+		} else {
+			tmp = (guint64) integral_time_tmp *
+				CH_AUTORANGE_PULSES_MIN * 5 / (pulses * 4);
+		}
+		tmp = MAX (tmp, (guint64) integral_time_tmp * 2);
+		integral_time_tmp = MIN (tmp, CH_INTEGRAL_TIME_VALUE_MAX);
+	}
+
+	/* still too dark, so fall back to the longest time */
+	if (i == CH_AUTORANGE_MAX_ATTEMPTS) {
+		integral_time_tmp = CH_INTEGRAL_TIME_VALUE_MAX;
+		ch_device_queue_set_integral_time (device_queue,
+						   device,
+						   integral_time_tmp);
+		if (!ch_device_queue_process (device_queue,
+					      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					      cancellable,
+					      error))
+			return FALSE;
+	}
+	*integral_time = integral_time_tmp;
+	return TRUE;
+}
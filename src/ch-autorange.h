@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_AUTORANGE_H__
+#define __CH_AUTORANGE_H__
+
+#include <colorhug.h>
+
+G_BEGIN_DECLS
+
+/* shortest integral time worth trying, about 1/32 of the maximum */
+#define CH_AUTORANGE_INTEGRAL_TIME_MIN		0x0800
+
+/* raw white pulses needed for a reading to be accurate enough */
+#define CH_AUTORANGE_PULSES_MIN			0x4000
+
+gboolean	 ch_autorange_integral_time	(ChDeviceQueue		*device_queue,
+						 GUsbDevice		*device,
+						 guint16		*integral_time,
+						 GCancellable		*cancellable,
+						 GError			**error);
+
+G_END_DECLS
+
+#endif
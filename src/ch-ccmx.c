@@ -31,6 +31,8 @@
 #include <libsoup/soup.h>
 #include <colorhug.h>
 
+#include "ch-autorange.h"
+
 typedef enum {
 	CH_CCMX_PAGE_DEVICES,
 	CH_CCMX_PAGE_REFERENCE,
@@ -1370,9 +1372,11 @@ ch_ccmx_measure_patches_colorhug (ChCcmxPrivate *priv)
 {
 	CdColorRGB rgb;
 	CdColorXYZ xyz;
+	GError *error = NULL;
 	GtkWidget *w;
 	guint i;
 	guint len;
+	guint16 integral_time = 0;
 
 	len = cd_it8_get_data_size (priv->gen_ti1);
 	for (i = 0; i < len; i++) {
@@ -1386,9 +1390,22 @@ ch_ccmx_measure_patches_colorhug (ChCcmxPrivate *priv)
 			       ch_ccmx_loop_quit_cb,
 			       priv);
 		g_main_loop_run (priv->gen_loop);
-		ch_device_queue_set_integral_time (priv->device_queue,
-						   priv->device,
-						   CH_INTEGRAL_TIME_VALUE_MAX);
+
+		/* bright patches do not need the full integral time */
+		if (!ch_autorange_integral_time (priv->device_queue,
+						 priv->device,
+						 &integral_time,
+						 NULL,
+						 &error)) {
+			g_warning ("failed to autorange: %s", error->message);
+			g_clear_error (&error);
+			integral_time = 0;
+		}
+		if (integral_time == 0) {
+			ch_device_queue_set_integral_time (priv->device_queue,
+							   priv->device,
+							   CH_INTEGRAL_TIME_VALUE_MAX);
+		}
 		ch_device_queue_set_multiplier (priv->device_queue,
 						priv->device,
 						CH_FREQ_SCALE_100);
@@ -1406,9 +1423,9 @@ ch_ccmx_measure_patches_colorhug (ChCcmxPrivate *priv)
 		gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (w), (gfloat) i / (len - 1));
 		gtk_widget_set_visible (w, TRUE);
 		cd_it8_add_data (priv->gen_ti3_colorhug, &rgb, &xyz);
-		g_debug ("for %f,%f,%f got %f,%f,%f",
+		g_debug ("for %f,%f,%f got %f,%f,%f at integral time 0x%04x",
 			 rgb.R, rgb.G, rgb.B,
-			 xyz.X, xyz.Y, xyz.Z);
+			 xyz.X, xyz.Y, xyz.Z, integral_time);
 	}
 
 	/* set next page */
@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <locale.h>
 #include <stdio.h>
@@ -31,75 +32,575 @@
 #include <colorhug.h>
 #include <libsoup/soup.h>
 
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#endif
+
+#include "ch-autorange.h"
+#include "ch-stats.h"
+
+typedef struct {
+	GString			*events;
+	GTimer			*timer;
+} ChUtilTrace;
+
+/* what one device queue is doing, as each device gets its own queue */
+typedef struct {
+	ChUtilTrace		*trace;
+	guint			 tid;
+	gdouble			 queued;
+	gdouble			 mark;
+	guint			 requests;
+	gchar			*command;
+	gchar			*device;
+} ChUtilTraceSpan;
+
 typedef struct {
 	ChDeviceQueue		*device_queue;
 	GOptionContext		*context;
-	GPtrArray		*cmd_array;
+	const struct _ChUtilItem *cmd_items;
+	guint			 cmd_items_len;
+	GUsbContext		*usb_ctx;
 	GUsbDevice		*device;
+	GPtrArray		*devices;
 	SoupSession		*session;
+	GPtrArray		*result;
+	ChUtilTrace		*trace;
+	ChUtilTraceSpan		*trace_span;
+	gboolean		 json;
+	gboolean		 pipeline;
 } ChUtilPrivate;
 
 typedef gboolean (*ChUtilPrivateCb)	(ChUtilPrivate	*util,
 					 gchar		**values,
 					 GError		**error);
 
+typedef gboolean (*ChUtilPrintCb)	(ChUtilPrivate	*util,
+					 gpointer	 user_data,
+					 GError		**error);
+
 typedef struct {
-	gchar		*name;
-	gchar		*description;
+	gchar		*command;
+	ChUtilPrintCb	 print_cb;
+	gpointer	 user_data;
+	gdouble		 queued;
+} ChUtilPending;
+
+typedef gboolean (*ChUtilQueueCb)	(ChUtilPrivate	*util,
+					 gchar		**values,
+					 ChUtilPending	*pending,
+					 GError		**error);
+
+typedef enum {
+	CH_UTIL_ITEM_FLAG_NONE		= 0,
+	CH_UTIL_ITEM_FLAG_ALL_DEVICES	= 1 << 0,	/* finds its own devices */
+	CH_UTIL_ITEM_FLAG_NO_DEVICE	= 1 << 1,	/* never uses the device */
+	CH_UTIL_ITEM_FLAG_RESETS	= 1 << 2,	/* the device goes away */
+} ChUtilItemFlags;
+
+typedef struct _ChUtilItem {
+	const gchar	*name;
+	const gchar	*description;	/* untranslated */
 	ChUtilPrivateCb	 callback;
+	ChUtilQueueCb	 queue_cb;
+	ChUtilItemFlags	 flags;
 } ChUtilItem;
 
 static void
-ch_util_item_free (ChUtilItem *item)
+ch_util_pending_free (ChUtilPending *pending)
 {
-	g_free (item->name);
-	g_free (item->description);
-	g_free (item);
+	g_free (pending->command);
+	g_free (pending->user_data);
+	g_free (pending);
 }
 
-static gint
-cd_sort_command_name_cb (ChUtilItem **item1, ChUtilItem **item2)
+static void
+ch_util_pending_set (ChUtilPending *pending, ChUtilPrintCb print_cb, gpointer user_data)
+{
+	pending->print_cb = print_cb;
+	pending->user_data = user_data;
+}
+
+static GPrintFunc ch_util_print_func_old = NULL;
+static GString *ch_util_print_capture = NULL;
+
+static void
+ch_util_print_capture_cb (const gchar *string)
+{
+	g_string_append (ch_util_print_capture, string);
+}
+
+/* bypasses any output capture, for output that has to appear straight away */
+static void
+ch_util_print_raw (const gchar *string)
+{
+	if (ch_util_print_func_old != NULL) {
+		ch_util_print_func_old (string);
+		return;
+	}
+	fputs (string, stdout);
+	fflush (stdout);
+}
+
+static void
+ch_util_json_append_string (GString *str, const gchar *value)
+{
+	const gchar *tmp;
+
+	if (value == NULL) {
+		g_string_append (str, "null");
+		return;
+	}
+	g_string_append_c (str, '"');
+	for (tmp = value; *tmp != '\0'; tmp++) {
+		switch (*tmp) {
+		case '"':
+			g_string_append (str, "\\\"");
+			break;
+		case '\\':
+			g_string_append (str, "\\\\");
+			break;
+		case '\n':
+			g_string_append (str, "\\n");
+			break;
+		case '\t':
+			g_string_append (str, "\\t");
+			break;
+		default:
+			if ((guchar) *tmp < 0x20)
+				g_string_append_printf (str, "\\u%04x", (guint) *tmp);
+			else
+				g_string_append_c (str, *tmp);
+		}
+	}
+	g_string_append_c (str, '"');
+}
+
+static void
+ch_util_json_append_double (GString *str, gdouble value)
+{
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	/* JSON has no representation of these */
+	if (isnan (value) || isinf (value)) {
+		g_string_append (str, "null");
+		return;
+	}
+	g_string_append (str, g_ascii_dtostr (buf, sizeof (buf), value));
+}
+
+static void
+ch_util_result_add_raw (ChUtilPrivate *priv, const gchar *key, const gchar *value)
+{
+	GString *str;
+
+	/* not in machine readable mode */
+	if (priv->result == NULL)
+		return;
+	str = g_string_new ("");
+	ch_util_json_append_string (str, key);
+	g_string_append_printf (str, ":%s", value);
+	g_ptr_array_add (priv->result, g_string_free (str, FALSE));
+}
+
+static void
+ch_util_result_add_string (ChUtilPrivate *priv, const gchar *key, const gchar *value)
+{
+	g_autoptr(GString) str = g_string_new ("");
+	ch_util_json_append_string (str, value);
+	ch_util_result_add_raw (priv, key, str->str);
+}
+
+static void
+ch_util_result_add_int (ChUtilPrivate *priv, const gchar *key, gint64 value)
+{
+	g_autofree gchar *tmp = g_strdup_printf ("%" G_GINT64_FORMAT, value);
+	ch_util_result_add_raw (priv, key, tmp);
+}
+
+static void
+ch_util_result_add_bool (ChUtilPrivate *priv, const gchar *key, gboolean value)
+{
+	ch_util_result_add_raw (priv, key, value ? "true" : "false");
+}
+
+static void
+ch_util_result_add_double (ChUtilPrivate *priv, const gchar *key, gdouble value)
+{
+	g_autoptr(GString) str = g_string_new ("");
+	ch_util_json_append_double (str, value);
+	ch_util_result_add_raw (priv, key, str->str);
+}
+
+static void
+ch_util_result_add_doubles (ChUtilPrivate *priv, const gchar *key,
+			    const gdouble *values, guint len)
 {
-	return g_strcmp0 ((*item1)->name, (*item2)->name);
+	guint i;
+	g_autoptr(GString) str = g_string_new ("[");
+	for (i = 0; i < len; i++) {
+		if (i > 0)
+			g_string_append_c (str, ',');
+		ch_util_json_append_double (str, values[i]);
+	}
+	g_string_append_c (str, ']');
+	ch_util_result_add_raw (priv, key, str->str);
+}
+
+static void
+ch_util_result_add_hex (ChUtilPrivate *priv, const gchar *key,
+			const guint8 *data, gsize len)
+{
+	gsize i;
+	g_autoptr(GString) str = g_string_new ("\"");
+	for (i = 0; i < len; i++)
+		g_string_append_printf (str, "%02x", data[i]);
+	g_string_append_c (str, '"');
+	ch_util_result_add_raw (priv, key, str->str);
+}
+
+static void
+ch_util_result_add_triple (ChUtilPrivate *priv, const gchar *key,
+			   const gchar *n0, gdouble v0,
+			   const gchar *n1, gdouble v1,
+			   const gchar *n2, gdouble v2)
+{
+	g_autoptr(GString) str = g_string_new ("{");
+	ch_util_json_append_string (str, n0);
+	g_string_append_c (str, ':');
+	ch_util_json_append_double (str, v0);
+	g_string_append_c (str, ',');
+	ch_util_json_append_string (str, n1);
+	g_string_append_c (str, ':');
+	ch_util_json_append_double (str, v1);
+	g_string_append_c (str, ',');
+	ch_util_json_append_string (str, n2);
+	g_string_append_c (str, ':');
+	ch_util_json_append_double (str, v2);
+	g_string_append_c (str, '}');
+	ch_util_result_add_raw (priv, key, str->str);
+}
+
+static void
+ch_util_result_add_summary (ChUtilPrivate *priv, const gchar *key,
+			    const ChStatsSummary *summary)
+{
+	const gchar *names[] = { "mean", "std_dev", "min", "max",
+				 "p5", "median", "p95", "mad" };
+	const gdouble values[] = { summary->mean, summary->std_dev,
+				   summary->min, summary->max,
+				   summary->p5, summary->median,
+				   summary->p95, summary->mad };
+	guint i;
+	g_autoptr(GString) str = g_string_new ("");
+
+	/* the mean and std_dev skip the outliers, the rest use all samples */
+	g_string_append_printf (str, "{\"len\":%u,\"outliers\":%u",
+				summary->len, summary->outliers);
+	for (i = 0; i < G_N_ELEMENTS (names); i++) {
+		g_string_append_c (str, ',');
+		ch_util_json_append_string (str, names[i]);
+		g_string_append_c (str, ':');
+		ch_util_json_append_double (str, values[i]);
+	}
+	g_string_append_c (str, '}');
+	ch_util_result_add_raw (priv, key, str->str);
+}
+
+static void
+ch_util_json_begin (ChUtilPrivate *priv)
+{
+	if (!priv->json)
+		return;
+
+	/* collect anything printed by the command rather than showing it */
+	priv->result = g_ptr_array_new_with_free_func (g_free);
+	ch_util_print_capture = g_string_new ("");
+	ch_util_print_func_old = g_set_print_handler (ch_util_print_capture_cb);
 }
 
 static void
-ch_util_add (GPtrArray *array, const gchar *name, const gchar *description, ChUtilPrivateCb callback)
+ch_util_json_end (ChUtilPrivate *priv, const gchar *command, const GError *error)
 {
 	guint i;
-	ChUtilItem *item;
-	g_auto(GStrv) names = NULL;
+	g_auto(GStrv) lines = NULL;
+	g_autoptr(GString) str = NULL;
+
+	if (priv->result == NULL)
+		return;
+	g_set_print_handler (ch_util_print_func_old);
+	ch_util_print_func_old = NULL;
+
+	/* one object per command, on a single line */
+	str = g_string_new ("{\"command\":");
+	ch_util_json_append_string (str, command);
+	if (priv->device != NULL) {
+		g_string_append (str, ",\"device\":");
+		ch_util_json_append_string (str, g_usb_device_get_platform_id (priv->device));
+	}
+	g_string_append_printf (str, ",\"success\":%s",
+				error == NULL ? "true" : "false");
+
+	/* structured results */
+	g_string_append (str, ",\"result\":");
+	if (priv->result->len > 0) {
+		g_string_append_c (str, '{');
+		for (i = 0; i < priv->result->len; i++) {
+			if (i > 0)
+				g_string_append_c (str, ',');
+			g_string_append (str, g_ptr_array_index (priv->result, i));
+		}
+		g_string_append_c (str, '}');
+	} else {
+		g_string_append (str, "null");
+	}
 
-	/* add each one */
-	names = g_strsplit (name, ",", -1);
-	for (i=0; names[i] != NULL; i++) {
-		item = g_new0 (ChUtilItem, 1);
-		item->name = g_strdup (names[i]);
-		if (i == 0) {
-			item->description = g_strdup (description);
-		} else {
-			/* TRANSLATORS: this is a command alias */
-			item->description = g_strdup_printf (_("Alias to %s"),
-							     names[0]);
+	/* the command has no structured results, so pass on the text */
+	if (priv->result->len == 0 && ch_util_print_capture->len > 0) {
+		g_string_append (str, ",\"output\":[");
+		g_strchomp (ch_util_print_capture->str);
+		lines = g_strsplit (ch_util_print_capture->str, "\n", -1);
+		for (i = 0; lines[i] != NULL; i++) {
+			if (i > 0)
+				g_string_append_c (str, ',');
+			ch_util_json_append_string (str, lines[i]);
 		}
-		item->callback = callback;
-		g_ptr_array_add (array, item);
+		g_string_append_c (str, ']');
+	}
+	g_string_append (str, ",\"error\":");
+	ch_util_json_append_string (str, error != NULL ? error->message : NULL);
+	g_string_append (str, "}\n");
+	g_print ("%s", str->str);
+
+	g_string_free (ch_util_print_capture, TRUE);
+	ch_util_print_capture = NULL;
+	g_clear_pointer (&priv->result, g_ptr_array_unref);
+}
+
+static ChUtilTrace *
+ch_util_trace_new (void)
+{
+	ChUtilTrace *trace = g_new0 (ChUtilTrace, 1);
+	trace->events = g_string_new ("");
+	trace->timer = g_timer_new ();
+	return trace;
+}
+
+static void
+ch_util_trace_free (ChUtilTrace *trace)
+{
+	g_string_free (trace->events, TRUE);
+	g_timer_destroy (trace->timer);
+	g_free (trace);
+}
+
+static ChUtilTraceSpan *
+ch_util_trace_span_new (ChUtilTrace *trace, guint tid)
+{
+	ChUtilTraceSpan *span = g_new0 (ChUtilTraceSpan, 1);
+	span->trace = trace;
+	span->tid = tid;
+	return span;
+}
+
+static void
+ch_util_trace_span_free (ChUtilTraceSpan *span)
+{
+	g_free (span->command);
+	g_free (span->device);
+	g_free (span);
+}
+
+static gdouble
+ch_util_trace_now (ChUtilTrace *trace)
+{
+	return g_timer_elapsed (trace->timer, NULL);
+}
+
+/* adds a complete event, with times in seconds since startup */
+static void
+ch_util_trace_add (ChUtilTrace *trace,
+		   const gchar *cat,
+		   const gchar *name,
+		   guint tid,
+		   gdouble start,
+		   gdouble end,
+		   const gchar *args)
+{
+	if (trace->events->len > 0)
+		g_string_append (trace->events, ",\n");
+	g_string_append (trace->events, "{\"name\":");
+	ch_util_json_append_string (trace->events, name);
+	g_string_append (trace->events, ",\"cat\":");
+	ch_util_json_append_string (trace->events, cat);
+	g_string_append_printf (trace->events,
+				",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+				"\"ts\":%.0f,\"dur\":%.0f",
+				tid, start * G_USEC_PER_SEC,
+				(end - start) * G_USEC_PER_SEC);
+	if (args != NULL)
+		g_string_append_printf (trace->events, ",\"args\":%s", args);
+	g_string_append_c (trace->events, '}');
+}
+
+/* call when a command starts queueing requests, @queued being when it did */
+static void
+ch_util_trace_submit (ChUtilPrivate *priv, const gchar *command, gdouble queued)
+{
+	ChUtilTraceSpan *span = priv->trace_span;
+
+	if (span == NULL)
+		return;
+	span->queued = queued;
+	span->mark = ch_util_trace_now (span->trace);
+	span->requests = 0;
+	g_free (span->command);
+	span->command = g_strdup (command);
+	g_free (span->device);
+	span->device = NULL;
+	if (priv->device != NULL)
+		span->device = g_strdup (g_usb_device_get_platform_id (priv->device));
+}
+
+static void
+ch_util_trace_submit_pending (ChUtilPrivate *priv, GPtrArray *pending_array)
+{
+	guint i;
+	g_autoptr(GString) command = NULL;
+
+	if (priv->trace_span == NULL || pending_array->len == 0)
+		return;
+	command = g_string_new ("");
+	for (i = 0; i < pending_array->len; i++) {
+		ChUtilPending *pending = g_ptr_array_index (pending_array, i);
+		if (pending->command == NULL)
+			continue;
+		if (command->len > 0)
+			g_string_append_c (command, ',');
+		g_string_append (command, pending->command);
+	}
+	ch_util_trace_submit (priv, command->str,
+			      ((ChUtilPending *) g_ptr_array_index (pending_array, 0))->queued);
+}
+
+/* call just before the queue is sent to the device, so the first request
+ * does not include the time spent between transactions */
+static void
+ch_util_trace_begin (ChUtilPrivate *priv)
+{
+	if (priv->trace_span == NULL)
+		return;
+	priv->trace_span->mark = ch_util_trace_now (priv->trace_span->trace);
+}
+
+static gboolean
+ch_util_queue_process (ChUtilPrivate *priv,
+		       ChDeviceQueueProcessFlags process_flags,
+		       GError **error)
+{
+	ch_util_trace_begin (priv);
+	return ch_device_queue_process (priv->device_queue,
+					process_flags,
+					NULL,
+					error);
+}
+
+static void
+ch_util_trace_progress_cb (ChDeviceQueue *device_queue,
+			   guint percentage,
+			   ChUtilTraceSpan *span)
+{
+	gdouble now = ch_util_trace_now (span->trace);
+	g_autofree gchar *name = NULL;
+	g_autoptr(GString) args = NULL;
+
+	/* each request in the queue has just completed; the queue only
+	 * reports how far through it is, so record what queued it and
+	 * where it is in the queue */
+	name = g_strdup_printf ("%s #%u",
+				span->command != NULL ? span->command : "request",
+				++span->requests);
+	args = g_string_new ("{\"command\":");
+	ch_util_json_append_string (args, span->command);
+	g_string_append (args, ",\"device\":");
+	ch_util_json_append_string (args, span->device);
+	g_string_append_printf (args, ",\"request\":%u,\"progress\":%u,"
+				"\"queued\":%.0f}",
+				span->requests, percentage,
+				span->queued * G_USEC_PER_SEC);
+	ch_util_trace_add (span->trace, "request", name, span->tid,
+			   span->mark, now, args->str);
+	span->mark = now;
+}
+
+static void
+ch_util_trace_add_command (ChUtilPrivate *priv,
+			   const gchar *command,
+			   gchar **values,
+			   guint tid,
+			   gdouble start,
+			   gdouble end,
+			   const GError *error)
+{
+	guint i;
+	g_autoptr(GString) args = NULL;
+
+	if (priv->trace == NULL)
+		return;
+	args = g_string_new ("{\"values\":[");
+	for (i = 0; values != NULL && values[i] != NULL; i++) {
+		if (i > 0)
+			g_string_append_c (args, ',');
+		ch_util_json_append_string (args, values[i]);
+	}
+	g_string_append_c (args, ']');
+	if (error != NULL) {
+		g_string_append (args, ",\"error\":");
+		ch_util_json_append_string (args, error->message);
 	}
+	g_string_append_c (args, '}');
+	ch_util_trace_add (priv->trace, "command", command, tid,
+			   start, end, args->str);
+}
+
+static gboolean
+ch_util_trace_save (ChUtilTrace *trace, const gchar *filename, GError **error)
+{
+	g_autofree gchar *data = NULL;
+	data = g_strdup_printf ("{\"traceEvents\":[\n%s\n],"
+				"\"displayTimeUnit\":\"ms\"}\n",
+				trace->events->str);
+	return g_file_set_contents (filename, data, -1, error);
+}
+
+/* translating every description is only worth it when they are shown */
+static gboolean
+ch_util_wants_help (gint argc, gchar **argv)
+{
+	gint i;
+	for (i = 1; i < argc; i++) {
+		if (g_str_has_prefix (argv[i], "--help") ||
+		    g_strcmp0 (argv[i], "-h") == 0 ||
+		    g_strcmp0 (argv[i], "-?") == 0)
+			return TRUE;
+	}
+	return FALSE;
 }
 
 static gchar *
-ch_util_get_descriptions (GPtrArray *array)
+ch_util_get_descriptions (ChUtilPrivate *priv)
 {
 	guint i;
 	guint j;
 	guint len;
 	guint max_len = 0;
-	ChUtilItem *item;
+	const ChUtilItem *item;
 	GString *string;
 
 	/* get maximum command length */
-	for (i = 0; i < array->len; i++) {
-		item = g_ptr_array_index (array, i);
+	for (i = 0; i < priv->cmd_items_len; i++) {
+		item = &priv->cmd_items[i];
 		len = strlen (item->name);
 		if (len > max_len)
 			max_len = len;
@@ -111,14 +612,14 @@ ch_util_get_descriptions (GPtrArray *array)
 
 	/* print each command */
 	string = g_string_new ("");
-	for (i = 0; i < array->len; i++) {
-		item = g_ptr_array_index (array, i);
+	for (i = 0; i < priv->cmd_items_len; i++) {
+		item = &priv->cmd_items[i];
 		g_string_append (string, "  ");
 		g_string_append (string, item->name);
 		len = strlen (item->name);
 		for (j = len; j < max_len+3; j++)
 			g_string_append_c (string, ' ');
-		g_string_append (string, item->description);
+		g_string_append (string, _(item->description));
 		g_string_append_c (string, '\n');
 	}
 
@@ -129,118 +630,444 @@ ch_util_get_descriptions (GPtrArray *array)
 	return g_string_free (string, FALSE);
 }
 
-static gboolean
-ch_util_run (ChUtilPrivate *priv, const gchar *command, gchar **values, GError **error)
+static gint
+ch_util_item_compare_cb (gconstpointer key, gconstpointer element)
+{
+	const ChUtilItem *item = (const ChUtilItem *) element;
+	return strcmp ((const gchar *) key, item->name);
+}
+
+static const ChUtilItem *
+ch_util_find_item (ChUtilPrivate *priv, const gchar *command, GError **error)
 {
-	ChUtilItem *item;
+	const ChUtilItem *item;
 	guint i;
 	g_autoptr(GString) string = NULL;
 
 	/* find command */
-	for (i = 0; i < priv->cmd_array->len; i++) {
-		item = g_ptr_array_index (priv->cmd_array, i);
-		if (g_strcmp0 (item->name, command) == 0)
-			return item->callback (priv, values, error);
+	if (command != NULL) {
+		item = bsearch (command,
+				priv->cmd_items,
+				priv->cmd_items_len,
+				sizeof (ChUtilItem),
+				ch_util_item_compare_cb);
+		if (item != NULL)
+			return item;
 	}
 
 	/* not found */
 	string = g_string_new ("");
 	/* TRANSLATORS: error message */
 	g_string_append_printf (string, "%s\n", _("Command not found, valid commands are:"));
-	for (i = 0; i < priv->cmd_array->len; i++) {
-		item = g_ptr_array_index (priv->cmd_array, i);
-		g_string_append_printf (string, " * %s\n", item->name);
-	}
+	for (i = 0; i < priv->cmd_items_len; i++)
+		g_string_append_printf (string, " * %s\n", priv->cmd_items[i].name);
 	g_set_error_literal (error, 1, 0, string->str);
-	return FALSE;
+	return NULL;
 }
 
 static gboolean
-ch_util_get_prompt (const gchar *question, gboolean defaultyes)
+ch_util_print_pending (ChUtilPrivate *priv, GPtrArray *pending_array, GError **error)
 {
-	gchar value;
-	g_print ("%s %s ", question, defaultyes ? "[Y/n]" : "[N/y]");
-	while (TRUE) {
-		value = getchar ();
-		if (value == 'y' || value == 'Y')
-			return TRUE;
-		if (value == 'n' || value == 'N')
+	ChUtilPending *pending;
+	guint i;
+
+	/* print the results in the order the commands were given */
+	for (i = 0; i < pending_array->len; i++) {
+		gboolean json_each = priv->json && priv->result == NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		pending = g_ptr_array_index (pending_array, i);
+		if (json_each)
+			ch_util_json_begin (priv);
+		if (pending->print_cb != NULL)
+			pending->print_cb (priv, pending->user_data, &error_local);
+		if (json_each)
+			ch_util_json_end (priv, pending->command, error_local);
+		if (error_local != NULL) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
 			return FALSE;
-		if (value == '\n')
-			return defaultyes;
+		}
 	}
-	return FALSE;
+	return TRUE;
+}
+
+static gboolean
+ch_util_process_pending (ChUtilPrivate *priv, GPtrArray *pending_array, GError **error)
+{
+	/* send every queued request to the device in one go */
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+	return ch_util_print_pending (priv, pending_array, error);
+}
+
+typedef struct {
+	ChUtilPrivate		 priv;
+	GPtrArray		*pending_array;
+	GError			*error;
+	GMainLoop		*loop;
+	GTimer			*timer;
+	gchar			*prefix;
+	gdouble			 elapsed;
+	gdouble			 started;
+	guint			*remaining;
+} ChUtilTarget;
+
+static ChUtilTarget *
+ch_util_target_new (ChUtilPrivate *priv, GUsbDevice *device, guint idx)
+{
+	ChUtilTarget *target = g_new0 (ChUtilTarget, 1);
+
+	/* each device gets its own queue so they can run concurrently */
+	target->priv = *priv;
+	target->priv.devices = NULL;
+	target->priv.device = g_object_ref (device);
+	target->priv.device_queue = ch_device_queue_new ();
+	target->priv.trace_span = NULL;
+	if (priv->trace != NULL) {
+		target->priv.trace_span = ch_util_trace_span_new (priv->trace, idx + 1);
+		g_signal_connect (target->priv.device_queue, "progress-changed",
+				  G_CALLBACK (ch_util_trace_progress_cb),
+				  target->priv.trace_span);
+	}
+	target->pending_array = g_ptr_array_new_with_free_func ((GDestroyNotify) ch_util_pending_free);
+	target->timer = g_timer_new ();
+	target->prefix = g_strdup_printf ("[%u] ", idx);
+	return target;
+}
+
+static void
+ch_util_target_free (ChUtilTarget *target)
+{
+	g_object_unref (target->priv.device);
+	g_object_unref (target->priv.device_queue);
+	if (target->priv.trace_span != NULL)
+		ch_util_trace_span_free (target->priv.trace_span);
+	g_ptr_array_unref (target->pending_array);
+	g_timer_destroy (target->timer);
+	g_clear_error (&target->error);
+	g_free (target->prefix);
+	g_free (target);
+}
+
+static const gchar *ch_util_print_prefix = NULL;
+static gboolean ch_util_print_newline = TRUE;
+
+static void
+ch_util_print_prefixed_cb (const gchar *string)
+{
+	const gchar *tmp;
+
+	/* prefix every line with the device it came from */
+	for (tmp = string; *tmp != '\0'; tmp++) {
+		if (ch_util_print_newline && ch_util_print_prefix != NULL)
+			fputs (ch_util_print_prefix, stdout);
+		fputc (*tmp, stdout);
+		ch_util_print_newline = (*tmp == '\n');
+	}
+	fflush (stdout);
+}
+
+static void
+ch_util_run_item_all_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	ChUtilTarget *target = (ChUtilTarget *) user_data;
+
+	/* get result */
+	target->elapsed = g_timer_elapsed (target->timer, NULL);
+	ch_device_queue_process_finish (CH_DEVICE_QUEUE (source), res, &target->error);
+
+	/* all devices have finished */
+	if (--(*target->remaining) == 0)
+		g_main_loop_quit (target->loop);
 }
 
 static gboolean
-ch_util_get_color_select (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_run_item_all (ChUtilPrivate *priv, const ChUtilItem *item, gchar **values, GError **error)
 {
+	ChUtilTarget *target;
+	GPrintFunc print_func_old = NULL;
 	gboolean ret;
-	ChColorSelect color_select = 0;
+	guint failed = 0;
+	guint i;
+	guint remaining;
+	g_autoptr(GMainLoop) loop = NULL;
+	g_autoptr(GPtrArray) targets = NULL;
+
+	targets = g_ptr_array_new_with_free_func ((GDestroyNotify) ch_util_target_free);
+	for (i = 0; i < priv->devices->len; i++) {
+		GUsbDevice *device = g_ptr_array_index (priv->devices, i);
+		g_ptr_array_add (targets, ch_util_target_new (priv, device, i));
+	}
 
-	/* get from HW */
-	ch_device_queue_get_color_select (priv->device_queue,
-					  priv->device,
-					  &color_select);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
+	if (item->queue_cb != NULL) {
+		/* queue the requests for every device */
+		for (i = 0; i < targets->len; i++) {
+			ChUtilPending *pending = g_new0 (ChUtilPending, 1);
+			target = g_ptr_array_index (targets, i);
+			g_ptr_array_add (target->pending_array, pending);
+			if (priv->trace != NULL) {
+				ch_util_trace_submit (&target->priv, item->name,
+						      ch_util_trace_now (priv->trace));
+			}
+			/* share the web session, which the command may create */
+			target->priv.session = priv->session;
+			ret = item->queue_cb (&target->priv, values, pending, error);
+			priv->session = target->priv.session;
+			if (!ret)
+				return FALSE;
+		}
 
-	switch (color_select) {
-	case CH_COLOR_SELECT_BLUE:
-	case CH_COLOR_SELECT_RED:
-	case CH_COLOR_SELECT_GREEN:
-	case CH_COLOR_SELECT_WHITE:
-		g_print ("%s\n", ch_color_select_to_string (color_select));
-		break;
-	default:
+		/* process them all at the same time */
+		loop = g_main_loop_new (NULL, FALSE);
+		remaining = targets->len;
+		for (i = 0; i < targets->len; i++) {
+			target = g_ptr_array_index (targets, i);
+			target->loop = loop;
+			target->remaining = &remaining;
+			g_timer_start (target->timer);
+			if (priv->trace != NULL)
+				target->started = ch_util_trace_now (priv->trace);
+			ch_util_trace_begin (&target->priv);
+			ch_device_queue_process_async (target->priv.device_queue,
+						       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+						       NULL,
+						       ch_util_run_item_all_cb,
+						       target);
+		}
+		g_main_loop_run (loop);
+
+		/* print the results in device order */
+		if (!priv->json)
+			print_func_old = g_set_print_handler (ch_util_print_prefixed_cb);
+		for (i = 0; i < targets->len; i++) {
+			target = g_ptr_array_index (targets, i);
+			ch_util_print_prefix = target->prefix;
+			ch_util_json_begin (&target->priv);
+			if (target->error == NULL) {
+				ch_util_print_pending (&target->priv,
+						       target->pending_array,
+						       &target->error);
+			}
+			ch_util_json_end (&target->priv, item->name, target->error);
+		}
+	} else {
+		/* the command talks to the device itself, so do one at a time */
+		if (!priv->json)
+			print_func_old = g_set_print_handler (ch_util_print_prefixed_cb);
+		for (i = 0; i < targets->len; i++) {
+			target = g_ptr_array_index (targets, i);
+			ch_util_print_prefix = target->prefix;
+			ch_util_json_begin (&target->priv);
+			g_timer_start (target->timer);
+			if (priv->trace != NULL) {
+				target->started = ch_util_trace_now (priv->trace);
+				ch_util_trace_submit (&target->priv, item->name,
+						      target->started);
+			}
+			/* share the web session, which the command may create */
+			target->priv.session = priv->session;
+			item->callback (&target->priv, values, &target->error);
+			priv->session = target->priv.session;
+			target->elapsed = g_timer_elapsed (target->timer, NULL);
+			ch_util_json_end (&target->priv, item->name, target->error);
+		}
+	}
+	if (!priv->json)
+		g_set_print_handler (print_func_old);
+	ch_util_print_prefix = NULL;
+
+	/* show the latency of each device on stderr */
+	for (i = 0; i < targets->len; i++) {
+		target = g_ptr_array_index (targets, i);
+		ch_util_trace_add_command (priv, item->name, values, i + 1,
+					   target->started,
+					   target->started + target->elapsed,
+					   target->error);
+		g_printerr ("%s%s\t%.2fms\t%s\n",
+			    target->prefix,
+			    g_usb_device_get_platform_id (target->priv.device),
+			    target->elapsed * 1000,
+			    target->error != NULL ? target->error->message : "OK");
+		if (target->error != NULL)
+			failed++;
+	}
+	if (failed > 0) {
 		g_set_error (error, 1, 0,
-			     "invalid color value %i",
-			     color_select);
+			     "command failed on %u of %u devices",
+			     failed, targets->len);
 		return FALSE;
 	}
 	return TRUE;
 }
 
 static gboolean
-ch_util_get_hardware_version (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_run_item_internal (ChUtilPrivate *priv, const ChUtilItem *item, gchar **values, GError **error)
 {
-	gboolean ret;
-	guint8 hw_version = 0;
-
-	/* get from HW */
-	ch_device_queue_get_hardware_version (priv->device_queue,
-					      priv->device,
-					      &hw_version);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
+	ChUtilPending *pending;
+	g_autoptr(GPtrArray) pending_array = NULL;
+
+	/* the command talks to the device itself */
+	if (item->callback != NULL)
+		return item->callback (priv, values, error);
+
+	/* queue the requests, then process them straight away */
+	pending_array = g_ptr_array_new_with_free_func ((GDestroyNotify) ch_util_pending_free);
+	pending = g_new0 (ChUtilPending, 1);
+	pending->command = g_strdup (item->name);
+	g_ptr_array_add (pending_array, pending);
+	if (!item->queue_cb (priv, values, pending, error))
 		return FALSE;
+	return ch_util_process_pending (priv, pending_array, error);
+}
 
-	switch (hw_version) {
-	case 0x00:
-		g_print ("Prototype Hardware\n");
-		break;
-	default:
-		g_print ("Hardware Version %i\n", hw_version);
+static gboolean
+ch_util_run_item (ChUtilPrivate *priv, const ChUtilItem *item, gchar **values, GError **error)
+{
+	gboolean ret;
+	gdouble start = 0.f;
+	g_autoptr(GError) error_local = NULL;
+
+	/* run on every selected device */
+	if (priv->devices != NULL &&
+	    (item->flags & CH_UTIL_ITEM_FLAG_ALL_DEVICES) == 0)
+		return ch_util_run_item_all (priv, item, values, error);
+
+	/* wrap the output up as one object */
+	if (priv->trace != NULL) {
+		start = ch_util_trace_now (priv->trace);
+		ch_util_trace_submit (priv, item->name, start);
+	}
+	ch_util_json_begin (priv);
+	ret = ch_util_run_item_internal (priv, item, values, &error_local);
+	ch_util_json_end (priv, item->name, error_local);
+	if (priv->trace != NULL) {
+		ch_util_trace_add_command (priv, item->name, values, 0, start,
+					   ch_util_trace_now (priv->trace),
+					   error_local);
+	}
+	if (!ret) {
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return FALSE;
 	}
 	return TRUE;
 }
 
 static gboolean
-ch_util_take_reading_array (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_run (ChUtilPrivate *priv, const gchar *command, gchar **values, GError **error)
+{
+	const ChUtilItem *item;
+
+	item = ch_util_find_item (priv, command, error);
+	if (item == NULL) {
+		ch_util_json_begin (priv);
+		ch_util_json_end (priv, command, *error);
+		return FALSE;
+	}
+	return ch_util_run_item (priv, item, values, error);
+}
+
+static gboolean
+ch_util_get_prompt (const gchar *question, gboolean defaultyes)
+{
+	gint value;
+
+	/* not g_print(), which is captured as the result with --json */
+	g_printerr ("%s %s ", question, defaultyes ? "[Y/n]" : "[N/y]");
+	while (TRUE) {
+		value = getchar ();
+		if (value == EOF)
+			return FALSE;
+		if (value == 'y' || value == 'Y')
+			return TRUE;
+		if (value == 'n' || value == 'N')
+			return FALSE;
+		if (value == '\n')
+			return defaultyes;
+	}
+	return FALSE;
+}
+
+static gboolean
+ch_util_get_color_select_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
+{
+	ChColorSelect *color_select = (ChColorSelect *) user_data;
+
+	switch (*color_select) {
+	case CH_COLOR_SELECT_BLUE:
+	case CH_COLOR_SELECT_RED:
+	case CH_COLOR_SELECT_GREEN:
+	case CH_COLOR_SELECT_WHITE:
+		g_print ("%s\n", ch_color_select_to_string (*color_select));
+		ch_util_result_add_string (priv, "color_select",
+					   ch_color_select_to_string (*color_select));
+		break;
+	default:
+		g_set_error (error, 1, 0,
+			     "invalid color value %i",
+			     *color_select);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_color_select (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	ChColorSelect *color_select = g_new0 (ChColorSelect, 1);
+
+	/* get from HW */
+	ch_device_queue_get_color_select (priv->device_queue,
+					  priv->device,
+					  color_select);
+	ch_util_pending_set (pending, ch_util_get_color_select_print, color_select);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_hardware_version_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
+{
+	guint8 *hw_version = (guint8 *) user_data;
+
+	ch_util_result_add_int (priv, "hardware_version", *hw_version);
+	switch (*hw_version) {
+	case 0x00:
+		g_print ("Prototype Hardware\n");
+		break;
+	default:
+		g_print ("Hardware Version %i\n", *hw_version);
+	}
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_hardware_version (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	guint8 *hw_version = g_new0 (guint8, 1);
+
+	/* get from HW */
+	ch_device_queue_get_hardware_version (priv->device_queue,
+					      priv->device,
+					      hw_version);
+	ch_util_pending_set (pending, ch_util_get_hardware_version_print, hw_version);
+	return TRUE;
+}
+
+/* robust standard deviations from the median before a sample is ignored */
+#define CH_UTIL_OUTLIER_THRESHOLD	3.f
+
+static gboolean
+ch_util_take_reading_array (ChUtilPrivate *priv, gchar **values, GError **error)
 {
+	ChStatsSummary summary;
 	gboolean ret;
-	gdouble ave = 0.0f;
+	gdouble ave;
+	gdouble std_dev;
+	gdouble tmp[30];
 	gint i, j;
 	guint8 max = 0;
 	guint8 reading_array[30];
-	gdouble std_dev = 0.0f;
 
 	/* setup HW */
 	if (ch_device_get_mode (priv->device) == CH_DEVICE_MODE_FIRMWARE) {
@@ -257,10 +1084,9 @@ ch_util_take_reading_array (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_take_reading_array (priv->device_queue,
 					    priv->device,
 					    reading_array);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				     error);
 	if (!ret)
 		return FALSE;
 
@@ -268,9 +1094,9 @@ ch_util_take_reading_array (ChUtilPrivate *priv, gchar **values, GError **error)
 	for (i = 0; i < 30; i++) {
 		if (reading_array[i] > max)
 			max = reading_array[i];
-		ave += reading_array[i];
+		tmp[i] = reading_array[i];
 	}
-	ave /= 30;
+	ave = ch_stats_mean (tmp, 30);
 	for (i = 0; i < 30; i++) {
 		g_print ("%i.\t%u\t[",
 			 i + 1,
@@ -292,80 +1118,222 @@ ch_util_take_reading_array (ChUtilPrivate *priv, gchar **values, GError **error)
 		g_print ("]\n");
 	}
 
-	/* print standard deviation */
-	for (i = 0; i < 30; i++)
-		std_dev += pow (reading_array[i] - ave, 2);
-	g_print ("Standard deviation: %.03lf\n", sqrt (std_dev / 60));
+	/* print statistics, where the summary moments skip the outliers */
+	std_dev = ch_stats_std_dev (tmp, 30);
+	ch_stats_summary_init (&summary, tmp, 30, CH_UTIL_OUTLIER_THRESHOLD);
+	g_print ("Standard deviation: %.03lf\n", std_dev);
+	if (summary.outliers > 0) {
+		g_print ("Standard deviation (%u outliers removed): %.03lf\n",
+			 summary.outliers, summary.std_dev);
+	}
+	g_print ("Median: %.01lf, 5%%: %.01lf, 95%%: %.01lf, MAD: %.01lf\n",
+		 summary.median, summary.p5, summary.p95, summary.mad);
+	ch_util_result_add_doubles (priv, "readings", tmp, 30);
+	ch_util_result_add_double (priv, "std_dev", std_dev);
+	ch_util_result_add_summary (priv, "stats", &summary);
+	return TRUE;
+}
+
+/* only the commands that talk to the web site need this */
+static gboolean
+ch_util_ensure_session (ChUtilPrivate *priv, GError **error)
+{
+	if (priv->session != NULL)
+		return TRUE;
+	priv->session = soup_session_new_with_options (SOUP_SESSION_USER_AGENT, "colorhug",
+						       SOUP_SESSION_TIMEOUT, 5000,
+						       NULL);
+	if (priv->session == NULL) {
+		/* TRANSLATORS: internal error when setting up HTTP */
+		g_set_error_literal (error, 1, 0, _("Failed to setup networking"));
+		return FALSE;
+	}
+
+	/* automatically use the correct proxies */
+	soup_session_add_feature_by_type (priv->session,
+					  SOUP_TYPE_PROXY_RESOLVER_DEFAULT);
 	return TRUE;
 }
 
+/* where uploaded profiles can be downloaded from, by SHA1 */
+#define CH_UTIL_PROFILE_BASE_URI	"http://www.hughski.com/uploads"
+
+static gboolean
+ch_util_file_has_sha1 (const gchar *filename, const gchar *sha1)
+{
+	GMappedFile *mapped_file;
+	g_autofree gchar *sha1_tmp = NULL;
+
+	mapped_file = g_mapped_file_new (filename, FALSE, NULL);
+	if (mapped_file == NULL)
+		return FALSE;
+	sha1_tmp = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+						(const guchar *) g_mapped_file_get_contents (mapped_file),
+						g_mapped_file_get_length (mapped_file));
+	g_mapped_file_unref (mapped_file);
+	return g_strcmp0 (sha1, sha1_tmp) == 0;
+}
+
+/* streams @uri into @filename, carrying on from where a previous attempt
+ * stopped if the server supports range requests */
+static gboolean
+ch_util_download_file (ChUtilPrivate *priv,
+		       const gchar *uri,
+		       const gchar *filename,
+		       GError **error)
+{
+	goffset offset = 0;
+	goffset range_start = -1;
+	goffset range_end;
+	goffset range_total;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GFileInfo) info = NULL;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GOutputStream) ostream = NULL;
+	g_autoptr(SoupMessage) msg = NULL;
+
+	/* continue a partial download */
+	file = g_file_new_for_path (filename);
+	info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+				  G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	if (info != NULL)
+		offset = g_file_info_get_size (info);
+
+	/* GET file */
+	msg = soup_message_new (SOUP_METHOD_GET, uri);
+	if (msg == NULL) {
+		g_set_error (error, 1, 0,
+			     "Failed to setup message for %s", uri);
+		return FALSE;
+	}
+	if (offset > 0) {
+		g_debug ("resuming %s from %" G_GOFFSET_FORMAT, uri, offset);
+		soup_message_headers_set_range (msg->request_headers, offset, -1);
+	}
+	if (!ch_util_ensure_session (priv, error))
+		return FALSE;
+	stream = soup_session_send (priv->session, msg, NULL, error);
+	if (stream == NULL)
+		return FALSE;
+
+	/* the partial file is as long or longer than the remote file, or the
+	 * server sent a different range to the one asked for, so start again */
+	if (offset > 0 && msg->status_code == SOUP_STATUS_PARTIAL_CONTENT)
+		soup_message_headers_get_content_range (msg->response_headers,
+							&range_start,
+							&range_end,
+							&range_total);
+	if (offset > 0 &&
+	    (msg->status_code == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE ||
+	     (msg->status_code == SOUP_STATUS_PARTIAL_CONTENT &&
+	      range_start != offset))) {
+		g_debug ("cannot resume %s, restarting", uri);
+		g_input_stream_close (stream, NULL, NULL);
+		if (g_unlink (filename) < 0) {
+			g_set_error (error, 1, 0,
+				     "Failed to delete %s", filename);
+			return FALSE;
+		}
+		return ch_util_download_file (priv, uri, filename, error);
+	}
+	if (msg->status_code == SOUP_STATUS_PARTIAL_CONTENT && offset > 0) {
+		ostream = G_OUTPUT_STREAM (g_file_append_to (file,
+							     G_FILE_CREATE_NONE,
+							     NULL,
+							     error));
+	} else if (msg->status_code == SOUP_STATUS_OK) {
+		ostream = G_OUTPUT_STREAM (g_file_replace (file, NULL, FALSE,
+							   G_FILE_CREATE_NONE,
+							   NULL,
+							   error));
+	} else {
+		g_set_error (error, 1, 0,
+			     "Failed to download file %s: %s",
+			     uri, msg->reason_phrase);
+		return FALSE;
+	}
+	if (ostream == NULL)
+		return FALSE;
+
+	/* write to disk as it arrives rather than keeping it in memory */
+	return g_output_stream_splice (ostream, stream,
+				       G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+				       G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+				       NULL, error) >= 0;
+}
+
 static gboolean
 ch_util_remote_profile_download (ChUtilPrivate *priv, gchar **values, GError **error)
 {
 	ChSha1 remote_hash;
-	gboolean ret;
-	guint status_code;
-	SoupURI *base_uri = NULL;
+	const gchar *base_uri;
+	gboolean cached;
+	g_autofree gchar *dirname = NULL;
 	g_autofree gchar *filename = NULL;
+	g_autofree gchar *filename_part = NULL;
 	g_autofree gchar *sha1 = NULL;
 	g_autofree gchar *uri = NULL;
-	g_autoptr(SoupMessage) msg = NULL;
 
 	/* get the remote hash from the device */
 	ch_device_queue_get_remote_hash (priv->device_queue,
 					 priv->device,
 					 &remote_hash);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		goto out;
-
-	/* print hash */
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
 	sha1 = ch_sha1_to_string (&remote_hash);
-	uri = g_strdup_printf ("http://www.hughski.com/uploads/%s.icc", sha1);
 
-	/* GET file */
-	base_uri = soup_uri_new (uri);
-	msg = soup_message_new_from_uri (SOUP_METHOD_GET, base_uri);
-	if (msg == NULL) {
-		/* TRANSLATORS: internal error when setting up HTTP request */
-		ret = FALSE;
-		g_set_error (error, 1, 0,
-			     "Failed to setup message");
-		goto out;
-	}
-	status_code = soup_session_send_message (priv->session, msg);
-	if (status_code != 200) {
-		ret = FALSE;
-		g_set_error (error, 1, 0,
-			     "Failed to download file %s: %s",
-			     uri, msg->reason_phrase);
-		goto out;
-	}
+	/* the profile is named after its own hash, so if it is already
+	 * in the users default icc folder there is nothing to do */
+	dirname = g_build_filename (g_get_user_data_dir (), "icc", NULL);
+	filename = g_strdup_printf ("%s/%s.icc", dirname, sha1);
+	cached = ch_util_file_has_sha1 (filename, sha1);
+	if (!cached) {
+		if (g_mkdir_with_parents (dirname, 0700) < 0) {
+			g_set_error (error, 1, 0,
+				     "Failed to create %s", dirname);
+			return FALSE;
+		}
 
-	/* copy this file into the users default icc folder */
-	filename = g_strdup_printf ("%s/%s/%s.icc",
-				    g_get_user_data_dir (),
-				    "icc",
-				    sha1);
-	ret = g_file_set_contents (filename,
-				   msg->response_body->data,
-				   msg->response_body->length,
-				   error);
-	if (!ret)
-		goto out;
+		/* allow a local mirror to be used */
+		base_uri = g_getenv ("COLORHUG_PROFILE_URI");
+		if (base_uri == NULL)
+			base_uri = CH_UTIL_PROFILE_BASE_URI;
+		uri = g_strdup_printf ("%s/%s.icc", base_uri, sha1);
+		filename_part = g_strdup_printf ("%s.part", filename);
+
+		/* an earlier attempt may have got all of it but not renamed
+		 * it, and asking for more would then fail */
+		if (!ch_util_file_has_sha1 (filename_part, sha1) &&
+		    !ch_util_download_file (priv, uri, filename_part, error))
+			return FALSE;
+
+		/* a partial file left by a different download is no use */
+		if (!ch_util_file_has_sha1 (filename_part, sha1)) {
+			g_unlink (filename_part);
+			g_set_error (error, 1, 0,
+				     "Downloaded file %s does not match %s",
+				     uri, sha1);
+			return FALSE;
+		}
+		if (g_rename (filename_part, filename) < 0) {
+			g_set_error (error, 1, 0,
+				     "Failed to rename %s", filename_part);
+			return FALSE;
+		}
+	}
 
 	/* print something */
 	if (g_strcmp0 (g_getenv ("COLORHUG_OUTPUT"), "plain") == 0)
 		g_print ("%s\n", filename);
+	else if (cached)
+		g_print ("Remote profile already in %s\n", filename);
 	else
 		g_print ("Copied remote profile into %s\n", filename);
-out:
-	if (base_uri != NULL)
-		soup_uri_free (base_uri);
-	return ret;
+	ch_util_result_add_string (priv, "filename", filename);
+	ch_util_result_add_bool (priv, "cached", cached);
+	return TRUE;
 }
 
 static gboolean
@@ -410,6 +1378,10 @@ ch_util_remote_profile_upload (ChUtilPrivate *priv, gchar **values, GError **err
 					 NULL,
 					 buffer);
 	msg = soup_form_request_new_from_multipart ("http://www.hughski.com/profile-store.php", multipart);
+	if (!ch_util_ensure_session (priv, error)) {
+		ret = FALSE;
+		goto out;
+	}
 	status_code = soup_session_send_message (priv->session, msg);
 	if (status_code != 201) {
 		ret = FALSE;
@@ -426,6 +1398,7 @@ ch_util_remote_profile_upload (ChUtilPrivate *priv, gchar **values, GError **err
 		g_print ("%s\n", uri);
 	else
 		g_print ("Uploaded profile to %s\n", uri);
+	ch_util_result_add_string (priv, "uri", uri);
 
 	/* set SHA1 hash to device */
 	sha1 = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
@@ -441,10 +1414,9 @@ ch_util_remote_profile_upload (ChUtilPrivate *priv, gchar **values, GError **err
 	ch_device_queue_write_eeprom (priv->device_queue,
 				      priv->device,
 				      CH_WRITE_EEPROM_MAGIC);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				     error);
 	if (!ret)
 		goto out;
 out:
@@ -489,6 +1461,10 @@ ch_util_ccmx_upload (ChUtilPrivate *priv, gchar **values, GError **error)
 					 NULL,
 					 buffer);
 	msg = soup_form_request_new_from_multipart ("http://www.hughski.com/ccmx-store.php", multipart);
+	if (!ch_util_ensure_session (priv, error)) {
+		ret = FALSE;
+		goto out;
+	}
 	status_code = soup_session_send_message (priv->session, msg);
 	if (!SOUP_STATUS_IS_SUCCESSFUL (status_code)) {
 		ret = FALSE;
@@ -505,6 +1481,7 @@ ch_util_ccmx_upload (ChUtilPrivate *priv, gchar **values, GError **error)
 		g_print ("%s\n", uri);
 	else
 		g_print ("Uploaded CCMX to %s\n", uri);
+	ch_util_result_add_string (priv, "uri", uri);
 out:
 	if (buffer != NULL)
 		soup_buffer_free (buffer);
@@ -514,7 +1491,7 @@ out:
 }
 
 static gboolean
-ch_util_set_color_select (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_color_select (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	ChColorSelect color_select;
 
@@ -543,48 +1520,49 @@ ch_util_set_color_select (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_set_color_select (priv->device_queue,
 					  priv->device,
 					  color_select);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
-ch_util_get_multiplier (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_multiplier_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	ChFreqScale multiplier = CH_FREQ_SCALE_0;
-
-	/* get from HW */
-	ch_device_queue_get_multiplier (priv->device_queue, priv->device,
-					&multiplier);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
+	ChFreqScale *multiplier = (ChFreqScale *) user_data;
 
-	switch (multiplier) {
+	switch (*multiplier) {
 	case CH_FREQ_SCALE_0:
 		g_print ("0%% (disabled)\n");
+		ch_util_result_add_string (priv, "multiplier", "0%");
 		break;
 	case CH_FREQ_SCALE_2:
 	case CH_FREQ_SCALE_20:
 	case CH_FREQ_SCALE_100:
-		g_print ("%s\n", ch_multiplier_to_string (multiplier));
+		g_print ("%s\n", ch_multiplier_to_string (*multiplier));
+		ch_util_result_add_string (priv, "multiplier",
+					   ch_multiplier_to_string (*multiplier));
 		break;
 	default:
 		g_set_error (error, 1, 0,
 			     "invalid multiplier value %i",
-			     multiplier);
+			     *multiplier);
 		return FALSE;
 	}
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_multiplier (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_multiplier (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	ChFreqScale *multiplier = g_new0 (ChFreqScale, 1);
+
+	/* get from HW */
+	ch_device_queue_get_multiplier (priv->device_queue, priv->device,
+					multiplier);
+	ch_util_pending_set (pending, ch_util_get_multiplier_print, multiplier);
+	return TRUE;
+}
+
+static gboolean
+ch_util_set_multiplier (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	ChFreqScale multiplier;
 
@@ -612,10 +1590,7 @@ ch_util_set_multiplier (ChUtilPrivate *priv, gchar **values, GError **error)
 	/* set to HW */
 	ch_device_queue_set_multiplier (priv->device_queue, priv->device,
 					multiplier);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
@@ -633,6 +1608,7 @@ ch_util_get_integral_time (ChUtilPrivate *priv, gchar **values, GError **error)
 		return FALSE;
 
 	g_print ("%i\n", integral_time);
+	ch_util_result_add_int (priv, "integral_time", integral_time);
 	return TRUE;
 }
 
@@ -656,33 +1632,40 @@ ch_util_set_integral_time (ChUtilPrivate *priv, gchar **values, GError **error)
 					    error);
 }
 
+static gboolean
+ch_util_get_calibration_map_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
+{
+	guint16 *calibration_map = (guint16 *) user_data;
+	gdouble tmp[6];
+	guint i;
+
+	for (i = 0; i < 6; i++) {
+		g_print ("%i -> %i\n", i, calibration_map[i]);
+		tmp[i] = calibration_map[i];
+	}
+	ch_util_result_add_doubles (priv, "calibration_map", tmp, 6);
+	return TRUE;
+}
+
 static gboolean
 ch_util_get_calibration_map (ChUtilPrivate *priv,
 			     gchar **values,
+			     ChUtilPending *pending,
 			     GError **error)
 {
-	gboolean ret;
-	guint16 calibration_map[6];
-	guint i;
+	guint16 *calibration_map = g_new0 (guint16, 6);
 
 	/* get from HW */
 	ch_device_queue_get_calibration_map (priv->device_queue, priv->device,
 					     calibration_map);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	for (i = 0; i < 6; i++)
-		g_print ("%i -> %i\n", i, calibration_map[i]);
+	ch_util_pending_set (pending, ch_util_get_calibration_map_print, calibration_map);
 	return TRUE;
 }
 
 static gboolean
 ch_util_set_calibration_map (ChUtilPrivate *priv,
 			     gchar **values,
+			     ChUtilPending *pending,
 			     GError **error)
 {
 	guint16 calibration_map[6];
@@ -701,44 +1684,50 @@ ch_util_set_calibration_map (ChUtilPrivate *priv,
 	ch_device_queue_set_calibration_map (priv->device_queue,
 					     priv->device,
 					     calibration_map);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
+typedef struct {
+	guint16		 major;
+	guint16		 minor;
+	guint16		 micro;
+} ChUtilFirmwareVer;
+
 static gboolean
-ch_util_get_firmware_ver (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_firmware_ver_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	guint16 major = 0;
-	guint16 minor = 0;
-	guint16 micro = 0;
+	ChUtilFirmwareVer *ver = (ChUtilFirmwareVer *) user_data;
+	g_autofree gchar *tmp = NULL;
+
+	tmp = g_strdup_printf ("%i.%i.%i", ver->major, ver->minor, ver->micro);
+	g_print ("%s\n", tmp);
+	ch_util_result_add_string (priv, "firmware_version", tmp);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_firmware_ver (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	ChUtilFirmwareVer *ver = g_new0 (ChUtilFirmwareVer, 1);
 
 	/* get from HW */
 	ch_device_queue_get_firmware_ver (priv->device_queue,
 					  priv->device,
-					  &major,
-					  &minor,
-					  &micro);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("%i.%i.%i\n", major, minor, micro);
+					  &ver->major,
+					  &ver->minor,
+					  &ver->micro);
+	ch_util_pending_set (pending, ch_util_get_firmware_ver_print, ver);
 	return TRUE;
 }
 
 static void
-ch_util_show_calibration (const CdMat3x3 *calibration)
+ch_util_show_calibration (ChUtilPrivate *priv, const CdMat3x3 *calibration)
 {
 	gdouble *calibration_tmp;
 	guint i, j;
 
 	calibration_tmp = cd_mat33_get_data (calibration);
+	ch_util_result_add_doubles (priv, "matrix", calibration_tmp, 9);
 	for (j = 0; j < 3; j++) {
 		g_print ("( ");
 		for (i = 0; i < 3; i++)
@@ -747,14 +1736,38 @@ ch_util_show_calibration (const CdMat3x3 *calibration)
 	}
 }
 
+typedef struct {
+	CdMat3x3	 calibration;
+	guint16		 calibration_index;
+	gchar		 description[24];
+	guint8		 types;
+} ChUtilCalibration;
+
 static gboolean
-ch_util_get_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_calibration_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	CdMat3x3 calibration;
-	guint16 calibration_index = 0;
-	gchar description[24];
-	guint8 types;
+	ChUtilCalibration *cal = (ChUtilCalibration *) user_data;
+
+	g_print ("index: %i\n", cal->calibration_index);
+	g_print ("supports LCD: %i\n", (cal->types & CH_CALIBRATION_TYPE_LCD) > 0);
+	g_print ("supports LED: %i\n", (cal->types & CH_CALIBRATION_TYPE_LED) > 0);
+	g_print ("supports CRT: %i\n", (cal->types & CH_CALIBRATION_TYPE_CRT) > 0);
+	g_print ("supports projector: %i\n", (cal->types & CH_CALIBRATION_TYPE_PROJECTOR) > 0);
+	g_print ("description: %s\n", cal->description);
+	ch_util_result_add_int (priv, "index", cal->calibration_index);
+	ch_util_result_add_bool (priv, "lcd", (cal->types & CH_CALIBRATION_TYPE_LCD) > 0);
+	ch_util_result_add_bool (priv, "led", (cal->types & CH_CALIBRATION_TYPE_LED) > 0);
+	ch_util_result_add_bool (priv, "crt", (cal->types & CH_CALIBRATION_TYPE_CRT) > 0);
+	ch_util_result_add_bool (priv, "projector", (cal->types & CH_CALIBRATION_TYPE_PROJECTOR) > 0);
+	ch_util_result_add_string (priv, "description", cal->description);
+	ch_util_show_calibration (priv, &cal->calibration);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_calibration (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	ChUtilCalibration *cal;
 
 	/* parse */
 	if (g_strv_length (values) != 1) {
@@ -762,37 +1775,31 @@ ch_util_get_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
 				     "invalid input, expect 'calibration_index'");
 		return FALSE;
 	}
-	calibration_index = g_ascii_strtoull (values[0], NULL, 10);
+	cal = g_new0 (ChUtilCalibration, 1);
+	cal->calibration_index = g_ascii_strtoull (values[0], NULL, 10);
 
 	/* get from HW */
 	ch_device_queue_get_calibration (priv->device_queue,
 					 priv->device,
-					 calibration_index,
-					 &calibration,
-					 &types,
-					 description);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
+					 cal->calibration_index,
+					 &cal->calibration,
+					 &cal->types,
+					 cal->description);
+	ch_util_pending_set (pending, ch_util_get_calibration_print, cal);
+	return TRUE;
+}
 
-	g_print ("index: %i\n", calibration_index);
-	g_print ("supports LCD: %i\n", (types & CH_CALIBRATION_TYPE_LCD) > 0);
-	g_print ("supports LED: %i\n", (types & CH_CALIBRATION_TYPE_LED) > 0);
-	g_print ("supports CRT: %i\n", (types & CH_CALIBRATION_TYPE_CRT) > 0);
-	g_print ("supports projector: %i\n", (types & CH_CALIBRATION_TYPE_PROJECTOR) > 0);
-	g_print ("description: %s\n", description);
-	ch_util_show_calibration (&calibration);
+static gboolean
+ch_util_set_calibration_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
+{
+	ch_util_show_calibration (priv, (const CdMat3x3 *) user_data);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_calibration (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	CdMat3x3 calibration;
-	gboolean ret;
 	gdouble *calibration_tmp;
 	guint16 calibration_index = 0;
 	guint i;
@@ -848,19 +1855,13 @@ ch_util_set_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
 					 &calibration,
 					 types,
 					 values[11]);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	ch_util_show_calibration (&calibration);
+	ch_util_pending_set (pending, ch_util_set_calibration_print,
+			     g_memdup (&calibration, sizeof (CdMat3x3)));
 	return TRUE;
 }
 
 static gboolean
-ch_util_clear_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_clear_calibration (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	guint16 calibration_index = 0;
 
@@ -876,10 +1877,7 @@ ch_util_clear_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_clear_calibration (priv->device_queue,
 					   priv->device,
 					   calibration_index);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gchar *
@@ -898,39 +1896,59 @@ ch_util_types_to_short_string (guint8 types)
 }
 
 static gboolean
-ch_util_list_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_calibration_all (ChUtilPrivate *priv,
+			     ChUtilCalibration *cal,
+			     GError **error)
 {
-	gboolean ret;
-	gchar description[CH_CALIBRATION_DESCRIPTION_LEN];
-	GError *error_local = NULL;
 	guint16 i;
-	guint8 types;
-	g_autoptr(GString) string = NULL;
 
-	string = g_string_new ("");
+	/* get the calibration info from all slots in one transaction, where
+	 * the empty slots fail and just leave the description blank */
+	memset (cal, 0, sizeof (ChUtilCalibration) * CH_CALIBRATION_MAX);
 	for (i = 0; i < CH_CALIBRATION_MAX; i++) {
-		description[0] = '\0';
+		cal[i].calibration_index = i;
 		ch_device_queue_get_calibration (priv->device_queue,
 						 priv->device,
 						 i,
-						 NULL,
-						 &types,
-						 description);
-		ret = ch_device_queue_process (priv->device_queue,
-					       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					       NULL,
-					       &error_local);
-		if (ret) {
-			if (description[0] != '\0') {
-				g_autofree gchar *tmp = NULL;
-				tmp = ch_util_types_to_short_string (types);
-				g_string_append_printf (string, "%i\t%s [%s]\n",
-							i, description, tmp);
-			}
-		} else {
-			g_debug ("ignoring error: %s", error_local->message);
-			g_clear_error (&error_local);
-		}
+						 &cal[i].calibration,
+						 &cal[i].types,
+						 cal[i].description);
+	}
+	return ch_util_queue_process (priv,
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_CONTINUE_ERRORS |
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONFATAL_ERRORS,
+				      error);
+}
+
+static gboolean
+ch_util_list_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	guint16 i;
+	g_autofree ChUtilCalibration *cal = NULL;
+	g_autoptr(GString) json = NULL;
+	g_autoptr(GString) string = NULL;
+
+	/* get from HW */
+	cal = g_new0 (ChUtilCalibration, CH_CALIBRATION_MAX);
+	if (!ch_util_get_calibration_all (priv, cal, error))
+		return FALSE;
+
+	json = g_string_new ("[");
+	string = g_string_new ("");
+	for (i = 0; i < CH_CALIBRATION_MAX; i++) {
+		g_autofree gchar *tmp = NULL;
+		if (cal[i].description[0] == '\0')
+			continue;
+		tmp = ch_util_types_to_short_string (cal[i].types);
+		g_string_append_printf (string, "%i\t%s [%s]\n",
+					i, cal[i].description, tmp);
+		if (json->len > 1)
+			g_string_append_c (json, ',');
+		g_string_append_printf (json, "{\"index\":%i,\"description\":", i);
+		ch_util_json_append_string (json, cal[i].description);
+		g_string_append (json, ",\"types\":");
+		ch_util_json_append_string (json, tmp);
+		g_string_append_c (json, '}');
 	}
 
 	/* if no matrices */
@@ -942,11 +1960,287 @@ ch_util_list_calibration (ChUtilPrivate *priv, gchar **values, GError **error)
 
 	/* print */
 	g_print ("Index\tDescription\n%s", string->str);
+	g_string_append_c (json, ']');
+	ch_util_result_add_raw (priv, "calibrations", json->str);
+	return TRUE;
+}
+
+static const struct {
+	guint8		 type;
+	const gchar	*name;
+} ch_util_calibration_types[] = {
+	{ CH_CALIBRATION_TYPE_LCD,		"lcd" },
+	{ CH_CALIBRATION_TYPE_LED,		"led" },
+	{ CH_CALIBRATION_TYPE_CRT,		"crt" },
+	{ CH_CALIBRATION_TYPE_PROJECTOR,	"projector" },
+	{ 0,					NULL }
+};
+
+static gboolean
+ch_util_calibration_export (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	gdouble map_tmp[6];
+	guint16 calibration_map[6] = { 0, 0, 0, 0, 0, 0 };
+	guint cnt = 0;
+	guint i;
+	guint j;
+	g_autofree ChUtilCalibration *cal = NULL;
+	g_autofree gchar *data = NULL;
+	g_autoptr(GKeyFile) keyfile = NULL;
+
+	/* parse */
+	if (g_strv_length (values) != 1) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'filename'");
+		return FALSE;
+	}
+
+	/* get from HW */
+	cal = g_new0 (ChUtilCalibration, CH_CALIBRATION_MAX);
+	if (!ch_util_get_calibration_all (priv, cal, error))
+		return FALSE;
+
+	/* unlike the slots the map always exists, so failing is fatal */
+	ch_device_queue_get_calibration_map (priv->device_queue,
+					     priv->device,
+					     calibration_map);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+
+	/* one group per used slot */
+	keyfile = g_key_file_new ();
+	for (i = 0; i < 6; i++)
+		map_tmp[i] = calibration_map[i];
+	g_key_file_set_double_list (keyfile, "calibration-map", "Map", map_tmp, 6);
+	for (i = 0; i < CH_CALIBRATION_MAX; i++) {
+		const gchar *types[G_N_ELEMENTS (ch_util_calibration_types)];
+		guint types_len = 0;
+		g_autofree gchar *group = NULL;
+
+		if (cal[i].description[0] == '\0')
+			continue;
+		group = g_strdup_printf ("calibration-%u", i);
+		g_key_file_set_string (keyfile, group, "Description",
+				       cal[i].description);
+		for (j = 0; ch_util_calibration_types[j].name != NULL; j++) {
+			if ((cal[i].types & ch_util_calibration_types[j].type) > 0)
+				types[types_len++] = ch_util_calibration_types[j].name;
+		}
+		g_key_file_set_string_list (keyfile, group, "Types", types, types_len);
+		g_key_file_set_double_list (keyfile, group, "Matrix",
+					    cd_mat33_get_data (&cal[i].calibration), 9);
+		cnt++;
+	}
+
+	/* every slot failed or is empty */
+	if (cnt == 0) {
+		g_set_error_literal (error, 1, 0,
+				     "no calibration matrices stored");
+		return FALSE;
+	}
+
+	/* save */
+	data = g_key_file_to_data (keyfile, NULL, error);
+	if (data == NULL)
+		return FALSE;
+	if (!g_file_set_contents (values[0], data, -1, error))
+		return FALSE;
+	g_print ("Exported %u calibration matrices to %s\n", cnt, values[0]);
+	ch_util_result_add_int (priv, "count", cnt);
+	return TRUE;
+}
+
+static gboolean
+ch_util_calibration_import_slot (GKeyFile *keyfile,
+				 const gchar *group,
+				 guint16 *calibration_index,
+				 CdMat3x3 *calibration,
+				 guint8 *types,
+				 gchar **description,
+				 GError **error)
+{
+	gchar *endptr = NULL;
+	gsize len = 0;
+	guint64 idx;
+	guint i;
+	guint j;
+	g_autofree gchar *description_tmp = NULL;
+	g_autofree gdouble *matrix = NULL;
+	g_auto(GStrv) types_str = NULL;
+
+	idx = g_ascii_strtoull (group + strlen ("calibration-"), &endptr, 10);
+	if (endptr[0] != '\0' || idx >= CH_CALIBRATION_MAX) {
+		g_set_error (error, 1, 0,
+			     "invalid calibration index in [%s]",
+			     group);
+		return FALSE;
+	}
+	description_tmp = g_key_file_get_string (keyfile, group,
+						 "Description", error);
+	if (description_tmp == NULL)
+		return FALSE;
+	if (strlen (description_tmp) > CH_CALIBRATION_DESCRIPTION_LEN) {
+		g_set_error (error, 1, 0,
+			     "description in [%s] is limited to %i chars",
+			     group, CH_CALIBRATION_DESCRIPTION_LEN);
+		return FALSE;
+	}
+
+	/* try to parse magic constants */
+	types_str = g_key_file_get_string_list (keyfile, group,
+						"Types", NULL, error);
+	if (types_str == NULL)
+		return FALSE;
+	*types = 0;
+	for (i = 0; types_str[i] != NULL; i++) {
+		for (j = 0; ch_util_calibration_types[j].name != NULL; j++) {
+			if (g_strcmp0 (types_str[i], ch_util_calibration_types[j].name) == 0)
+				*types |= ch_util_calibration_types[j].type;
+		}
+	}
+	if (*types == 0) {
+		g_set_error (error, 1, 0,
+			     "invalid types in [%s], expected "
+			     "'lcd', 'led', 'crt', 'projector'",
+			     group);
+		return FALSE;
+	}
+
+	/* check is valid */
+	matrix = g_key_file_get_double_list (keyfile, group,
+					     "Matrix", &len, error);
+	if (matrix == NULL)
+		return FALSE;
+	if (len != 9) {
+		g_set_error (error, 1, 0,
+			     "invalid matrix in [%s], expected 9 values",
+			     group);
+		return FALSE;
+	}
+	for (i = 0; i < 9; i++) {
+		if (matrix[i] > 0x7fff || matrix[i] < -0x7fff) {
+			g_set_error (error, 1, 0,
+				     "invalid matrix value in [%s]",
+				     group);
+			return FALSE;
+		}
+	}
+	memcpy (cd_mat33_get_data (calibration), matrix, sizeof (gdouble) * 9);
+	*calibration_index = idx;
+	*description = g_steal_pointer (&description_tmp);
+	return TRUE;
+}
+
+static gboolean
+ch_util_calibration_import_map (GKeyFile *keyfile,
+				guint16 *calibration_map,
+				GError **error)
+{
+	gsize len = 0;
+	guint i;
+	g_autofree gdouble *map_tmp = NULL;
+
+	map_tmp = g_key_file_get_double_list (keyfile, "calibration-map",
+					      "Map", &len, error);
+	if (map_tmp == NULL)
+		return FALSE;
+	if (len != 6) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid calibration map, expected 6 values");
+		return FALSE;
+	}
+	for (i = 0; i < 6; i++) {
+		if (map_tmp[i] < 0 || map_tmp[i] >= CH_CALIBRATION_MAX) {
+			g_set_error_literal (error, 1, 0,
+					     "invalid calibration map index");
+			return FALSE;
+		}
+		calibration_map[i] = map_tmp[i];
+	}
+	return TRUE;
+}
+
+static gboolean
+ch_util_calibration_import (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	CdMat3x3 calibration;
+	gboolean has_map = FALSE;
+	guint cnt = 0;
+	guint i;
+	guint pass;
+	guint16 calibration_index;
+	guint16 calibration_map[6];
+	guint8 types;
+	g_autoptr(GKeyFile) keyfile = NULL;
+	g_auto(GStrv) groups = NULL;
+
+	/* parse */
+	if (g_strv_length (values) != 1) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'filename'");
+		return FALSE;
+	}
+	keyfile = g_key_file_new ();
+	if (!g_key_file_load_from_file (keyfile, values[0], G_KEY_FILE_NONE, error))
+		return FALSE;
+	if (g_key_file_has_group (keyfile, "calibration-map")) {
+		if (!ch_util_calibration_import_map (keyfile, calibration_map, error))
+			return FALSE;
+		has_map = TRUE;
+	}
+
+	/* check every slot before anything is queued, then queue them; slots
+	 * that are not in the file are left as they are on the device */
+	groups = g_key_file_get_groups (keyfile, NULL);
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; groups[i] != NULL; i++) {
+			g_autofree gchar *description = NULL;
+			if (g_strcmp0 (groups[i], "calibration-map") == 0)
+				continue;
+			if (!g_str_has_prefix (groups[i], "calibration-"))
+				continue;
+			if (!ch_util_calibration_import_slot (keyfile,
+							      groups[i],
+							      &calibration_index,
+							      &calibration,
+							      &types,
+							      &description,
+							      error))
+				return FALSE;
+			if (pass == 0)
+				continue;
+			ch_device_queue_set_calibration (priv->device_queue,
+							 priv->device,
+							 calibration_index,
+							 &calibration,
+							 types,
+							 description);
+			cnt++;
+		}
+	}
+	if (has_map) {
+		ch_device_queue_set_calibration_map (priv->device_queue,
+						     priv->device,
+						     calibration_map);
+	}
+
+	/* write everything, then save once */
+	ch_device_queue_write_eeprom (priv->device_queue,
+				      priv->device,
+				      CH_WRITE_EEPROM_MAGIC);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+	g_print ("Imported %u calibration matrices from %s\n", cnt, values[0]);
+	ch_util_result_add_int (priv, "count", cnt);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_calibration_ccmx (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_calibration_ccmx (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	gboolean ret;
 	guint16 calibration_index;
@@ -975,10 +2269,7 @@ ch_util_set_calibration_ccmx (ChUtilPrivate *priv, gchar **values, GError **erro
 						    error);
 	if (!ret)
 		return FALSE;
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
@@ -996,6 +2287,7 @@ ch_util_get_serial_number (ChUtilPrivate *priv, gchar **values, GError **error)
 		return FALSE;
 
 	g_print ("%06i\n", serial_number);
+	ch_util_result_add_int (priv, "serial_number", serial_number);
 	return TRUE;
 }
 
@@ -1027,27 +2319,27 @@ ch_util_set_serial_number (ChUtilPrivate *priv, gchar **values, GError **error)
 }
 
 static gboolean
-ch_util_get_owner_name (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_owner_name_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	gchar name[CH_OWNER_LENGTH_MAX];
+	g_print ("%s\n", (const gchar *) user_data);
+	ch_util_result_add_string (priv, "owner_name", (const gchar *) user_data);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_owner_name (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	gchar *name = g_new0 (gchar, CH_OWNER_LENGTH_MAX);
 
 	/* get from HW */
 	ch_device_queue_get_owner_name (priv->device_queue, priv->device,
 					name);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("%s\n", name);
+	ch_util_pending_set (pending, ch_util_get_owner_name_print, name);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_owner_name (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_owner_name (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	gchar name[CH_OWNER_LENGTH_MAX];
 
@@ -1067,34 +2359,31 @@ ch_util_set_owner_name (ChUtilPrivate *priv, gchar **values, GError **error)
 	g_print ("setting name to %s\n", name);
 	ch_device_queue_set_owner_name (priv->device_queue, priv->device,
 					name);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
-ch_util_get_owner_email (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_owner_email_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	gchar email[CH_OWNER_LENGTH_MAX];
+	g_print ("%s\n", (const gchar *) user_data);
+	ch_util_result_add_string (priv, "owner_email", (const gchar *) user_data);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_owner_email (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	gchar *email = g_new0 (gchar, CH_OWNER_LENGTH_MAX);
 
 	/* get from HW */
 	ch_device_queue_get_owner_email (priv->device_queue, priv->device,
 					email);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("%s\n", email);
+	ch_util_pending_set (pending, ch_util_get_owner_email_print, email);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_owner_email (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_owner_email (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	gchar email[CH_OWNER_LENGTH_MAX];
 
@@ -1114,10 +2403,7 @@ ch_util_set_owner_email (ChUtilPrivate *priv, gchar **values, GError **error)
 	g_print ("setting email to %s\n", email);
 	ch_device_queue_set_owner_email (priv->device_queue, priv->device,
 					email);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
@@ -1135,6 +2421,7 @@ ch_util_get_leds (ChUtilPrivate *priv, gchar **values, GError **error)
 		return FALSE;
 
 	g_print ("LEDs: %i\n", leds);
+	ch_util_result_add_int (priv, "leds", leds);
 	return TRUE;
 }
 
@@ -1204,6 +2491,7 @@ ch_util_get_illuminants (ChUtilPrivate *priv, gchar **values, GError **error)
 		return FALSE;
 
 	g_print ("illuminants: %i\n", illuminants);
+	ch_util_result_add_int (priv, "illuminants", illuminants);
 	return TRUE;
 }
 
@@ -1262,6 +2550,7 @@ ch_util_get_pcb_errata (ChUtilPrivate *priv, gchar **values, GError **error)
 	if (!ret)
 		return FALSE;
 
+	ch_util_result_add_int (priv, "pcb_errata", pcb_errata);
 	if (pcb_errata == 0) {
 		g_print ("Errata: none\n");
 		return TRUE;
@@ -1310,31 +2599,32 @@ ch_util_set_pcb_errata (ChUtilPrivate *priv, gchar **values, GError **error)
 }
 
 static gboolean
-ch_util_get_remote_hash (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_remote_hash_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	ChSha1 remote_hash;
-	gboolean ret;
 	g_autofree gchar *tmp = NULL;
 
+	/* print hash */
+	tmp = ch_sha1_to_string ((const ChSha1 *) user_data);
+	g_print ("%s\n", tmp);
+	ch_util_result_add_string (priv, "remote_hash", tmp);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_remote_hash (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	ChSha1 *remote_hash = g_new0 (ChSha1, 1);
+
 	/* get from HW */
 	ch_device_queue_get_remote_hash (priv->device_queue,
 					 priv->device,
-					 &remote_hash);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	/* print hash */
-	tmp = ch_sha1_to_string (&remote_hash);
-	g_print ("%s\n", tmp);
+					 remote_hash);
+	ch_util_pending_set (pending, ch_util_get_remote_hash_print, remote_hash);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_remote_hash (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_remote_hash (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	ChSha1 remote_hash;
 
@@ -1356,30 +2646,29 @@ ch_util_set_remote_hash (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_write_eeprom (priv->device_queue,
 				      priv->device,
 				      CH_WRITE_EEPROM_MAGIC);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
-ch_util_get_dark_offsets (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_dark_offsets_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	CdColorRGB value;
+	CdColorRGB *value = (CdColorRGB *) user_data;
+	g_print ("R:%.5f G:%.5f B:%.5f\n", value->R, value->G, value->B);
+	ch_util_result_add_triple (priv, "dark_offsets",
+				   "R", value->R, "G", value->G, "B", value->B);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_dark_offsets (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	CdColorRGB *value = g_new0 (CdColorRGB, 1);
 
 	/* get from HW */
 	ch_device_queue_get_dark_offsets (priv->device_queue,
 					  priv->device,
-					  &value);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("R:%.5f G:%.5f B:%.5f\n", value.R, value.G, value.B);
+					  value);
+	ch_util_pending_set (pending, ch_util_get_dark_offsets_print, value);
 	return TRUE;
 }
 
@@ -1426,14 +2715,15 @@ ch_util_set_dark_offsets_auto (ChUtilPrivate *priv, GError **error)
 	ch_device_queue_take_readings (priv->device_queue,
 				       priv->device,
 				       &value);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				     error);
 	if (!ret)
 		return FALSE;
 
 	g_print ("Values: R:%.5f G:%.5f B:%.5f\n", value.R, value.G, value.B);
+	ch_util_result_add_triple (priv, "dark_offsets",
+				   "R", value.R, "G", value.G, "B", value.B);
 
 	/* TRANSLATORS: ask before we set these */
 	ret = ch_util_get_prompt (_("Set these values as the dark offsets"), FALSE);
@@ -1445,10 +2735,9 @@ ch_util_set_dark_offsets_auto (ChUtilPrivate *priv, GError **error)
 		ch_device_queue_set_post_scale (priv->device_queue,
 						priv->device,
 						post_scale_old);
-		ret = ch_device_queue_process (priv->device_queue,
-					       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					       NULL,
-					       error);
+		ret = ch_util_queue_process (priv,
+					     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					     error);
 		if (!ret)
 			return FALSE;
 		g_set_error_literal (error, 1, 0,
@@ -1465,10 +2754,9 @@ ch_util_set_dark_offsets_auto (ChUtilPrivate *priv, GError **error)
 	ch_device_queue_write_eeprom (priv->device_queue,
 				      priv->device,
 				      CH_WRITE_EEPROM_MAGIC);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return ch_util_queue_process (priv,
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				      error);
 }
 
 static gboolean
@@ -1494,14 +2782,13 @@ ch_util_set_dark_offsets (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_set_dark_offsets (priv->device_queue,
 					  priv->device,
 					  &value);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return ch_util_queue_process (priv,
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				      error);
 }
 
 static gboolean
-ch_util_write_eeprom (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_write_eeprom (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	/* parse */
 	if (g_strv_length (values) != 1) {
@@ -1514,10 +2801,7 @@ ch_util_write_eeprom (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_write_eeprom (priv->device_queue,
 				      priv->device,
 				      values[0]);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
@@ -1548,10 +2832,9 @@ ch_util_take_reading_raw (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_take_reading_raw (priv->device_queue,
 					  priv->device,
 					  &take_reading);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_CONTINUE_ERRORS,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_CONTINUE_ERRORS,
+				     error);
 	if (!ret)
 		return FALSE;
 
@@ -1570,10 +2853,19 @@ ch_util_take_reading_raw (ChUtilPrivate *priv, gchar **values, GError **error)
 
 		/* TRANSLATORS: this is the sensor sample time */
 		g_print ("%s:\t0x%04x\n", _("Integral"), integral_time);
+
+		ch_util_result_add_string (priv, "color_select",
+					   ch_color_select_to_string (color_select));
+		ch_util_result_add_string (priv, "multiplier",
+					   ch_multiplier_to_string (multiplier));
+		ch_util_result_add_string (priv, "measure_mode",
+					   ch_measure_mode_to_string (measure_mode));
+		ch_util_result_add_int (priv, "integral_time", integral_time);
 	}
 
 	/* TRANSLATORS: this is the number of pulses detected */
 	g_print ("%s:\t\t%" G_GUINT32_FORMAT "\n", _("Pulses"), take_reading);
+	ch_util_result_add_int (priv, "pulses", take_reading);
 	return TRUE;
 }
 
@@ -1596,22 +2888,24 @@ ch_util_take_readings (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_take_readings (priv->device_queue,
 				       priv->device,
 				       &value);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				     error);
 	if (!ret)
 		return FALSE;
 	if (ch_device_get_mode (priv->device) == CH_DEVICE_MODE_FIRMWARE) {
 		/* TRANSLATORS: this is the sensor sample time */
 		g_print ("%s:\t0x%04x\n", _("Integral"), integral_time);
+		ch_util_result_add_int (priv, "integral_time", integral_time);
 	}
 	g_print ("R:%.5f G:%.5f B:%.5f\n", value.R, value.G, value.B);
+	ch_util_result_add_triple (priv, "rgb",
+				   "R", value.R, "G", value.G, "B", value.B);
 	return TRUE;
 }
 
 static void
-ch_util_print_color_values (CdColorXYZ *value)
+ch_util_print_color_values (ChUtilPrivate *priv, CdColorXYZ *value)
 {
 	CdMat3x3 xyz_to_srgb;
 	CdVec3 srgb;
@@ -1620,10 +2914,14 @@ ch_util_print_color_values (CdColorXYZ *value)
 
 	/* raw values */
 	g_print ("X:% .5f\tY:% .5f\tZ:% .5f\n", value->X, value->Y, value->Z);
+	ch_util_result_add_triple (priv, "XYZ",
+				   "X", value->X, "Y", value->Y, "Z", value->Z);
 
 	/* show Yxy */
 	cd_color_xyz_to_yxy (value, &yxy);
 	g_print ("Y:% .5f\tx:% .5f\ty:% .5f\n", yxy.Y, yxy.x, yxy.y);
+	ch_util_result_add_triple (priv, "Yxy",
+				   "Y", yxy.Y, "x", yxy.x, "y", yxy.y);
 
 	/* convert to sRGB */
 	cd_vec3_init (&xyz, value->X, value->Y, value->Z);
@@ -1633,6 +2931,8 @@ ch_util_print_color_values (CdColorXYZ *value)
 		        0.0556434, -0.2040259,  1.0572252);
 	cd_mat33_vector_multiply (&xyz_to_srgb, &xyz, &srgb);
 	g_print ("R:% .5f\tG:% .5f\tB:% .5f\n", srgb.v0, srgb.v1, srgb.v2);
+	ch_util_result_add_triple (priv, "sRGB",
+				   "R", srgb.v0, "G", srgb.v1, "B", srgb.v2);
 }
 
 static gboolean
@@ -1657,14 +2957,419 @@ ch_util_take_readings_xyz (ChUtilPrivate *priv, gchar **values, GError **error)
 	if (value == NULL)
 		return FALSE;
 
-	ch_util_print_color_values (value);
+	ch_util_print_color_values (priv, value);
 	return TRUE;
 }
 
 static gboolean
-ch_util_take_reading_spectral (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_take_readings_xyz_auto (ChUtilPrivate *priv, gchar **values, GError **error)
 {
-	gdouble cal[4];
+	CdColorXYZ value;
+	gboolean ret;
+	guint16 calibration_index = 0;
+	guint16 integral_time = 0;
+	guint16 integral_time_old = 0;
+	g_autoptr(GError) error_local = NULL;
+
+	/* parse */
+	if (g_strv_length (values) != 1) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'calibration_index'");
+		return FALSE;
+	}
+	calibration_index = g_ascii_strtoull (values[0], NULL, 10);
+
+	/* only the original ColorHug has an integral time to put back */
+	if (ch_device_get_mode (priv->device) == CH_DEVICE_MODE_FIRMWARE) {
+		ch_device_queue_get_integral_time (priv->device_queue,
+						   priv->device,
+						   &integral_time_old);
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error))
+			return FALSE;
+	}
+
+	/* bright patches do not need the full integral time */
+	ret = ch_autorange_integral_time (priv->device_queue,
+					  priv->device,
+					  &integral_time,
+					  NULL,
+					  error);
+	if (ret) {
+		ch_device_queue_take_readings_xyz (priv->device_queue,
+						   priv->device,
+						   calibration_index,
+						   &value);
+		ret = ch_util_queue_process (priv,
+					     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					     error);
+	}
+
+	/* put back what the user had, even if the reading failed */
+	if (integral_time_old != 0) {
+		ch_device_queue_set_integral_time (priv->device_queue,
+						   priv->device,
+						   integral_time_old);
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    &error_local)) {
+			if (!ret) {
+				g_warning ("failed to restore integral time: %s",
+					   error_local->message);
+				return FALSE;
+			}
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return FALSE;
+		}
+	}
+	if (!ret)
+		return FALSE;
+	if (integral_time != 0) {
+		/* TRANSLATORS: this is the sensor sample time */
+		g_print ("%s:\t0x%04x\n", _("Integral"), integral_time);
+		ch_util_result_add_int (priv, "integral_time", integral_time);
+	}
+	ch_util_print_color_values (priv, &value);
+	return TRUE;
+}
+
+/* number of readings queued in each device transaction */
+#define CH_UTIL_AVERAGE_BATCH_SIZE	8
+
+/* readings needed before the variance means anything */
+#define CH_UTIL_AVERAGE_MIN_SAMPLES	3
+
+static gboolean
+ch_util_take_readings_xyz_average (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	CdColorXYZ batch[CH_UTIL_AVERAGE_BATCH_SIZE];
+	CdColorXYZ mean;
+	CdColorXYZ median;
+	ChStatsWelford w[3];
+	gdouble ci95 = G_MAXDOUBLE;
+	gdouble target = 0.f;
+	guint16 calibration_index;
+	guint i, j;
+	guint max_samples;
+	GArray *samples[3];
+	g_autoptr(GArray) samples_x = NULL;
+	g_autoptr(GArray) samples_y = NULL;
+	g_autoptr(GArray) samples_z = NULL;
+
+	/* parse */
+	if (g_strv_length (values) < 2 || g_strv_length (values) > 3) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'calibration_index' "
+				     "'max_samples' ['ci95_target']");
+		return FALSE;
+	}
+	calibration_index = g_ascii_strtoull (values[0], NULL, 10);
+	max_samples = g_ascii_strtoull (values[1], NULL, 10);
+	if (max_samples == 0) {
+		g_set_error_literal (error, 1, 0,
+				     "max_samples must be at least 1");
+		return FALSE;
+	}
+	if (values[2] != NULL)
+		target = g_ascii_strtod (values[2], NULL);
+
+	/* take readings in batches until the mean is good enough */
+	memset (w, 0, sizeof (w));
+	samples_x = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), max_samples);
+	samples_y = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), max_samples);
+	samples_z = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), max_samples);
+	samples[0] = samples_x;
+	samples[1] = samples_y;
+	samples[2] = samples_z;
+	while (w[0].n < max_samples) {
+		guint batch_len = MIN (max_samples - w[0].n,
+				       CH_UTIL_AVERAGE_BATCH_SIZE);
+		for (i = 0; i < batch_len; i++) {
+			ch_device_queue_take_readings_xyz (priv->device_queue,
+							   priv->device,
+							   calibration_index,
+							   &batch[i]);
+		}
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error))
+			return FALSE;
+		for (i = 0; i < batch_len; i++) {
+			gdouble v[3] = { batch[i].X, batch[i].Y, batch[i].Z };
+			for (j = 0; j < 3; j++) {
+				ch_stats_welford_add (&w[j], v[j]);
+				g_array_append_val (samples[j], v[j]);
+			}
+		}
+
+		/* the widest interval of the three channels */
+		if (w[0].n < CH_UTIL_AVERAGE_MIN_SAMPLES)
+			continue;
+		ci95 = 0.f;
+		for (j = 0; j < 3; j++)
+			ci95 = MAX (ci95, ch_stats_welford_get_ci95 (&w[j]));
+		if (target > 0.f && ci95 <= target)
+			break;
+	}
+
+	/* print the mean, which is what the other commands show */
+	cd_color_xyz_set (&mean, w[0].mean, w[1].mean, w[2].mean);
+	cd_color_xyz_set (&median,
+			  ch_stats_median ((gdouble *) samples[0]->data, samples[0]->len),
+			  ch_stats_median ((gdouble *) samples[1]->data, samples[1]->len),
+			  ch_stats_median ((gdouble *) samples[2]->data, samples[2]->len));
+	ch_util_print_color_values (priv, &mean);
+	g_print ("Median\tX:% .5f\tY:% .5f\tZ:% .5f\n",
+		 median.X, median.Y, median.Z);
+	g_print ("StdDev\tX:% .5f\tY:% .5f\tZ:% .5f\n",
+		 sqrt (ch_stats_welford_get_variance (&w[0])),
+		 sqrt (ch_stats_welford_get_variance (&w[1])),
+		 sqrt (ch_stats_welford_get_variance (&w[2])));
+	if (w[0].n >= CH_UTIL_AVERAGE_MIN_SAMPLES)
+		g_print ("Samples: %u, 95%% CI: +/-%.5f\n", w[0].n, ci95);
+	else
+		g_print ("Samples: %u\n", w[0].n);
+	ch_util_result_add_triple (priv, "median",
+				   "X", median.X, "Y", median.Y, "Z", median.Z);
+	ch_util_result_add_triple (priv, "std_dev",
+				   "X", sqrt (ch_stats_welford_get_variance (&w[0])),
+				   "Y", sqrt (ch_stats_welford_get_variance (&w[1])),
+				   "Z", sqrt (ch_stats_welford_get_variance (&w[2])));
+	ch_util_result_add_int (priv, "samples", w[0].n);
+	if (w[0].n >= CH_UTIL_AVERAGE_MIN_SAMPLES)
+		ch_util_result_add_double (priv, "ci95", ci95);
+	return TRUE;
+}
+
+typedef struct {
+	ChUtilPrivate		*priv;
+	CdColorXYZ		 value;
+	GError			*error;
+	GMainLoop		*loop;
+	GTimer			*timer;
+	gboolean		 in_flight;
+	gboolean		 json;
+	gboolean		 sample_due;
+	gdouble			 interval;
+	gdouble			 requested;
+	guint			 count;
+	guint			 dropped;
+	guint			 samples;
+	guint			 ticks;
+	guint			 timeout_id;
+	guint16			 calibration_index;
+} ChUtilStreamHelper;
+
+static void ch_util_stream_schedule (ChUtilStreamHelper *helper);
+
+static void
+ch_util_stream_print (ChUtilStreamHelper *helper,
+		      const CdColorXYZ *value,
+		      gdouble elapsed,
+		      gdouble latency)
+{
+	const gchar *names[] = { "time", "elapsed", "latency", "X", "Y", "Z" };
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+	gdouble fields[6];
+	guint i;
+	g_autoptr(GString) str = g_string_new (helper->json ? "{" : "");
+
+	fields[0] = (gdouble) g_get_real_time () / G_USEC_PER_SEC;
+	fields[1] = elapsed;
+	fields[2] = latency;
+	fields[3] = value->X;
+	fields[4] = value->Y;
+	fields[5] = value->Z;
+
+	/* always use a '.' whatever the locale, or the columns break */
+	for (i = 0; i < 6; i++) {
+		if (i > 0)
+			g_string_append_c (str, ',');
+		if (helper->json) {
+			g_string_append_printf (str, "\"%s\":", names[i]);
+			ch_util_json_append_double (str, fields[i]);
+			continue;
+		}
+		g_string_append (str, g_ascii_formatd (buf, sizeof (buf),
+						       "%.6f", fields[i]));
+	}
+	if (helper->json) {
+		g_string_append (str, "}\n");
+		ch_util_print_raw (str->str);
+		return;
+	}
+	g_print ("%s\n", str->str);
+}
+
+static void
+ch_util_stream_take_reading_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	ChUtilStreamHelper *helper = (ChUtilStreamHelper *) user_data;
+	CdColorXYZ value;
+	gdouble elapsed;
+	gdouble latency;
+
+	/* get result */
+	helper->in_flight = FALSE;
+	if (!ch_device_queue_process_finish (CH_DEVICE_QUEUE (source), res, &helper->error)) {
+		g_main_loop_quit (helper->loop);
+		return;
+	}
+	elapsed = g_timer_elapsed (helper->timer, NULL);
+	latency = elapsed - helper->requested;
+	cd_color_xyz_copy (&helper->value, &value);
+	helper->samples++;
+
+	/* get the next sample going before printing this one */
+	if (helper->count > 0 && helper->samples >= helper->count) {
+		g_main_loop_quit (helper->loop);
+	} else if (helper->sample_due && g_main_loop_is_running (helper->loop)) {
+		helper->sample_due = FALSE;
+		ch_util_stream_schedule (helper);
+	}
+	ch_util_stream_print (helper, &value, elapsed, latency);
+}
+
+static void
+ch_util_stream_schedule (ChUtilStreamHelper *helper)
+{
+	/* take a reading */
+	helper->in_flight = TRUE;
+	helper->requested = g_timer_elapsed (helper->timer, NULL);
+	ch_device_queue_take_readings_xyz (helper->priv->device_queue,
+					   helper->priv->device,
+					   helper->calibration_index,
+					   &helper->value);
+	ch_device_queue_process_async (helper->priv->device_queue,
+				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				       NULL,
+				       ch_util_stream_take_reading_cb,
+				       helper);
+}
+
+static gboolean
+ch_util_stream_tick_cb (gpointer user_data)
+{
+	ChUtilStreamHelper *helper = (ChUtilStreamHelper *) user_data;
+	gdouble next;
+
+	/* the device is still busy with the last sample */
+	if (helper->in_flight) {
+		if (helper->sample_due)
+			helper->dropped++;
+		helper->sample_due = TRUE;
+	} else {
+		ch_util_stream_schedule (helper);
+	}
+
+	/* schedule from the start time so that the rate does not drift */
+	next = ++helper->ticks * helper->interval - g_timer_elapsed (helper->timer, NULL);
+	if (next < 0.f)
+		next = 0.f;
+	helper->timeout_id = g_timeout_add ((guint) (next * 1000), ch_util_stream_tick_cb, helper);
+	return FALSE;
+}
+
+#ifdef G_OS_UNIX
+static gboolean
+ch_util_stream_sigint_cb (gpointer user_data)
+{
+	ChUtilStreamHelper *helper = (ChUtilStreamHelper *) user_data;
+	g_main_loop_quit (helper->loop);
+	return FALSE;
+}
+#endif
+
+static gboolean
+ch_util_take_readings_stream (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	ChUtilStreamHelper helper;
+	gdouble elapsed;
+	gdouble rate;
+	g_autoptr(GMainLoop) loop = NULL;
+	g_autoptr(GTimer) timer = NULL;
+#ifdef G_OS_UNIX
+	guint sigint_id;
+#endif
+
+	/* parse */
+	if (g_strv_length (values) < 2 || g_strv_length (values) > 4) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'calibration_index' "
+				     "'rate_hz' [csv|json] [count]");
+		return FALSE;
+	}
+	memset (&helper, 0, sizeof (helper));
+	helper.calibration_index = g_ascii_strtoull (values[0], NULL, 10);
+	rate = g_ascii_strtod (values[1], NULL);
+	if (rate <= 0.f || rate > 1000.f) {
+		g_set_error (error, 1, 0,
+			     "invalid rate %s, expect 0-1000Hz",
+			     values[1]);
+		return FALSE;
+	}
+	if (values[2] != NULL) {
+		if (g_strcmp0 (values[2], "json") == 0) {
+			helper.json = TRUE;
+		} else if (g_strcmp0 (values[2], "csv") != 0) {
+			g_set_error (error, 1, 0,
+				     "invalid format %s, expect 'csv' or 'json'",
+				     values[2]);
+			return FALSE;
+		}
+		if (values[3] != NULL)
+			helper.count = g_ascii_strtoull (values[3], NULL, 10);
+	}
+
+	/* samples are printed as they arrive rather than at the end */
+	if (priv->json)
+		helper.json = TRUE;
+
+	/* take readings until interrupted */
+	loop = g_main_loop_new (NULL, FALSE);
+	timer = g_timer_new ();
+	helper.priv = priv;
+	helper.loop = loop;
+	helper.timer = timer;
+	helper.interval = 1.f / rate;
+	if (!helper.json)
+		g_print ("time,elapsed,latency,X,Y,Z\n");
+#ifdef G_OS_UNIX
+	sigint_id = g_unix_signal_add (SIGINT, ch_util_stream_sigint_cb, &helper);
+#endif
+	ch_util_stream_tick_cb (&helper);
+	g_main_loop_run (loop);
+	elapsed = g_timer_elapsed (timer, NULL);
+	g_source_remove (helper.timeout_id);
+#ifdef G_OS_UNIX
+	g_source_remove (sigint_id);
+#endif
+
+	/* wait for any reading still in progress */
+	while (helper.in_flight)
+		g_main_context_iteration (NULL, TRUE);
+
+	/* report on stderr so the output can still be parsed */
+	ch_util_result_add_int (priv, "samples", helper.samples);
+	ch_util_result_add_int (priv, "dropped", helper.dropped);
+	ch_util_result_add_double (priv, "rate", elapsed > 0.f ? helper.samples / elapsed : 0.f);
+	g_printerr ("Took %u samples in %.2fs at %.2fHz (requested %.2fHz), "
+		    "%u dropped\n",
+		    helper.samples, elapsed,
+		    elapsed > 0.f ? helper.samples / elapsed : 0.f,
+		    rate, helper.dropped);
+	if (helper.error != NULL) {
+		g_propagate_error (error, helper.error);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+ch_util_take_reading_spectral (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	gdouble cal[4];
 	g_autofree gchar *str = NULL;
 	g_autoptr(CdSpectrum) sp = NULL;
 
@@ -1696,43 +3401,54 @@ ch_util_reset (ChUtilPrivate *priv, gchar **values, GError **error)
 	/* this may return with an error */
 	ch_device_queue_reset (priv->device_queue,
 			       priv->device);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return ch_util_queue_process (priv,
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				      error);
 }
 
-static GUsbDevice *
-ch_util_get_default_device (gint device_idx, GError **error)
+static GPtrArray *
+ch_util_get_colorhug_devices (GUsbContext *usb_ctx, GError **error)
 {
 	guint i;
 	GUsbDevice *device_tmp;
-	g_autoptr(GUsbContext) usb_ctx = NULL;
-	g_autoptr(GUsbDevice) device = NULL;
+	GPtrArray *devices_ch;
 	g_autoptr(GPtrArray) devices = NULL;
-	g_autoptr(GPtrArray) devices_ch = NULL;
-
-	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
 	/* filter ColorHug devices */
-	usb_ctx = g_usb_context_new (NULL);
 	devices = g_usb_context_get_devices (usb_ctx);
-	devices_ch = g_ptr_array_new ();
+	devices_ch = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	for (i = 0; i < devices->len; i++) {
 		device_tmp = g_ptr_array_index (devices, i);
 		if (!ch_device_is_colorhug (device_tmp))
 			continue;
 		g_debug ("Found ColorHug device %s",
 			 g_usb_device_get_platform_id (device_tmp));
-		g_ptr_array_add (devices_ch, device_tmp);
+		g_ptr_array_add (devices_ch, g_object_ref (device_tmp));
 	}
 
 	/* no devices */
 	if (devices_ch->len == 0) {
+		g_ptr_array_unref (devices_ch);
 		g_set_error_literal (error, 1, 0,
 				     _("No ColorHug devices were found"));
 		return NULL;
 	}
+	return devices_ch;
+}
+
+static GUsbDevice *
+ch_util_get_default_device (GUsbContext *usb_ctx, gint device_idx, GError **error)
+{
+	GUsbDevice *device_tmp;
+	g_autoptr(GPtrArray) devices_ch = NULL;
+
+	g_return_val_if_fail (G_USB_IS_CONTEXT (usb_ctx), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	/* filter ColorHug devices */
+	devices_ch = ch_util_get_colorhug_devices (usb_ctx, error);
+	if (devices_ch == NULL)
+		return NULL;
 
 	/* multiple devices */
 	if (devices_ch->len == 1) {
@@ -1760,141 +3476,1258 @@ ch_util_get_default_device (gint device_idx, GError **error)
 	return g_object_ref (device_tmp);
 }
 
-static gboolean
-ch_util_helper_quit_loop_cb (gpointer user_data)
+static gchar *
+ch_util_get_device_cache_filename (void)
 {
-	GMainLoop *loop = (GMainLoop *) user_data;
-	g_main_loop_quit (loop);
-	return FALSE;
+	return g_build_filename (g_get_user_cache_dir (),
+				 "colorhug-client",
+				 "devices.conf",
+				 NULL);
+}
+
+static void
+ch_util_device_cache_save (GKeyFile *keyfile)
+{
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *dirname = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* the cache is only an optimisation, so failure is not fatal */
+	filename = ch_util_get_device_cache_filename ();
+	dirname = g_path_get_dirname (filename);
+	if (g_mkdir_with_parents (dirname, 0700) < 0) {
+		g_debug ("failed to create %s", dirname);
+		return;
+	}
+	data = g_key_file_to_data (keyfile, NULL, NULL);
+	if (!g_file_set_contents (filename, data, -1, &error))
+		g_debug ("failed to save device cache: %s", error->message);
 }
 
 static gboolean
-ch_util_flash_firmware_internal (ChUtilPrivate *priv,
-				 const gchar *filename,
-				 GError **error)
+ch_util_device_has_serial_number (GUsbDevice *device, guint32 serial_number, GError **error)
 {
-	gboolean ret;
-	gsize len = 0;
-	guint16 runcode_addr;
-	GMainLoop *loop = NULL;
-	g_autofree gchar *data_raw = NULL;
-	g_autofree guint8 *data = NULL;
+	guint32 serial_number_tmp = G_MAXUINT32;
+	if (!ch_device_get_serial_number (device,
+					  &serial_number_tmp,
+					  NULL,
+					  error))
+		return FALSE;
+	return serial_number_tmp == serial_number;
+}
+
+static GUsbDevice *
+ch_util_get_device_by_serial_number (GUsbContext *usb_ctx,
+				     guint32 serial_number,
+				     GError **error)
+{
+	GUsbDevice *device_tmp;
+	guint i;
+	guint32 serial_number_tmp;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *platform_id = NULL;
+	g_autoptr(GKeyFile) keyfile = NULL;
+	g_autoptr(GPtrArray) devices_ch = NULL;
 	g_autoptr(GUsbDevice) device = NULL;
 
-	g_return_val_if_fail (filename != NULL, FALSE);
-	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+	/* try the device we found last time */
+	keyfile = g_key_file_new ();
+	filename = ch_util_get_device_cache_filename ();
+	key = g_strdup_printf ("%06u", serial_number);
+	if (g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_NONE, NULL))
+		platform_id = g_key_file_get_string (keyfile, "devices", key, NULL);
+	if (platform_id != NULL) {
+		g_autoptr(GError) error_local = NULL;
+		device = g_usb_context_find_by_platform_id (usb_ctx,
+							    platform_id,
+							    NULL);
+		if (device != NULL &&
+		    ch_device_is_colorhug (device) &&
+		    ch_device_open (device, &error_local)) {
+			if (ch_util_device_has_serial_number (device,
+							      serial_number,
+							      &error_local)) {
+				g_debug ("found %s at %s from cache",
+					 key, platform_id);
+				return g_steal_pointer (&device);
+			}
+			g_usb_device_close (device, NULL);
+		}
+		g_debug ("device cache for %s is out of date: %s", key,
+			 error_local != NULL ? error_local->message : "not found");
+		g_clear_object (&device);
+	}
 
-	/* load file */
-	ret = g_file_get_contents (filename, &data_raw, &len, error);
-	if (!ret)
-		goto out;
+	/* ask every device, remembering what we find */
+	devices_ch = ch_util_get_colorhug_devices (usb_ctx, error);
+	if (devices_ch == NULL)
+		return NULL;
+	for (i = 0; i < devices_ch->len; i++) {
+		g_autofree gchar *key_tmp = NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		/* one busy or broken device should not hide the others */
+		device_tmp = g_ptr_array_index (devices_ch, i);
+		if (!ch_device_open (device_tmp, &error_local)) {
+			g_debug ("ignoring %s: %s",
+				 g_usb_device_get_platform_id (device_tmp),
+				 error_local->message);
+			continue;
+		}
+		serial_number_tmp = G_MAXUINT32;
+		if (!ch_device_get_serial_number (device_tmp,
+						  &serial_number_tmp,
+						  NULL,
+						  &error_local)) {
+			g_debug ("ignoring %s: %s",
+				 g_usb_device_get_platform_id (device_tmp),
+				 error_local->message);
+			g_usb_device_close (device_tmp, NULL);
+			continue;
+		}
+		key_tmp = g_strdup_printf ("%06u", serial_number_tmp);
+		g_key_file_set_string (keyfile, "devices", key_tmp,
+				       g_usb_device_get_platform_id (device_tmp));
+		if (serial_number_tmp == serial_number && device == NULL) {
+			device = g_object_ref (device_tmp);
+			continue;
+		}
+		g_usb_device_close (device_tmp, NULL);
+	}
+	ch_util_device_cache_save (keyfile);
 
-	/* unpack the hex file to a binary blob if required */
-	if (g_str_has_suffix (filename, ".bin")) {
-		data = g_memdup (data_raw, len);
-	} else if (g_str_has_suffix (filename, ".hex")) {
-		runcode_addr = ch_device_get_runcode_address (priv->device);
-		ret = ch_inhx32_to_bin_full (data_raw, &data, &len,
-					     runcode_addr, error);
-		if (!ret)
-			goto out;
-	} else {
-		ret = FALSE;
-		g_set_error_literal (error, 1, 0,
-				     "invalid file type, expect .bin or .hex");
-		goto out;
+	/* not attached */
+	if (device == NULL) {
+		g_set_error (error, 1, 0,
+			     "no device with serial number %s",
+			     key);
+		return NULL;
 	}
+	return g_steal_pointer (&device);
+}
 
-	/* check the blob contains the right magic string */
-	ret = ch_device_check_firmware (priv->device, data, len, error);
-	if (!ret)
-		goto out;
+static gboolean
+ch_util_device_str_is_list (const gchar *device_str)
+{
+	if (device_str == NULL)
+		return FALSE;
+	if (g_strcmp0 (device_str, "all") == 0)
+		return TRUE;
+	if (g_strstr_len (device_str, -1, ",") != NULL)
+		return TRUE;
+	return g_str_has_prefix (device_str, "serial:") ||
+	       g_str_has_prefix (device_str, "index:");
+}
 
-	/* boot to bootloader */
-	loop = g_main_loop_new (NULL, FALSE);
-	switch (ch_device_get_mode (priv->device)) {
-	case CH_DEVICE_MODE_FIRMWARE:
-	case CH_DEVICE_MODE_FIRMWARE2:
-	case CH_DEVICE_MODE_FIRMWARE_ALS:
-	case CH_DEVICE_MODE_FIRMWARE_PLUS:
-	case CH_DEVICE_MODE_LEGACY:
-		ch_device_queue_reset (priv->device_queue, priv->device);
-		ret = ch_device_queue_process (priv->device_queue,
-					       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					       NULL,
-					       error);
-		if (!ret)
-			goto out;
+static GPtrArray *
+ch_util_get_devices (GUsbContext *usb_ctx, const gchar *device_str, GError **error)
+{
+	GUsbDevice *device_tmp;
+	guint i;
+	guint j;
+	g_autofree gboolean *opened = NULL;
+	g_autofree gboolean *selected = NULL;
+	g_autofree guint32 *serials = NULL;
+	g_auto(GStrv) split = NULL;
+	g_autoptr(GPtrArray) devices_ch = NULL;
+	GPtrArray *devices;
 
-		/* wait for the device to reconnect */
-		g_timeout_add (CH_FLASH_RECONNECT_TIMEOUT,
-			       ch_util_helper_quit_loop_cb,
-			       loop);
-		g_main_loop_run (loop);
-		device = ch_util_get_default_device (-1, error);
-		if (device == NULL)
-			goto out;
-		break;
+	devices_ch = ch_util_get_colorhug_devices (usb_ctx, error);
+	if (devices_ch == NULL)
+		return NULL;
+	opened = g_new0 (gboolean, devices_ch->len);
+	selected = g_new0 (gboolean, devices_ch->len);
+	serials = g_new0 (guint32, devices_ch->len);
+
+	/* every device */
+	if (g_strcmp0 (device_str, "all") == 0) {
+		for (i = 0; i < devices_ch->len; i++)
+			selected[i] = TRUE;
+	}
+
+	/* a list of device indexes or serial numbers, where an index can be
+	 * written as 'index:N' or just 'N' and a serial number as 'serial:N' */
+	split = g_strsplit (device_str, ",", -1);
+	for (j = 0; split[j] != NULL && g_strcmp0 (device_str, "all") != 0; j++) {
+		const gchar *str = split[j];
+		gboolean is_serial = FALSE;
+		gchar *endptr = NULL;
+		guint64 tmp;
+
+		if (g_str_has_prefix (str, "serial:")) {
+			str += strlen ("serial:");
+			is_serial = TRUE;
+		} else if (g_str_has_prefix (str, "index:")) {
+			str += strlen ("index:");
+		}
+		tmp = g_ascii_strtoull (str, &endptr, 10);
+		if (!g_ascii_isdigit (str[0]) || endptr[0] != '\0') {
+			g_set_error (error, 1, 0,
+				     "invalid device '%s', expected 'all' or "
+				     "a list of N, index:N or serial:N",
+				     split[j]);
+			return NULL;
+		}
+
+		/* device index */
+		if (!is_serial) {
+			if (tmp >= devices_ch->len) {
+				g_set_error (error, 1, 0,
+					     "invalid device index %s, only %u devices attached",
+					     split[j], devices_ch->len);
+				return NULL;
+			}
+			selected[tmp] = TRUE;
+			continue;
+		}
+
+		/* serial number, which may already have been found */
+		if (tmp > G_MAXUINT32) {
+			g_set_error (error, 1, 0,
+				     "invalid serial number %s", str);
+			return NULL;
+		}
+		for (i = 0; i < devices_ch->len; i++) {
+			if (opened[i] && serials[i] == tmp)
+				break;
+		}
+		if (i == devices_ch->len) {
+			g_autoptr(GUsbDevice) device = NULL;
+			device = ch_util_get_device_by_serial_number (usb_ctx,
+								      tmp,
+								      error);
+			if (device == NULL)
+				return NULL;
+			for (i = 0; i < devices_ch->len; i++) {
+				device_tmp = g_ptr_array_index (devices_ch, i);
+				if (g_strcmp0 (g_usb_device_get_platform_id (device_tmp),
+					       g_usb_device_get_platform_id (device)) == 0)
+					break;
+			}
+			if (i == devices_ch->len) {
+				g_usb_device_close (device, NULL);
+				g_set_error (error, 1, 0,
+					     "no device with serial number %s",
+					     str);
+				return NULL;
+			}
+			opened[i] = TRUE;
+			serials[i] = tmp;
+		}
+		selected[i] = TRUE;
+	}
+
+	/* open the selected devices and close any others */
+	devices = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	for (i = 0; i < devices_ch->len; i++) {
+		device_tmp = g_ptr_array_index (devices_ch, i);
+		if (!selected[i]) {
+			if (opened[i])
+				g_usb_device_close (device_tmp, NULL);
+			continue;
+		}
+		if (!opened[i] && !ch_device_open (device_tmp, error)) {
+			g_ptr_array_unref (devices);
+			return NULL;
+		}
+		g_ptr_array_add (devices, g_object_ref (device_tmp));
+	}
+	return devices;
+}
+
+static void
+ch_util_queue_read_flash (ChUtilPrivate *priv, guint16 address, guint8 *data, gsize len)
+{
+	gsize chunk_len;
+	gsize i;
+
+	/* split into requests the device can handle */
+	for (i = 0; i < len; i += CH_FLASH_TRANSFER_BLOCK_SIZE) {
+		chunk_len = MIN (len - i, CH_FLASH_TRANSFER_BLOCK_SIZE);
+		ch_device_queue_read_flash (priv->device_queue,
+					    priv->device,
+					    address + i,
+					    data + i,
+					    chunk_len);
+	}
+}
+
+static gboolean
+ch_util_helper_quit_loop_cb (gpointer user_data)
+{
+	GMainLoop *loop = (GMainLoop *) user_data;
+	g_main_loop_quit (loop);
+	return FALSE;
+}
+
+/* how long to wait for the device to come back after a reset */
+#define CH_UTIL_RECONNECT_DEADLINE	(CH_FLASH_RECONNECT_TIMEOUT * 2)
+
+typedef struct {
+	GMainLoop		*loop;
+	GUsbContext		*usb_ctx;
+	GUsbDevice		*device;
+	gchar			*platform_id;
+	gulong			 device_added_id;
+} ChUtilReconnect;
+
+static void
+ch_util_reconnect_device_added_cb (GUsbContext *usb_ctx,
+				   GUsbDevice *device,
+				   ChUtilReconnect *helper)
+{
+	/* the device keeps its platform ID when it re-enumerates */
+	if (helper->device != NULL)
+		return;
+	if (!ch_device_is_colorhug (device))
+		return;
+	if (g_strcmp0 (g_usb_device_get_platform_id (device),
+		       helper->platform_id) != 0)
+		return;
+	g_debug ("%s reconnected", helper->platform_id);
+	helper->device = g_object_ref (device);
+	if (g_main_loop_is_running (helper->loop))
+		g_main_loop_quit (helper->loop);
+}
+
+/* this has to be called before the device is reset so no event is missed */
+static ChUtilReconnect *
+ch_util_reconnect_new (GUsbContext *usb_ctx, GUsbDevice *device)
+{
+	ChUtilReconnect *helper = g_new0 (ChUtilReconnect, 1);
+	helper->loop = g_main_loop_new (NULL, FALSE);
+	helper->usb_ctx = g_object_ref (usb_ctx);
+	helper->platform_id = g_strdup (g_usb_device_get_platform_id (device));
+	helper->device_added_id =
+		g_signal_connect (usb_ctx, "device-added",
+				  G_CALLBACK (ch_util_reconnect_device_added_cb),
+				  helper);
+	return helper;
+}
+
+static void
+ch_util_reconnect_free (ChUtilReconnect *helper)
+{
+	g_signal_handler_disconnect (helper->usb_ctx, helper->device_added_id);
+	if (helper->device != NULL)
+		g_object_unref (helper->device);
+	g_object_unref (helper->usb_ctx);
+	g_main_loop_unref (helper->loop);
+	g_free (helper->platform_id);
+	g_free (helper);
+}
+
+static GUsbDevice *
+ch_util_reconnect_wait (ChUtilReconnect *helper, GError **error)
+{
+	guint timeout_id;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+
+	/* wait for the device-added event rather than a fixed time */
+	if (helper->device == NULL) {
+		timeout_id = g_timeout_add (CH_UTIL_RECONNECT_DEADLINE,
+					    ch_util_helper_quit_loop_cb,
+					    helper->loop);
+		g_main_loop_run (helper->loop);
+		if (helper->device == NULL) {
+			g_set_error (error, 1, 0,
+				     "%s did not reconnect within %ums",
+				     helper->platform_id,
+				     (guint) CH_UTIL_RECONNECT_DEADLINE);
+			return NULL;
+		}
+		g_source_remove (timeout_id);
+	}
+
+	/* the device node may not be accessible straight away */
+	while (!ch_device_open (helper->device, &error_local)) {
+		if (g_timer_elapsed (timer, NULL) * 1000 > CH_UTIL_RECONNECT_DEADLINE) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return NULL;
+		}
+		g_clear_error (&error_local);
+		g_usleep (50 * 1000);
+	}
+	return g_object_ref (helper->device);
+}
+
+/* the old device object is useless once the device has re-enumerated */
+static void
+ch_util_set_device (ChUtilPrivate *priv, GUsbDevice *device)
+{
+	if (priv->device == device)
+		return;
+	g_object_unref (priv->device);
+	priv->device = g_object_ref (device);
+}
+
+static void
+ch_util_print_phase (const gchar *phase, GTimer *timer)
+{
+	g_print ("%s:\t%.0fms\n", phase, g_timer_elapsed (timer, NULL) * 1000);
+	g_timer_reset (timer);
+}
+
+/* writes and verifies one erase block at a time, so a bad block is found
+ * straight away rather than in a second pass; with @diff set only the
+ * blocks that differ from what is on the device are written */
+static gboolean
+ch_util_flash_firmware_blocks (ChUtilPrivate *priv,
+			       GUsbDevice *device,
+			       const guint8 *data,
+			       gsize len,
+			       gboolean diff,
+			       GError **error)
+{
+	gsize block_len;
+	gsize i;
+	gsize j;
+	guint blocks_changed = 0;
+	guint blocks_total;
+	guint16 runcode_addr;
+	g_autofree guint8 *data_device = NULL;
+	g_autofree guint8 *data_padded = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+
+	/* read everything that is on the device now in one go */
+	runcode_addr = ch_device_get_runcode_address (device);
+	if (diff) {
+		data_device = g_new0 (guint8, len);
+		for (i = 0; i < len; i += CH_FLASH_TRANSFER_BLOCK_SIZE) {
+			ch_device_queue_read_flash (priv->device_queue,
+						    device,
+						    runcode_addr + i,
+						    data_device + i,
+						    MIN (len - i, CH_FLASH_TRANSFER_BLOCK_SIZE));
+		}
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error))
+			return FALSE;
+		ch_util_print_phase ("Compare", timer);
+	}
+
+	/* pad the last block out to whole transfers, like an erased flash */
+	blocks_total = (len + CH_FLASH_ERASE_BLOCK_SIZE - 1) /
+			CH_FLASH_ERASE_BLOCK_SIZE;
+	data_padded = g_new (guint8, blocks_total * CH_FLASH_ERASE_BLOCK_SIZE);
+	memset (data_padded, 0xff, blocks_total * CH_FLASH_ERASE_BLOCK_SIZE);
+	memcpy (data_padded, data, len);
+
+	/* verify each block before moving on to the next */
+	for (i = 0; i < len; i += CH_FLASH_ERASE_BLOCK_SIZE) {
+		g_autofree guint8 *data_verify = NULL;
+
+		block_len = MIN (len - i, CH_FLASH_ERASE_BLOCK_SIZE);
+		if (diff && memcmp (data + i, data_device + i, block_len) == 0)
+			continue;
+		blocks_changed++;
+		g_print ("Writing block 0x%04x (%u/%u)\n",
+			 (guint) (runcode_addr + i),
+			 (guint) (i / CH_FLASH_ERASE_BLOCK_SIZE) + 1,
+			 blocks_total);
+
+		/* round up to whole transfers */
+		block_len = ((block_len + CH_FLASH_TRANSFER_BLOCK_SIZE - 1) /
+			     CH_FLASH_TRANSFER_BLOCK_SIZE) * CH_FLASH_TRANSFER_BLOCK_SIZE;
+		ch_device_queue_erase_flash (priv->device_queue,
+					     device,
+					     runcode_addr + i,
+					     CH_FLASH_ERASE_BLOCK_SIZE);
+		data_verify = g_new0 (guint8, block_len);
+		for (j = 0; j < block_len; j += CH_FLASH_TRANSFER_BLOCK_SIZE) {
+			ch_device_queue_write_flash (priv->device_queue,
+						     device,
+						     runcode_addr + i + j,
+						     data_padded + i + j,
+						     CH_FLASH_TRANSFER_BLOCK_SIZE);
+			ch_device_queue_read_flash (priv->device_queue,
+						    device,
+						    runcode_addr + i + j,
+						    data_verify + j,
+						    CH_FLASH_TRANSFER_BLOCK_SIZE);
+		}
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error))
+			return FALSE;
+		if (memcmp (data_padded + i, data_verify, block_len) != 0) {
+			g_set_error (error, 1, 0,
+				     "failed to verify block at 0x%04x",
+				     (guint) (runcode_addr + i));
+			return FALSE;
+		}
+	}
+	g_print ("Wrote %u of %u blocks\n", blocks_changed, blocks_total);
+	ch_util_print_phase ("Write and verify", timer);
+	return TRUE;
+}
+
+static gchar *
+ch_util_firmware_cache_get_filename (const gchar *basename)
+{
+	return g_build_filename (g_get_user_cache_dir (),
+				 "colorhug-client",
+				 "firmware",
+				 basename,
+				 NULL);
+}
+
+static GKeyFile *
+ch_util_firmware_cache_load_keyfile (void)
+{
+	GKeyFile *keyfile;
+	g_autofree gchar *filename = NULL;
+
+	keyfile = g_key_file_new ();
+	filename = ch_util_firmware_cache_get_filename ("firmware.conf");
+	g_key_file_load_from_file (keyfile, filename, G_KEY_FILE_NONE, NULL);
+	return keyfile;
+}
+
+static void
+ch_util_firmware_cache_save_keyfile (GKeyFile *keyfile)
+{
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* the cache is only an optimisation, so failure is not fatal */
+	filename = ch_util_firmware_cache_get_filename ("firmware.conf");
+	data = g_key_file_to_data (keyfile, NULL, NULL);
+	if (!g_file_set_contents (filename, data, -1, &error))
+		g_debug ("failed to save firmware cache: %s", error->message);
+}
+
+/* the same source hex unpacks differently for each runcode address */
+static gchar *
+ch_util_firmware_cache_key (const gchar *data_raw, gsize len, guint16 runcode_addr)
+{
+	g_autofree gchar *sha1 = NULL;
+	sha1 = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+					    (const guchar *) data_raw,
+					    len);
+	return g_strdup_printf ("%s-%04x", sha1, runcode_addr);
+}
+
+static void
+ch_util_firmware_cache_prune (GKeyFile *keyfile)
+{
+	guint i;
+	g_auto(GStrv) groups = NULL;
+	g_auto(GStrv) paths = NULL;
+	g_autoptr(GHashTable) keys = NULL;
+
+	/* forget files that no longer exist */
+	keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	paths = g_key_file_get_keys (keyfile, "files", NULL, NULL);
+	for (i = 0; paths != NULL && paths[i] != NULL; i++) {
+		gchar *key;
+		if (!g_file_test (paths[i], G_FILE_TEST_EXISTS)) {
+			g_key_file_remove_key (keyfile, "files", paths[i], NULL);
+			continue;
+		}
+		key = g_key_file_get_string (keyfile, "files", paths[i], NULL);
+		if (key != NULL)
+			g_hash_table_add (keys, key);
+	}
+
+	/* remove anything made from an older version of a file */
+	groups = g_key_file_get_groups (keyfile, NULL);
+	for (i = 0; groups[i] != NULL; i++) {
+		g_autofree gchar *basename = NULL;
+		g_autofree gchar *cache_fn = NULL;
+		if (g_strcmp0 (groups[i], "files") == 0)
+			continue;
+		if (g_hash_table_contains (keys, groups[i]))
+			continue;
+		g_debug ("removing unused %s", groups[i]);
+		basename = g_strdup_printf ("%s.bin", groups[i]);
+		cache_fn = ch_util_firmware_cache_get_filename (basename);
+		g_unlink (cache_fn);
+		g_key_file_remove_group (keyfile, groups[i], NULL);
+	}
+}
+
+static void
+ch_util_firmware_cache_set_file (GKeyFile *keyfile,
+				 const gchar *filename,
+				 const gchar *key)
+{
+	g_autofree gchar *path = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	/* any older version of this file is pruned when nothing else uses it */
+	file = g_file_new_for_path (filename);
+	path = g_file_get_path (file);
+	g_key_file_set_string (keyfile, "files", path, key);
+}
+
+/* the unpacked file could have been truncated or changed on disk */
+static gboolean
+ch_util_firmware_cache_verify (GKeyFile *keyfile, const gchar *key, GBytes *blob)
+{
+	g_autofree gchar *checksum = NULL;
+	g_autofree gchar *checksum_blob = NULL;
+
+	if (g_key_file_get_uint64 (keyfile, key, "size", NULL) != g_bytes_get_size (blob))
+		return FALSE;
+	checksum = g_key_file_get_string (keyfile, key, "checksum", NULL);
+	if (checksum == NULL)
+		return FALSE;
+	checksum_blob = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, blob);
+	return g_strcmp0 (checksum, checksum_blob) == 0;
+}
+
+static GBytes *
+ch_util_firmware_cache_get (GKeyFile *keyfile,
+			    const gchar *filename,
+			    const gchar *key,
+			    const gchar *data_raw,
+			    gsize len,
+			    guint16 runcode_addr,
+			    GError **error)
+{
+	GMappedFile *mapped_file;
+	GBytes *blob;
+	guint8 *data = NULL;
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *cache_dir = NULL;
+	g_autofree gchar *cache_fn = NULL;
+	g_autofree gchar *checksum = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	/* binary files need no unpacking */
+	if (g_str_has_suffix (filename, ".bin"))
+		return g_bytes_new (data_raw, len);
+	if (!g_str_has_suffix (filename, ".hex")) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid file type, expect .bin or .hex");
+		return NULL;
+	}
+
+	/* already unpacked */
+	basename = g_strdup_printf ("%s.bin", key);
+	cache_fn = ch_util_firmware_cache_get_filename (basename);
+	mapped_file = g_mapped_file_new (cache_fn, FALSE, NULL);
+	if (mapped_file != NULL) {
+		blob = g_mapped_file_get_bytes (mapped_file);
+		g_mapped_file_unref (mapped_file);
+		if (ch_util_firmware_cache_verify (keyfile, key, blob)) {
+			g_debug ("using cached %s", cache_fn);
+			return blob;
+		}
+		g_debug ("ignoring invalid %s", cache_fn);
+		g_bytes_unref (blob);
+		g_unlink (cache_fn);
+	}
+
+	/* unpack and save for next time */
+	if (!ch_inhx32_to_bin_full (data_raw, &data, &len, runcode_addr, error))
+		return NULL;
+	cache_dir = g_path_get_dirname (cache_fn);
+	if (g_mkdir_with_parents (cache_dir, 0700) < 0) {
+		g_debug ("failed to create %s", cache_dir);
+	} else if (!g_file_set_contents (cache_fn, (const gchar *) data,
+					 len, &error_local)) {
+		g_debug ("failed to cache firmware: %s", error_local->message);
+	} else {
+		checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1, data, len);
+		g_key_file_set_uint64 (keyfile, key, "size", len);
+		g_key_file_set_string (keyfile, key, "checksum", checksum);
+	}
+	return g_bytes_new_take (data, len);
+}
+
+static gboolean
+ch_util_firmware_cache_check (GKeyFile *keyfile,
+			      const gchar *key,
+			      GUsbDevice *device,
+			      GBytes *blob,
+			      GError **error)
+{
+	g_autofree gchar *mode = NULL;
+
+	/* the magic string only has to be found once for each device type */
+	mode = g_strdup_printf ("checked-mode%i", ch_device_get_mode (device));
+	if (g_key_file_get_boolean (keyfile, key, mode, NULL))
+		return TRUE;
+	if (!ch_device_check_firmware (device,
+				       g_bytes_get_data (blob, NULL),
+				       g_bytes_get_size (blob),
+				       error))
+		return FALSE;
+	g_key_file_set_boolean (keyfile, key, mode, TRUE);
+	return TRUE;
+}
+
+/* returns a blob, checked for @device if set, reusing the unpacked file if possible */
+static GBytes *
+ch_util_firmware_load (GUsbDevice *device,
+		       guint16 runcode_addr,
+		       const gchar *filename,
+		       GError **error)
+{
+	gsize len = 0;
+	g_autofree gchar *data_raw = NULL;
+	g_autofree gchar *key = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GKeyFile) keyfile = NULL;
+
+	/* hashing the file is much quicker than parsing it */
+	if (!g_file_get_contents (filename, &data_raw, &len, error))
+		return NULL;
+	key = ch_util_firmware_cache_key (data_raw, len, runcode_addr);
+	keyfile = ch_util_firmware_cache_load_keyfile ();
+	blob = ch_util_firmware_cache_get (keyfile, filename, key,
+					   data_raw, len, runcode_addr,
+					   error);
+	if (blob == NULL)
+		return NULL;
+	ch_util_firmware_cache_set_file (keyfile, filename, key);
+	ch_util_firmware_cache_prune (keyfile);
+	if (device != NULL &&
+	    !ch_util_firmware_cache_check (keyfile, key, device, blob, error))
+		return NULL;
+	ch_util_firmware_cache_save_keyfile (keyfile);
+	return g_steal_pointer (&blob);
+}
+
+static gboolean
+ch_util_flash_firmware_internal (ChUtilPrivate *priv,
+				 const gchar *filename,
+				 gboolean diff,
+				 GError **error)
+{
+	const guint8 *data;
+	gsize len = 0;
+	ChUtilReconnect *reconnect = NULL;
+	g_autoptr(GBytes) blob = NULL;
+	g_autoptr(GTimer) timer = NULL;
+	g_autoptr(GTimer) timer_total = NULL;
+	g_autoptr(GUsbDevice) device = NULL;
+
+	g_return_val_if_fail (filename != NULL, FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	/* load file, and check the blob contains the right magic string */
+	timer = g_timer_new ();
+	timer_total = g_timer_new ();
+	blob = ch_util_firmware_load (priv->device,
+				      ch_device_get_runcode_address (priv->device),
+				      filename,
+				      error);
+	if (blob == NULL)
+		return FALSE;
+	data = g_bytes_get_data (blob, &len);
+	ch_util_print_phase ("Load", timer);
+
+	/* boot to bootloader */
+	switch (ch_device_get_mode (priv->device)) {
+	case CH_DEVICE_MODE_FIRMWARE:
+	case CH_DEVICE_MODE_FIRMWARE2:
+	case CH_DEVICE_MODE_FIRMWARE_ALS:
+	case CH_DEVICE_MODE_FIRMWARE_PLUS:
+	case CH_DEVICE_MODE_LEGACY:
+		reconnect = ch_util_reconnect_new (priv->usb_ctx, priv->device);
+		ch_device_queue_reset (priv->device_queue, priv->device);
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error)) {
+			ch_util_reconnect_free (reconnect);
+			return FALSE;
+		}
+
+		/* wait for the device to reconnect */
+		device = ch_util_reconnect_wait (reconnect, error);
+		ch_util_reconnect_free (reconnect);
+		if (device == NULL)
+			return FALSE;
+		ch_util_set_device (priv, device);
+		ch_util_print_phase ("Reset", timer);
+		break;
+	default:
+		device = g_object_ref (priv->device);
+		break;
+	}
+
+	/* write firmware */
+	ch_device_queue_set_flash_success (priv->device_queue,
+					   device,
+					   0x00);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+	if (!ch_util_flash_firmware_blocks (priv, device, data, len, diff, error))
+		return FALSE;
+
+	/* boot the new firmware and wait again for the device to reconnect */
+	reconnect = ch_util_reconnect_new (priv->usb_ctx, device);
+	ch_device_queue_boot_flash (priv->device_queue,
+				    device);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error)) {
+		ch_util_reconnect_free (reconnect);
+		return FALSE;
+	}
+	g_object_unref (device);
+	device = ch_util_reconnect_wait (reconnect, error);
+	ch_util_reconnect_free (reconnect);
+	if (device == NULL)
+		return FALSE;
+	ch_util_set_device (priv, device);
+	ch_util_print_phase ("Boot", timer);
+
+	/* set flash success true */
+	ch_device_queue_set_flash_success (priv->device_queue,
+					   device,
+					   0x01);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+	g_print ("Total:\t%.0fms\n", g_timer_elapsed (timer_total, NULL) * 1000);
+	return TRUE;
+}
+
+typedef enum {
+	CH_UTIL_FLASH_STATE_RESET,
+	CH_UTIL_FLASH_STATE_WAIT_BOOTLOADER,
+	CH_UTIL_FLASH_STATE_WRITE,
+	CH_UTIL_FLASH_STATE_WAIT_FIRMWARE,
+	CH_UTIL_FLASH_STATE_SET_SUCCESS,
+	CH_UTIL_FLASH_STATE_DONE,
+	CH_UTIL_FLASH_STATE_FAILED
+} ChUtilFlashState;
+
+typedef struct {
+	GMainLoop		*loop;
+	GPtrArray		*devices;
+	guint			 remaining;
+} ChUtilFlashAll;
+
+typedef struct {
+	ChUtilFlashAll		*all;
+	ChUtilFlashState	 state;
+	ChDeviceQueue		*device_queue;
+	GBytes			*blob;
+	GError			*error;
+	GTimer			*timer;
+	GTimer			*timer_phase;
+	GUsbDevice		*device;
+	GUsbDevice		*device_new;
+	gchar			*platform_id;
+	gdouble			 elapsed;
+	guint			 timeout_id;
+	guint32			 serial_number;
+} ChUtilFlashDevice;
+
+static void
+ch_util_flash_device_free (ChUtilFlashDevice *fd)
+{
+	if (fd->timeout_id != 0)
+		g_source_remove (fd->timeout_id);
+	if (fd->device_new != NULL)
+		g_object_unref (fd->device_new);
+	if (fd->blob != NULL)
+		g_bytes_unref (fd->blob);
+	g_clear_error (&fd->error);
+	g_object_unref (fd->device_queue);
+	g_object_unref (fd->device);
+	g_timer_destroy (fd->timer);
+	g_timer_destroy (fd->timer_phase);
+	g_free (fd->platform_id);
+	g_free (fd);
+}
+
+static void
+ch_util_flash_device_finished (ChUtilFlashDevice *fd, GError *error)
+{
+	if (fd->timeout_id != 0) {
+		g_source_remove (fd->timeout_id);
+		fd->timeout_id = 0;
+	}
+	fd->elapsed = g_timer_elapsed (fd->timer, NULL);
+	if (error != NULL) {
+		g_debug ("%s failed: %s", fd->platform_id, error->message);
+		fd->state = CH_UTIL_FLASH_STATE_FAILED;
+		fd->error = error;
+	} else {
+		fd->state = CH_UTIL_FLASH_STATE_DONE;
+	}
+	if (--fd->all->remaining == 0)
+		g_main_loop_quit (fd->all->loop);
+}
+
+static void ch_util_flash_device_write (ChUtilFlashDevice *fd);
+static void ch_util_flash_device_set_success (ChUtilFlashDevice *fd);
+
+static gboolean
+ch_util_flash_device_timeout_cb (gpointer user_data)
+{
+	ChUtilFlashDevice *fd = (ChUtilFlashDevice *) user_data;
+	fd->timeout_id = 0;
+	ch_util_flash_device_finished (fd, g_error_new (1, 0,
+			"did not reconnect within %ums",
+			(guint) CH_UTIL_RECONNECT_DEADLINE));
+	return FALSE;
+}
+
+static gboolean
+ch_util_flash_device_open_cb (gpointer user_data)
+{
+	ChUtilFlashDevice *fd = (ChUtilFlashDevice *) user_data;
+	g_autoptr(GError) error = NULL;
+
+	/* the device node may not be accessible straight away */
+	fd->timeout_id = 0;
+	if (!ch_device_open (fd->device_new, &error)) {
+		if (g_timer_elapsed (fd->timer_phase, NULL) * 1000 > CH_UTIL_RECONNECT_DEADLINE) {
+			ch_util_flash_device_finished (fd, g_steal_pointer (&error));
+			return FALSE;
+		}
+		fd->timeout_id = g_timeout_add (50, ch_util_flash_device_open_cb, fd);
+		return FALSE;
+	}
+
+	/* carry on with the new device */
+	g_object_unref (fd->device);
+	fd->device = g_steal_pointer (&fd->device_new);
+	if (fd->state == CH_UTIL_FLASH_STATE_WAIT_BOOTLOADER)
+		ch_util_flash_device_write (fd);
+	else
+		ch_util_flash_device_set_success (fd);
+	return FALSE;
+}
+
+static void
+ch_util_flash_device_wait (ChUtilFlashDevice *fd, ChUtilFlashState state)
+{
+	/* the device-added event may have beaten the reply */
+	fd->state = state;
+	g_timer_reset (fd->timer_phase);
+	if (fd->device_new != NULL) {
+		ch_util_flash_device_open_cb (fd);
+		return;
+	}
+	fd->timeout_id = g_timeout_add (CH_UTIL_RECONNECT_DEADLINE,
+					ch_util_flash_device_timeout_cb,
+					fd);
+}
+
+static void
+ch_util_flash_all_device_added_cb (GUsbContext *usb_ctx,
+				   GUsbDevice *device,
+				   ChUtilFlashAll *all)
+{
+	ChUtilFlashDevice *fd;
+	guint i;
+
+	/* find which device this is from where it is plugged in */
+	if (!ch_device_is_colorhug (device))
+		return;
+	for (i = 0; i < all->devices->len; i++) {
+		fd = g_ptr_array_index (all->devices, i);
+		if (g_strcmp0 (fd->platform_id,
+			       g_usb_device_get_platform_id (device)) != 0)
+			continue;
+		if (fd->device_new != NULL)
+			return;
+		switch (fd->state) {
+		case CH_UTIL_FLASH_STATE_RESET:
+		case CH_UTIL_FLASH_STATE_WRITE:
+			fd->device_new = g_object_ref (device);
+			break;
+		case CH_UTIL_FLASH_STATE_WAIT_BOOTLOADER:
+		case CH_UTIL_FLASH_STATE_WAIT_FIRMWARE:
+			g_source_remove (fd->timeout_id);
+			fd->timeout_id = 0;
+			fd->device_new = g_object_ref (device);
+			ch_util_flash_device_open_cb (fd);
+			break;
+		default:
+			break;
+		}
+		return;
+	}
+}
+
+static void
+ch_util_flash_device_set_success_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	ChUtilFlashDevice *fd = (ChUtilFlashDevice *) user_data;
+	GError *error = NULL;
+	ch_device_queue_process_finish (CH_DEVICE_QUEUE (source), res, &error);
+	ch_util_flash_device_finished (fd, error);
+}
+
+static void
+ch_util_flash_device_set_success (ChUtilFlashDevice *fd)
+{
+	/* set flash success true */
+	fd->state = CH_UTIL_FLASH_STATE_SET_SUCCESS;
+	ch_device_queue_set_flash_success (fd->device_queue,
+					   fd->device,
+					   0x01);
+	ch_device_queue_process_async (fd->device_queue,
+				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				       NULL,
+				       ch_util_flash_device_set_success_cb,
+				       fd);
+}
+
+static void
+ch_util_flash_device_write_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	ChUtilFlashDevice *fd = (ChUtilFlashDevice *) user_data;
+	GError *error = NULL;
+
+	if (!ch_device_queue_process_finish (CH_DEVICE_QUEUE (source), res, &error)) {
+		ch_util_flash_device_finished (fd, error);
+		return;
+	}
+	ch_util_flash_device_wait (fd, CH_UTIL_FLASH_STATE_WAIT_FIRMWARE);
+}
+
+static void
+ch_util_flash_device_write (ChUtilFlashDevice *fd)
+{
+	gsize len;
+	const guint8 *data;
+
+	/* write, verify and boot in one transaction */
+	fd->state = CH_UTIL_FLASH_STATE_WRITE;
+	data = g_bytes_get_data (fd->blob, &len);
+	ch_device_queue_set_flash_success (fd->device_queue,
+					   fd->device,
+					   0x00);
+	ch_device_queue_write_firmware (fd->device_queue,
+					fd->device,
+					data,
+					len);
+	ch_device_queue_verify_firmware (fd->device_queue,
+					 fd->device,
+					 data,
+					 len);
+	ch_device_queue_boot_flash (fd->device_queue,
+				    fd->device);
+	ch_device_queue_process_async (fd->device_queue,
+				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				       NULL,
+				       ch_util_flash_device_write_cb,
+				       fd);
+}
+
+static void
+ch_util_flash_device_reset_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	ChUtilFlashDevice *fd = (ChUtilFlashDevice *) user_data;
+	GError *error = NULL;
+
+	if (!ch_device_queue_process_finish (CH_DEVICE_QUEUE (source), res, &error)) {
+		ch_util_flash_device_finished (fd, error);
+		return;
+	}
+	ch_util_flash_device_wait (fd, CH_UTIL_FLASH_STATE_WAIT_BOOTLOADER);
+}
+
+static void
+ch_util_flash_device_start (ChUtilFlashDevice *fd)
+{
+	switch (ch_device_get_mode (fd->device)) {
+	case CH_DEVICE_MODE_FIRMWARE:
+	case CH_DEVICE_MODE_FIRMWARE2:
+	case CH_DEVICE_MODE_FIRMWARE_ALS:
+	case CH_DEVICE_MODE_FIRMWARE_PLUS:
+	case CH_DEVICE_MODE_LEGACY:
+		/* boot to bootloader */
+		fd->state = CH_UTIL_FLASH_STATE_RESET;
+		ch_device_queue_reset (fd->device_queue, fd->device);
+		ch_device_queue_process_async (fd->device_queue,
+					       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					       NULL,
+					       ch_util_flash_device_reset_cb,
+					       fd);
+		break;
+	default:
+		ch_util_flash_device_write (fd);
+		break;
+	}
+}
+
+static GBytes *
+ch_util_flash_all_get_blob (GHashTable *blobs,
+			    GUsbDevice *device,
+			    const gchar *filename,
+			    GError **error)
+{
+	GBytes *blob;
+	guint16 runcode_addr;
+
+	/* only load the file once for each runcode address */
+	runcode_addr = ch_device_get_runcode_address (device);
+	blob = g_hash_table_lookup (blobs, GUINT_TO_POINTER (runcode_addr));
+	if (blob != NULL)
+		return g_bytes_ref (blob);
+	blob = ch_util_firmware_load (NULL, runcode_addr, filename, error);
+	if (blob == NULL)
+		return NULL;
+	g_hash_table_insert (blobs, GUINT_TO_POINTER (runcode_addr), g_bytes_ref (blob));
+	return blob;
+}
+
+static const gchar *
+ch_util_flash_state_to_string (ChUtilFlashState state)
+{
+	switch (state) {
+	case CH_UTIL_FLASH_STATE_RESET:
+		return "reset";
+	case CH_UTIL_FLASH_STATE_WAIT_BOOTLOADER:
+		return "wait-bootloader";
+	case CH_UTIL_FLASH_STATE_WRITE:
+		return "write";
+	case CH_UTIL_FLASH_STATE_WAIT_FIRMWARE:
+		return "wait-firmware";
+	case CH_UTIL_FLASH_STATE_SET_SUCCESS:
+		return "set-success";
+	case CH_UTIL_FLASH_STATE_DONE:
+		return "done";
+	case CH_UTIL_FLASH_STATE_FAILED:
+		return "failed";
 	default:
-		device = g_object_ref (priv->device);
 		break;
 	}
+	return NULL;
+}
 
-	/* write firmware */
-	ch_device_queue_set_flash_success (priv->device_queue,
-					   device,
-					   0x00);
-	ch_device_queue_write_firmware (priv->device_queue,
-					device,
-					data,
-					len);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		goto out;
+static gboolean
+ch_util_flash_firmware_all (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	ChUtilFlashAll all;
+	ChUtilFlashDevice *fd;
+	GUsbDevice *device;
+	gulong device_added_id;
+	guint failed = 0;
+	guint i;
+	g_autoptr(GHashTable) blobs = NULL;
+	g_autoptr(GMainLoop) loop = NULL;
+	g_autoptr(GPtrArray) devices = NULL;
+	g_autoptr(GPtrArray) flash_devices = NULL;
 
-	/* read firmware */
-	ch_device_queue_verify_firmware (priv->device_queue,
-					 device,
-					 data,
-					 len);
-	ch_device_queue_boot_flash (priv->device_queue,
-				    device);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		goto out;
+	/* parse */
+	if (g_strv_length (values) != 1) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'filename'");
+		return FALSE;
+	}
 
-	/* wait again for the device to reconnect */
-	g_object_unref (device);
-	g_timeout_add (CH_FLASH_RECONNECT_TIMEOUT,
-		       ch_util_helper_quit_loop_cb,
-		       loop);
-	g_main_loop_run (loop);
-	device = ch_util_get_default_device (-1, error);
-	if (device == NULL) {
-		ret = FALSE;
-		goto out;
+	/* use the selected devices, or every one attached */
+	if (priv->devices != NULL) {
+		devices = g_ptr_array_ref (priv->devices);
+	} else if (priv->device != NULL) {
+		devices = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+		g_ptr_array_add (devices, g_object_ref (priv->device));
+	} else {
+		devices = ch_util_get_colorhug_devices (priv->usb_ctx, error);
+		if (devices == NULL)
+			return FALSE;
 	}
 
-	/* set flash success true */
-	ch_device_queue_set_flash_success (priv->device_queue,
-					   device,
-					   0x01);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		goto out;
-out:
-	if (loop != NULL)
-		g_main_loop_unref (loop);
-	return ret;
+	/* check the firmware is suitable for every device first */
+	blobs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+				       NULL, (GDestroyNotify) g_bytes_unref);
+	flash_devices = g_ptr_array_new_with_free_func ((GDestroyNotify) ch_util_flash_device_free);
+	loop = g_main_loop_new (NULL, FALSE);
+	all.loop = loop;
+	all.devices = flash_devices;
+	all.remaining = devices->len;
+	for (i = 0; i < devices->len; i++) {
+		g_autoptr(GError) error_local = NULL;
+		device = g_ptr_array_index (devices, i);
+		if (!ch_device_open (device, &error_local) &&
+		    !g_error_matches (error_local,
+				      G_USB_DEVICE_ERROR,
+				      G_USB_DEVICE_ERROR_ALREADY_OPEN)) {
+			g_propagate_error (error, g_steal_pointer (&error_local));
+			return FALSE;
+		}
+		fd = g_new0 (ChUtilFlashDevice, 1);
+		fd->all = &all;
+		fd->device = g_object_ref (device);
+		fd->device_queue = ch_device_queue_new ();
+		fd->platform_id = g_strdup (g_usb_device_get_platform_id (device));
+		fd->timer = g_timer_new ();
+		fd->timer_phase = g_timer_new ();
+		fd->serial_number = G_MAXUINT32;
+		g_ptr_array_add (flash_devices, fd);
+		fd->blob = ch_util_flash_all_get_blob (blobs,
+						       device,
+						       values[0],
+						       error);
+		if (fd->blob == NULL)
+			return FALSE;
+		if (!ch_device_check_firmware (device,
+					       g_bytes_get_data (fd->blob, NULL),
+					       g_bytes_get_size (fd->blob),
+					       &error_local)) {
+			g_set_error (error, 1, 0, "%s: %s",
+				     fd->platform_id, error_local->message);
+			return FALSE;
+		}
+
+		/* only the firmware knows the serial number */
+		if (ch_device_get_mode (device) != CH_DEVICE_MODE_BOOTLOADER &&
+		    ch_device_get_mode (device) != CH_DEVICE_MODE_BOOTLOADER2 &&
+		    ch_device_get_mode (device) != CH_DEVICE_MODE_BOOTLOADER_ALS &&
+		    ch_device_get_mode (device) != CH_DEVICE_MODE_BOOTLOADER_PLUS) {
+			ch_device_get_serial_number (device,
+						     &fd->serial_number,
+						     NULL,
+						     NULL);
+		}
+	}
+
+	/* flash all the devices at the same time */
+	device_added_id = g_signal_connect (priv->usb_ctx, "device-added",
+					    G_CALLBACK (ch_util_flash_all_device_added_cb),
+					    &all);
+	for (i = 0; i < flash_devices->len; i++)
+		ch_util_flash_device_start (g_ptr_array_index (flash_devices, i));
+	g_main_loop_run (loop);
+	g_signal_handler_disconnect (priv->usb_ctx, device_added_id);
+
+	/* print a table of results */
+	g_print ("Device\t\tSerial\tResult\tTime\n");
+	for (i = 0; i < flash_devices->len; i++) {
+		g_autofree gchar *serial = NULL;
+		fd = g_ptr_array_index (flash_devices, i);
+		if (fd->serial_number != G_MAXUINT32)
+			serial = g_strdup_printf ("%06u", fd->serial_number);
+		else
+			serial = g_strdup ("-");
+		if (fd->state == CH_UTIL_FLASH_STATE_DONE) {
+			g_print ("%s\t%s\tPASS\t%.1fs\n",
+				 fd->platform_id, serial, fd->elapsed);
+			continue;
+		}
+		g_print ("%s\t%s\tFAIL\t%.1fs\t%s\n",
+			 fd->platform_id, serial, fd->elapsed,
+			 fd->error != NULL ? fd->error->message :
+			 ch_util_flash_state_to_string (fd->state));
+		failed++;
+	}
+	if (failed > 0) {
+		g_set_error (error, 1, 0,
+			     "failed to flash %u of %u devices",
+			     failed, flash_devices->len);
+		return FALSE;
+	}
+	return TRUE;
 }
 
 static gboolean
@@ -1908,7 +4741,7 @@ ch_util_flash_firmware_force (ChUtilPrivate *priv, gchar **values, GError **erro
 	}
 
 	/* set to HW */
-	if (!ch_util_flash_firmware_internal (priv, values[0], error))
+	if (!ch_util_flash_firmware_internal (priv, values[0], FALSE, error))
 		return FALSE;
 
 	/* print success */
@@ -1917,7 +4750,7 @@ ch_util_flash_firmware_force (ChUtilPrivate *priv, gchar **values, GError **erro
 }
 
 static gboolean
-ch_util_flash_firmware (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_flash_firmware_prompt (ChUtilPrivate *priv, gchar **values, gboolean diff, GError **error)
 {
 	/* parse */
 	if (g_strv_length (values) != 1) {
@@ -1936,7 +4769,7 @@ ch_util_flash_firmware (ChUtilPrivate *priv, gchar **values, GError **error)
 	}
 
 	/* set to HW */
-	if (!ch_util_flash_firmware_internal (priv, values[0], error))
+	if (!ch_util_flash_firmware_internal (priv, values[0], diff, error))
 		return FALSE;
 
 	/* print success */
@@ -1945,28 +4778,41 @@ ch_util_flash_firmware (ChUtilPrivate *priv, gchar **values, GError **error)
 }
 
 static gboolean
-ch_util_get_pre_scale (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_flash_firmware (ChUtilPrivate *priv, gchar **values, GError **error)
 {
-	gboolean ret;
-	gdouble pre_scale = 0.0f;
+	return ch_util_flash_firmware_prompt (priv, values, FALSE, error);
+}
+
+static gboolean
+ch_util_flash_firmware_diff_cmd (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	return ch_util_flash_firmware_prompt (priv, values, TRUE, error);
+}
+
+static gboolean
+ch_util_get_pre_scale_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
+{
+	gdouble *pre_scale = (gdouble *) user_data;
+	g_print ("Pre Scale: %f\n", *pre_scale);
+	ch_util_result_add_double (priv, "pre_scale", *pre_scale);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_pre_scale (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	gdouble *pre_scale = g_new0 (gdouble, 1);
 
 	/* get from HW */
 	ch_device_queue_get_pre_scale (priv->device_queue,
 				       priv->device,
-				       &pre_scale);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("Pre Scale: %f\n", pre_scale);
+				       pre_scale);
+	ch_util_pending_set (pending, ch_util_get_pre_scale_print, pre_scale);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_pre_scale (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_pre_scale (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	gdouble pre_scale;
 
@@ -1988,35 +4834,33 @@ ch_util_set_pre_scale (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_set_pre_scale (priv->device_queue,
 				       priv->device,
 				       pre_scale);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
-ch_util_get_dac_value (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_dac_value_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	gdouble dac_value = 0.0f;
+	gdouble *dac_value = (gdouble *) user_data;
+	g_print ("DAC value: %f\n", *dac_value);
+	ch_util_result_add_double (priv, "dac_value", *dac_value);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_dac_value (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	gdouble *dac_value = g_new0 (gdouble, 1);
 
 	/* get from HW */
 	ch_device_queue_get_dac_value (priv->device_queue,
 				       priv->device,
-				       &dac_value);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("DAC value: %f\n", dac_value);
+				       dac_value);
+	ch_util_pending_set (pending, ch_util_get_dac_value_print, dac_value);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_dac_value (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_dac_value (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	gdouble dac_value;
 
@@ -2038,35 +4882,38 @@ ch_util_set_dac_value (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_set_dac_value (priv->device_queue,
 				       priv->device,
 				       dac_value);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
+}
+
+typedef struct {
+	gdouble		 vref_neg;
+	gdouble		 vref_pos;
+} ChUtilAdcVrefs;
+
+static gboolean
+ch_util_get_adc_vrefs_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
+{
+	ChUtilAdcVrefs *vrefs = (ChUtilAdcVrefs *) user_data;
+	g_print ("ADC Vref+: %f Volts\n", vrefs->vref_pos);
+	g_print ("ADC Vref-: %f Volts\n", vrefs->vref_neg);
+	ch_util_result_add_double (priv, "adc_vref_pos", vrefs->vref_pos);
+	ch_util_result_add_double (priv, "adc_vref_neg", vrefs->vref_neg);
+	return TRUE;
 }
 
 static gboolean
-ch_util_get_adc_vrefs (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_adc_vrefs (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
-	gboolean ret;
-	gdouble vref_neg = 0.0f;
-	gdouble vref_pos = 0.0f;
+	ChUtilAdcVrefs *vrefs = g_new0 (ChUtilAdcVrefs, 1);
 
 	/* get from HW */
 	ch_device_queue_get_adc_vref_neg (priv->device_queue,
 					  priv->device,
-					  &vref_neg);
+					  &vrefs->vref_neg);
 	ch_device_queue_get_adc_vref_pos (priv->device_queue,
 					  priv->device,
-					  &vref_pos);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("ADC Vref+: %f Volts\n", vref_pos);
-	g_print ("ADC Vref-: %f Volts\n", vref_neg);
+					  &vrefs->vref_pos);
+	ch_util_pending_set (pending, ch_util_get_adc_vrefs_print, vrefs);
 	return TRUE;
 }
 
@@ -2086,6 +4933,7 @@ ch_util_get_ccd_calibration (ChUtilPrivate *priv, gchar **values, GError **error
 		 ccd_calibration[1],
 		 ccd_calibration[2],
 		 ccd_calibration[3]);
+	ch_util_result_add_doubles (priv, "ccd_calibration", ccd_calibration, 4);
 	return TRUE;
 }
 
@@ -2140,28 +4988,43 @@ ch_util_set_crypto_key (ChUtilPrivate *priv, gchar **values, GError **error)
 static gboolean
 ch_util_inhx32_to_bin (ChUtilPrivate *priv, gchar **values, GError **error)
 {
+	const guint8 *out;
 	gsize len = 0;
-	guint16 runcode_addr;
-	g_autofree gchar *data = NULL;
-	g_autofree guint8 *out = NULL;
+	guint64 runcode_addr = CH_EEPROM_ADDR_RUNCODE;
+	g_autoptr(GBytes) blob = NULL;
 
 	/* parse */
-	if (g_strv_length (values) != 2 ||
+	if (g_strv_length (values) < 2 || g_strv_length (values) > 3 ||
 	    !g_str_has_suffix (values[0], ".hex") ||
 	    !g_str_has_suffix (values[1], ".bin")) {
 		g_set_error_literal (error, 1, 0,
-				     "invalid input, expect 'foo.hex', 'bar.bin'");
+				     "invalid input, expect 'foo.hex', 'bar.bin' "
+				     "['runcode_address (base-16)']");
 		return FALSE;
 	}
 
-	/* load file */
-	if (!g_file_get_contents (values[0], &data, &len, error))
-		return FALSE;
+	/* a device is only opened for this with --device or --serial, or in
+	 * batch mode, so otherwise the address has to be given for anything
+	 * other than the original ColorHug */
+	if (priv->device != NULL)
+		runcode_addr = ch_device_get_runcode_address (priv->device);
+	if (values[2] != NULL) {
+		gchar *endptr = NULL;
+		runcode_addr = g_ascii_strtoull (values[2], &endptr, 16);
+		if (!g_ascii_isxdigit (values[2][0]) || endptr[0] != '\0' ||
+		    runcode_addr > 0xffff) {
+			g_set_error (error, 1, 0,
+				     "invalid runcode address %s",
+				     values[2]);
+			return FALSE;
+		}
+	}
 
 	/* convert */
-	runcode_addr = ch_device_get_runcode_address (priv->device);
-	if (!ch_inhx32_to_bin_full (data, &out, &len, runcode_addr, error))
+	blob = ch_util_firmware_load (NULL, runcode_addr, values[0], error);
+	if (blob == NULL)
 		return FALSE;
+	out = g_bytes_get_data (blob, &len);
 
 	/* save file */
 	return g_file_set_contents (values[1], (const gchar *) out, len, error);
@@ -2213,31 +5076,33 @@ ch_util_get_temperature (ChUtilPrivate *priv, gchar **values, GError **error)
 		return FALSE;
 
 	g_print ("Temperature: %f\n", temperature);
+	ch_util_result_add_double (priv, "temperature", temperature);
 	return TRUE;
 }
 
 static gboolean
-ch_util_get_post_scale (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_post_scale_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	gdouble post_scale = 0.0f;
+	gdouble *post_scale = (gdouble *) user_data;
+	g_print ("Post Scale: %f\n", *post_scale);
+	ch_util_result_add_double (priv, "post_scale", *post_scale);
+	return TRUE;
+}
+
+static gboolean
+ch_util_get_post_scale (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	gdouble *post_scale = g_new0 (gdouble, 1);
 
 	/* get from HW */
 	ch_device_queue_get_post_scale (priv->device_queue, priv->device,
-					&post_scale);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
-
-	g_print ("Post Scale: %f\n", post_scale);
+					post_scale);
+	ch_util_pending_set (pending, ch_util_get_post_scale_print, post_scale);
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_post_scale (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_post_scale (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	gdouble post_scale;
 
@@ -2258,10 +5123,7 @@ ch_util_set_post_scale (ChUtilPrivate *priv, gchar **values, GError **error)
 	/* set to HW */
 	ch_device_queue_set_post_scale (priv->device_queue, priv->device,
 					post_scale);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
@@ -2270,14 +5132,13 @@ ch_util_boot_flash (ChUtilPrivate *priv, gchar **values, GError **error)
 	/* set to HW */
 	ch_device_queue_boot_flash (priv->device_queue,
 				    priv->device);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return ch_util_queue_process (priv,
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				      error);
 }
 
 static gboolean
-ch_util_set_flash_success (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_set_flash_success (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	gboolean flash_success;
 
@@ -2299,10 +5160,7 @@ ch_util_set_flash_success (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_set_flash_success (priv->device_queue,
 					   priv->device,
 					   flash_success);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
 }
 
 static gboolean
@@ -2369,10 +5227,9 @@ ch_util_eeprom_write (ChUtilPrivate *priv, gchar **values, GError **error)
 				     address,
 				     data,
 				     len);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				     error);
 	if (!ret)
 		return FALSE;
 
@@ -2382,10 +5239,9 @@ ch_util_eeprom_write (ChUtilPrivate *priv, gchar **values, GError **error)
 				     address | CH_FLASH_TRANSFER_BLOCK_SIZE,
 				     data,
 				     len);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				     error);
 	if (!ret)
 		return FALSE;
 
@@ -2427,10 +5283,156 @@ ch_util_eeprom_erase (ChUtilPrivate *priv, gchar **values, GError **error)
 				     priv->device,
 				     address,
 				     len);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return ch_util_queue_process (priv,
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				      error);
+}
+
+static gboolean
+ch_util_check_flash_range (ChUtilPrivate *priv, guint64 address, gsize len, GError **error)
+{
+	if (address < ch_device_get_runcode_address (priv->device) ||
+	    address > G_MAXUINT16) {
+		g_set_error (error, 1, 0,
+			     "invalid address 0x%04x",
+			     (guint) address);
+		return FALSE;
+	}
+	if (len < 1 || address + len > G_MAXUINT16 + 1) {
+		g_set_error (error, 1, 0,
+			     "invalid length %" G_GSIZE_FORMAT,
+			     len);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+ch_util_print_throughput (const gchar *action, gsize len, gdouble elapsed)
+{
+	g_print ("%s %" G_GSIZE_FORMAT " bytes in %.2fs (%.0f bytes/s)\n",
+		 action, len, elapsed, elapsed > 0.f ? len / elapsed : 0.f);
+}
+
+static gboolean
+ch_util_flash_dump (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	gsize len;
+	guint64 address;
+	g_autofree guint8 *data = NULL;
+	g_autoptr(GTimer) timer = NULL;
+
+	/* parse */
+	if (g_strv_length (values) != 3) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'address (base-16)' "
+				     "'length (base-10)' 'filename'");
+		return FALSE;
+	}
+	address = g_ascii_strtoull (values[0], NULL, 16);
+	len = g_ascii_strtoull (values[1], NULL, 10);
+	if (!ch_util_check_flash_range (priv, address, len, error))
+		return FALSE;
+
+	/* read the whole range in one transaction */
+	timer = g_timer_new ();
+	data = g_new0 (guint8, len);
+	ch_util_queue_read_flash (priv, address, data, len);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+	ch_util_print_throughput ("Read", len, g_timer_elapsed (timer, NULL));
+	ch_util_result_add_double (priv, "rate", len / g_timer_elapsed (timer, NULL));
+
+	/* save raw data */
+	return g_file_set_contents (values[2], (const gchar *) data, len, error);
+}
+
+static gboolean
+ch_util_flash_restore (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	gsize i;
+	gsize len = 0;
+	gsize len_erase;
+	guint64 address;
+	g_autofree gchar *file_data = NULL;
+	g_autofree guint8 *data = NULL;
+	g_autofree guint8 *data_verify = NULL;
+	g_autoptr(GTimer) timer = NULL;
+
+	/* parse */
+	if (g_strv_length (values) != 2) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'address (base-16)' 'filename'");
+		return FALSE;
+	}
+	address = g_ascii_strtoull (values[0], NULL, 16);
+	if (!g_file_get_contents (values[1], &file_data, &len, error))
+		return FALSE;
+	if (!ch_util_check_flash_range (priv, address, len, error))
+		return FALSE;
+	if (address % CH_FLASH_ERASE_BLOCK_SIZE != 0) {
+		g_set_error (error, 1, 0,
+			     "address 0x%04x is not a multiple of 0x%04x",
+			     (guint) address, CH_FLASH_ERASE_BLOCK_SIZE);
+		return FALSE;
+	}
+
+	/* the rest of the last erase block has to be preserved */
+	timer = g_timer_new ();
+	len_erase = ((len + CH_FLASH_ERASE_BLOCK_SIZE - 1) /
+		     CH_FLASH_ERASE_BLOCK_SIZE) * CH_FLASH_ERASE_BLOCK_SIZE;
+	if (address + len_erase > G_MAXUINT16 + 1) {
+		g_set_error (error, 1, 0,
+			     "invalid length %" G_GSIZE_FORMAT,
+			     len);
+		return FALSE;
+	}
+	data = g_new0 (guint8, len_erase);
+	memcpy (data, file_data, len);
+	if (len_erase > len) {
+		ch_util_queue_read_flash (priv, address + len,
+					  data + len, len_erase - len);
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error))
+			return FALSE;
+	}
+
+	/* erase, write and read back in one transaction */
+	ch_device_queue_erase_flash (priv->device_queue,
+				     priv->device,
+				     address,
+				     len_erase);
+	for (i = 0; i < len_erase; i += CH_FLASH_TRANSFER_BLOCK_SIZE) {
+		ch_device_queue_write_flash (priv->device_queue,
+					     priv->device,
+					     address + i,
+					     data + i,
+					     CH_FLASH_TRANSFER_BLOCK_SIZE);
+	}
+	data_verify = g_new0 (guint8, len_erase);
+	ch_util_queue_read_flash (priv, address, data_verify, len_erase);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+
+	/* verify */
+	for (i = 0; i < len_erase; i++) {
+		if (data[i] != data_verify[i]) {
+			g_set_error (error, 1, 0,
+				     "failed to verify at 0x%04x, "
+				     "wrote 0x%02x and read 0x%02x",
+				     (guint) (address + i),
+				     data[i], data_verify[i]);
+			return FALSE;
+		}
+	}
+	ch_util_print_throughput ("Wrote", len_erase, g_timer_elapsed (timer, NULL));
+	ch_util_result_add_double (priv, "rate", len_erase / g_timer_elapsed (timer, NULL));
+	return TRUE;
 }
 
 static gboolean
@@ -2470,52 +5472,56 @@ ch_util_eeprom_read (ChUtilPrivate *priv, gchar **values, GError **error)
 				    address,
 				    data,
 				    len);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
+	ret = ch_util_queue_process (priv,
+				     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				     error);
 	if (!ret)
 		return FALSE;
 
 	g_print ("Read:\n");
 	for (i = 0; i < len; i++)
 		g_print ("0x%04x = %02x\n", address + i, data[i]);
+	ch_util_result_add_int (priv, "address", address);
+	ch_util_result_add_hex (priv, "data", data, len);
 	return TRUE;
 }
 
 static gboolean
-ch_util_get_measure_mode (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_measure_mode_print (ChUtilPrivate *priv, gpointer user_data, GError **error)
 {
-	gboolean ret;
-	ChMeasureMode measure_mode = CH_MEASURE_MODE_FREQUENCY;
-
-	/* get from HW */
-	ch_device_queue_get_measure_mode (priv->device_queue,
-					  priv->device,
-					  &measure_mode);
-	ret = ch_device_queue_process (priv->device_queue,
-				       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-				       NULL,
-				       error);
-	if (!ret)
-		return FALSE;
+	ChMeasureMode *measure_mode = (ChMeasureMode *) user_data;
 
-	switch (measure_mode) {
+	switch (*measure_mode) {
 	case CH_MEASURE_MODE_FREQUENCY:
 	case CH_MEASURE_MODE_DURATION:
-		g_print ("%s\n", ch_measure_mode_to_string (measure_mode));
+		g_print ("%s\n", ch_measure_mode_to_string (*measure_mode));
+		ch_util_result_add_string (priv, "measure_mode",
+					   ch_measure_mode_to_string (*measure_mode));
 		break;
 	default:
 		g_set_error (error, 1, 0,
 			     "invalid measure_mode value %i",
-			     measure_mode);
+			     *measure_mode);
 		return FALSE;
 	}
 	return TRUE;
 }
 
 static gboolean
-ch_util_set_measure_mode (ChUtilPrivate *priv, gchar **values, GError **error)
+ch_util_get_measure_mode (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
+{
+	ChMeasureMode *measure_mode = g_new0 (ChMeasureMode, 1);
+
+	/* get from HW */
+	ch_device_queue_get_measure_mode (priv->device_queue,
+					  priv->device,
+					  measure_mode);
+	ch_util_pending_set (pending, ch_util_get_measure_mode_print, measure_mode);
+	return TRUE;
+}
+
+static gboolean
+ch_util_set_measure_mode (ChUtilPrivate *priv, gchar **values, ChUtilPending *pending, GError **error)
 {
 	ChMeasureMode measure_mode;
 
@@ -2540,10 +5546,121 @@ ch_util_set_measure_mode (ChUtilPrivate *priv, gchar **values, GError **error)
 	ch_device_queue_set_measure_mode (priv->device_queue,
 					  priv->device,
 					  measure_mode);
-	return ch_device_queue_process (priv->device_queue,
-					CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					NULL,
-					error);
+	return TRUE;
+}
+
+static gboolean
+ch_util_check_sram_range (guint64 address, gsize len, GError **error)
+{
+	if (address > 0xffff) {
+		g_set_error (error, 1, 0,
+			     "invalid address 0x%04x",
+			     (guint) address);
+		return FALSE;
+	}
+	if (len < 1 || address + len > 0x10000) {
+		g_set_error (error, 1, 0,
+			     "invalid length %" G_GSIZE_FORMAT,
+			     len);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+ch_util_sram_dump (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	gdouble elapsed;
+	gsize len;
+	guint64 address;
+	g_autoptr(GBytes) buf = NULL;
+	g_autoptr(GTimer) timer = NULL;
+
+	/* parse */
+	if (g_strv_length (values) != 3) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'address (base-16)' "
+				     "'length (base-10)' 'filename'");
+		return FALSE;
+	}
+	address = g_ascii_strtoull (values[0], NULL, 16);
+	len = g_ascii_strtoull (values[1], NULL, 10);
+	if (!ch_util_check_sram_range (address, len, error))
+		return FALSE;
+
+	/* get data, where the queue splits up large requests itself */
+	timer = g_timer_new ();
+	if (ch_device_get_mode (priv->device) == CH_DEVICE_MODE_FIRMWARE_PLUS) {
+		buf = ch_device_read_sram (priv->device, address, len, NULL, error);
+		if (buf == NULL)
+			return FALSE;
+	} else {
+		guint8 *data = g_new0 (guint8, len);
+		buf = g_bytes_new_take (data, len);
+		ch_device_queue_read_sram (priv->device_queue,
+					   priv->device,
+					   (guint16) address,
+					   data,
+					   len);
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error))
+			return FALSE;
+	}
+	elapsed = g_timer_elapsed (timer, NULL);
+	ch_util_print_throughput ("Read", len, elapsed);
+	ch_util_result_add_double (priv, "rate", len / elapsed);
+
+	/* save raw data */
+	return g_file_set_contents (values[2],
+				    g_bytes_get_data (buf, NULL),
+				    g_bytes_get_size (buf),
+				    error);
+}
+
+static gboolean
+ch_util_sram_upload (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	gchar *data = NULL;
+	gdouble elapsed;
+	gsize len = 0;
+	guint64 address;
+	g_autoptr(GBytes) buf = NULL;
+	g_autoptr(GTimer) timer = NULL;
+
+	/* parse */
+	if (g_strv_length (values) != 2) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect 'address (base-16)' 'filename'");
+		return FALSE;
+	}
+	address = g_ascii_strtoull (values[0], NULL, 16);
+	if (!g_file_get_contents (values[1], &data, &len, error))
+		return FALSE;
+	buf = g_bytes_new_take (data, len);
+	if (!ch_util_check_sram_range (address, len, error))
+		return FALSE;
+
+	/* write to hardware */
+	timer = g_timer_new ();
+	if (ch_device_get_mode (priv->device) == CH_DEVICE_MODE_FIRMWARE_PLUS) {
+		if (!ch_device_write_sram (priv->device, address, buf, NULL, error))
+			return FALSE;
+	} else {
+		ch_device_queue_write_sram (priv->device_queue,
+					    priv->device,
+					    (guint16) address,
+					    (guint8 *) data,
+					    len);
+		if (!ch_util_queue_process (priv,
+					    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					    error))
+			return FALSE;
+	}
+	elapsed = g_timer_elapsed (timer, NULL);
+	ch_util_print_throughput ("Wrote", len, elapsed);
+	ch_util_result_add_double (priv, "rate", len / elapsed);
+	return TRUE;
 }
 
 static gboolean
@@ -2594,10 +5711,9 @@ ch_util_sram_write (ChUtilPrivate *priv, gchar **values, GError **error)
 					    (guint16) address,
 					    data,
 					    len);
-		ret = ch_device_queue_process (priv->device_queue,
-					       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					       NULL,
-					       error);
+		ret = ch_util_queue_process (priv,
+					     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					     error);
 		if (!ret)
 			return FALSE;
 	}
@@ -2653,10 +5769,9 @@ ch_util_sram_read (ChUtilPrivate *priv, gchar **values, GError **error)
 					   (guint16) address,
 					   data,
 					   len);
-		ret = ch_device_queue_process (priv->device_queue,
-					       CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
-					       NULL,
-					       error);
+		ret = ch_util_queue_process (priv,
+					     CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+					     error);
 		if (!ret)
 			return FALSE;
 		buf_ptr = data;
@@ -2665,6 +5780,8 @@ ch_util_sram_read (ChUtilPrivate *priv, gchar **values, GError **error)
 	g_print ("Read:\n");
 	for (i = 0; i < len; i++)
 		g_print ("0x%04x = %02x\n", address + i, buf_ptr[i]);
+	ch_util_result_add_int (priv, "address", address);
+	ch_util_result_add_hex (priv, "data", buf_ptr, len);
 	return TRUE;
 }
 
@@ -2680,28 +5797,849 @@ ch_util_sram_save (ChUtilPrivate *priv, gchar **values, GError **error)
 	return ch_device_save_sram (priv->device, NULL, error);
 }
 
+typedef enum {
+	CH_UTIL_BENCHMARK_HW_VERSION,
+	CH_UTIL_BENCHMARK_READING_RAW,
+	CH_UTIL_BENCHMARK_READ_SRAM
+} ChUtilBenchmarkKind;
+
+typedef struct {
+	const gchar		*name;
+	ChUtilBenchmarkKind	 kind;
+	guint			 len;
+} ChUtilBenchmark;
+
+static const ChUtilBenchmark ch_util_benchmarks[] = {
+	{ "get-hardware-version",	CH_UTIL_BENCHMARK_HW_VERSION,	0 },
+	{ "take-reading-raw",		CH_UTIL_BENCHMARK_READING_RAW,	0 },
+	{ "read-sram-64",		CH_UTIL_BENCHMARK_READ_SRAM,	64 },
+	{ "read-sram-1024",		CH_UTIL_BENCHMARK_READ_SRAM,	1024 },
+	{ "read-sram-4096",		CH_UTIL_BENCHMARK_READ_SRAM,	4096 },
+	{ NULL,				0,				0 }
+};
+
+#define CH_UTIL_BENCHMARK_HISTOGRAM_BUCKETS	10
+#define CH_UTIL_BENCHMARK_HISTOGRAM_WIDTH	40
+
+/* each request takes at least 1ms, so this is already over a quarter hour */
+#define CH_UTIL_BENCHMARK_ITERATIONS_MAX	1000000
+
+static gboolean
+ch_util_benchmark_run_once (ChUtilPrivate *priv,
+			    const ChUtilBenchmark *benchmark,
+			    guint8 *buf,
+			    GError **error)
+{
+	guint8 hw_version = 0;
+	guint32 pulses = 0;
+
+	switch (benchmark->kind) {
+	case CH_UTIL_BENCHMARK_HW_VERSION:
+		ch_device_queue_get_hardware_version (priv->device_queue,
+						      priv->device,
+						      &hw_version);
+		break;
+	case CH_UTIL_BENCHMARK_READING_RAW:
+		ch_device_queue_take_reading_raw (priv->device_queue,
+						  priv->device,
+						  &pulses);
+		break;
+	case CH_UTIL_BENCHMARK_READ_SRAM:
+		ch_device_queue_read_sram (priv->device_queue,
+					   priv->device,
+					   0x0000,
+					   buf,
+					   benchmark->len);
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+	return ch_util_queue_process (priv,
+				      CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				      error);
+}
+
+static void
+ch_util_benchmark_print_histogram (const gdouble *sorted, guint len)
+{
+	gdouble hi;
+	gdouble lo;
+	gdouble width;
+	guint counts[CH_UTIL_BENCHMARK_HISTOGRAM_BUCKETS];
+	guint count_max = 0;
+	guint i, j;
+
+	/* the last bucket collects the slowest 1% */
+	lo = sorted[0];
+	hi = ch_stats_percentile_sorted (sorted, len, 99.f);
+	width = (hi - lo) / (CH_UTIL_BENCHMARK_HISTOGRAM_BUCKETS - 1);
+	memset (counts, 0, sizeof (counts));
+	for (i = 0; i < len; i++) {
+		guint idx = CH_UTIL_BENCHMARK_HISTOGRAM_BUCKETS - 1;
+		if (width > 0.f && sorted[i] < hi)
+			idx = MIN ((sorted[i] - lo) / width, idx);
+		counts[idx]++;
+	}
+	for (i = 0; i < CH_UTIL_BENCHMARK_HISTOGRAM_BUCKETS; i++)
+		count_max = MAX (count_max, counts[i]);
+	for (i = 0; i < CH_UTIL_BENCHMARK_HISTOGRAM_BUCKETS; i++) {
+		guint bar = counts[i] * CH_UTIL_BENCHMARK_HISTOGRAM_WIDTH / count_max;
+		if (i == CH_UTIL_BENCHMARK_HISTOGRAM_BUCKETS - 1)
+			g_print ("  >=%8.3fms\t%6u\t", (lo + i * width) * 1000, counts[i]);
+		else
+			g_print ("  %10.3fms\t%6u\t", (lo + i * width) * 1000, counts[i]);
+		for (j = 0; j < bar; j++)
+			g_print ("*");
+		g_print ("\n");
+	}
+}
+
+static gboolean
+ch_util_benchmark_usb_run (ChUtilPrivate *priv, guint iterations, GError **error)
+{
+	guint i, j;
+	g_autofree gdouble *latency = NULL;
+	g_autofree guint8 *buf = NULL;
+	g_autoptr(GTimer) timer = NULL;
+
+	latency = g_new0 (gdouble, iterations);
+	buf = g_new0 (guint8, 0x1000);
+	timer = g_timer_new ();
+	for (i = 0; ch_util_benchmarks[i].name != NULL; i++) {
+		const ChUtilBenchmark *benchmark = &ch_util_benchmarks[i];
+		gdouble max;
+		gdouble p50;
+		gdouble p95;
+		gdouble p99;
+		gdouble total = 0.f;
+		g_autoptr(GError) error_local = NULL;
+		g_autoptr(GString) json = NULL;
+
+		/* not every device supports every request */
+		if (!ch_util_benchmark_run_once (priv, benchmark, buf, &error_local)) {
+			g_print ("%s:\tnot supported: %s\n",
+				 benchmark->name, error_local->message);
+			continue;
+		}
+		for (j = 0; j < iterations; j++) {
+			g_timer_reset (timer);
+			if (!ch_util_benchmark_run_once (priv, benchmark, buf, error))
+				return FALSE;
+			latency[j] = g_timer_elapsed (timer, NULL);
+			total += latency[j];
+		}
+
+		/* show the distribution, not just the average */
+		ch_stats_sort (latency, iterations);
+		p50 = ch_stats_percentile_sorted (latency, iterations, 50.f);
+		p95 = ch_stats_percentile_sorted (latency, iterations, 95.f);
+		p99 = ch_stats_percentile_sorted (latency, iterations, 99.f);
+		max = latency[iterations - 1];
+		g_print ("%s:\tp50 %.3fms\tp95 %.3fms\tp99 %.3fms\tmax %.3fms\t%.0f req/s",
+			 benchmark->name,
+			 p50 * 1000, p95 * 1000, p99 * 1000, max * 1000,
+			 iterations / total);
+		if (benchmark->len > 0)
+			g_print ("\t%.1f kB/s", benchmark->len * iterations / total / 1024);
+		g_print ("\n");
+		ch_util_benchmark_print_histogram (latency, iterations);
+
+		json = g_string_new ("{\"p50\":");
+		ch_util_json_append_double (json, p50);
+		g_string_append (json, ",\"p95\":");
+		ch_util_json_append_double (json, p95);
+		g_string_append (json, ",\"p99\":");
+		ch_util_json_append_double (json, p99);
+		g_string_append (json, ",\"max\":");
+		ch_util_json_append_double (json, max);
+		g_string_append (json, ",\"mean\":");
+		ch_util_json_append_double (json, total / iterations);
+		g_string_append (json, ",\"requests_per_second\":");
+		ch_util_json_append_double (json, iterations / total);
+		if (benchmark->len > 0) {
+			g_string_append (json, ",\"bytes_per_second\":");
+			ch_util_json_append_double (json, benchmark->len * iterations / total);
+		}
+		g_string_append_c (json, '}');
+		ch_util_result_add_raw (priv, benchmark->name, json->str);
+	}
+	return TRUE;
+}
+
+static gboolean
+ch_util_benchmark_usb (ChUtilPrivate *priv, gchar **values, GError **error)
+{
+	gboolean ret;
+	guint iterations = 1000;
+	guint16 integral_time = 0;
+	g_autoptr(GError) error_local = NULL;
+
+	/* parse */
+	if (g_strv_length (values) > 1) {
+		g_set_error_literal (error, 1, 0,
+				     "invalid input, expect ['iterations']");
+		return FALSE;
+	}
+	if (values[0] != NULL) {
+		gchar *endptr = NULL;
+		guint64 tmp = g_ascii_strtoull (values[0], &endptr, 10);
+		if (!g_ascii_isdigit (values[0][0]) || endptr[0] != '\0' ||
+		    tmp < 2 || tmp > CH_UTIL_BENCHMARK_ITERATIONS_MAX) {
+			g_set_error (error, 1, 0,
+				     "invalid iterations '%s', expected 2-%u",
+				     values[0], CH_UTIL_BENCHMARK_ITERATIONS_MAX);
+			return FALSE;
+		}
+		iterations = tmp;
+	}
+
+	/* no sensor to worry about */
+	if (ch_device_get_mode (priv->device) != CH_DEVICE_MODE_FIRMWARE)
+		return ch_util_benchmark_usb_run (priv, iterations, error);
+
+	/* measure the USB round trip, not the sensor */
+	ch_device_queue_get_integral_time (priv->device_queue,
+					   priv->device,
+					   &integral_time);
+	ch_device_queue_set_integral_time (priv->device_queue,
+					   priv->device,
+					   CH_AUTORANGE_INTEGRAL_TIME_MIN);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    error))
+		return FALSE;
+	ret = ch_util_benchmark_usb_run (priv, iterations, error);
+
+	/* put back what the user had, even if a request failed */
+	ch_device_queue_set_integral_time (priv->device_queue,
+					   priv->device,
+					   integral_time);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    &error_local)) {
+		if (!ret) {
+			g_warning ("failed to restore integral time: %s",
+				   error_local->message);
+			return FALSE;
+		}
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return FALSE;
+	}
+	return ret;
+}
+
+static gboolean
+ch_util_flush_pending (ChUtilPrivate *priv,
+		       GPtrArray *pending_array,
+		       guint lineno_first,
+		       guint lineno_last,
+		       GError **error)
+{
+	guint i;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GTimer) timer = NULL;
+
+	/* nothing queued */
+	if (pending_array->len == 0)
+		return TRUE;
+
+	/* process everything queued so far as one transaction */
+	timer = g_timer_new ();
+	ch_util_trace_submit_pending (priv, pending_array);
+	if (!ch_util_queue_process (priv,
+				    CH_DEVICE_QUEUE_PROCESS_FLAGS_NONE,
+				    &error_local)) {
+		for (i = 0; i < pending_array->len; i++) {
+			ChUtilPending *pending = g_ptr_array_index (pending_array, i);
+			ch_util_json_begin (priv);
+			ch_util_json_end (priv, pending->command, error_local);
+		}
+		g_set_error (error, 1, 0,
+			     "lines %u-%u: %s",
+			     lineno_first, lineno_last,
+			     error_local->message);
+		return FALSE;
+	}
+	if (!ch_util_print_pending (priv, pending_array, &error_local)) {
+		g_set_error (error, 1, 0,
+			     "lines %u-%u: %s",
+			     lineno_first, lineno_last,
+			     error_local->message);
+		return FALSE;
+	}
+	g_printerr ("%u-%u\t%u commands\t%.2fms\n",
+		    lineno_first, lineno_last, pending_array->len,
+		    g_timer_elapsed (timer, NULL) * 1000);
+	if (priv->trace != NULL) {
+		gdouble now = ch_util_trace_now (priv->trace);
+		g_autofree gchar *args = NULL;
+		args = g_strdup_printf ("{\"commands\":%u,\"first_line\":%u,\"last_line\":%u}",
+					pending_array->len, lineno_first, lineno_last);
+		ch_util_trace_add (priv->trace, "transaction", "pipeline", 0,
+				   now - g_timer_elapsed (timer, NULL), now, args);
+	}
+	g_ptr_array_set_size (pending_array, 0);
+	return TRUE;
+}
+
+static gboolean
+ch_util_run_batch (ChUtilPrivate *priv, GIOChannel *channel, GError **error)
+{
+	gdouble elapsed;
+	gdouble elapsed_total = 0.f;
+	guint cnt = 0;
+	guint lineno = 0;
+	guint lineno_pending = 0;
+	guint lineno_reset = 0;
+	g_autoptr(GPtrArray) pending_array = NULL;
+	g_autoptr(GTimer) timer = NULL;
+	g_autoptr(GTimer) timer_total = NULL;
+
+	/* run each line as if it was passed on the command line */
+	pending_array = g_ptr_array_new_with_free_func ((GDestroyNotify) ch_util_pending_free);
+	timer = g_timer_new ();
+	timer_total = g_timer_new ();
+	while (TRUE) {
+		const ChUtilItem *item;
+		ChUtilPending *pending;
+		GIOStatus status;
+		gint argc_tmp = 0;
+		g_auto(GStrv) argv_tmp = NULL;
+		g_autofree gchar *line = NULL;
+		g_autoptr(GError) error_local = NULL;
+
+		status = g_io_channel_read_line (channel, &line, NULL, NULL, error);
+		if (status == G_IO_STATUS_EOF)
+			break;
+		if (status != G_IO_STATUS_NORMAL)
+			return FALSE;
+		lineno++;
+
+		/* ignore blank lines and comments */
+		g_strstrip (line);
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+		if (!g_shell_parse_argv (line, &argc_tmp, &argv_tmp, &error_local)) {
+			g_set_error (error, 1, 0,
+				     "failed to parse line %u: %s",
+				     lineno, error_local->message);
+			return FALSE;
+		}
+		item = ch_util_find_item (priv, argv_tmp[0], &error_local);
+		if (item == NULL) {
+			g_set_error (error, 1, 0,
+				     "line %u: %s",
+				     lineno, error_local->message);
+			return FALSE;
+		}
+
+		/* the device is not there anymore */
+		if (lineno_reset > 0 &&
+		    (item->flags & CH_UTIL_ITEM_FLAG_NO_DEVICE) == 0) {
+			g_set_error (error, 1, 0,
+				     "line %u: the device was reset on line %u",
+				     lineno, lineno_reset);
+			return FALSE;
+		}
+
+		/* just add the requests to the queue, and process them
+		 * when something needs the results */
+		if (priv->pipeline && item->queue_cb != NULL) {
+			pending = g_new0 (ChUtilPending, 1);
+			pending->command = g_strdup (argv_tmp[0]);
+			if (priv->trace != NULL)
+				pending->queued = ch_util_trace_now (priv->trace);
+			g_ptr_array_add (pending_array, pending);
+			if (!item->queue_cb (priv, &argv_tmp[1], pending, &error_local)) {
+				g_set_error (error, 1, 0,
+					     "line %u: %s",
+					     lineno, error_local->message);
+				return FALSE;
+			}
+			if (pending_array->len == 1)
+				lineno_pending = lineno;
+			cnt++;
+			continue;
+		}
+
+		/* anything already queued has to go out first */
+		if (!ch_util_flush_pending (priv, pending_array,
+					    lineno_pending, lineno - 1,
+					    error))
+			return FALSE;
+
+		/* run the command, stopping on the first failure */
+		g_timer_reset (timer);
+		if (!ch_util_run_item (priv, item, &argv_tmp[1], &error_local)) {
+			g_set_error (error, 1, 0,
+				     "line %u: %s",
+				     lineno, error_local->message);
+			return FALSE;
+		}
+		elapsed = g_timer_elapsed (timer, NULL);
+		elapsed_total += elapsed;
+		cnt++;
+		if (item->flags & CH_UTIL_ITEM_FLAG_RESETS)
+			lineno_reset = lineno;
+
+		/* report on stderr so the output can still be parsed */
+		g_printerr ("%u\t%s\t%.2fms\n", lineno, argv_tmp[0], elapsed * 1000);
+	}
+
+	/* process anything left over */
+	if (!ch_util_flush_pending (priv, pending_array,
+				    lineno_pending, lineno,
+				    error))
+		return FALSE;
+
+	/* print the summary */
+	if (cnt > 0) {
+		if (priv->pipeline)
+			elapsed_total = g_timer_elapsed (timer_total, NULL);
+		g_printerr ("Ran %u commands in %.2fms (%.2fms per command)\n",
+			    cnt, elapsed_total * 1000,
+			    (elapsed_total * 1000) / cnt);
+	}
+	return TRUE;
+}
+
+static gboolean
+ch_util_open_device (ChUtilPrivate *priv,
+		     const gchar *device_str,
+		     const gchar *serial_str,
+		     gboolean all_devices,
+		     GError **error)
+{
+	priv->usb_ctx = g_usb_context_new (error);
+	if (priv->usb_ctx == NULL) {
+		/* TRANSLATORS: no colord available */
+		g_prefix_error (error, "%s ", _("No connection to device:"));
+		return FALSE;
+	}
+	if (serial_str != NULL) {
+		guint64 serial_number;
+		gchar *endptr = NULL;
+		if (device_str != NULL) {
+			g_set_error_literal (error, 1, 0,
+					     "--serial cannot be used with --device");
+			return FALSE;
+		}
+		serial_number = g_ascii_strtoull (serial_str, &endptr, 10);
+		if (serial_str[0] == '\0' || endptr[0] != '\0' ||
+		    serial_number > G_MAXUINT32) {
+			g_set_error (error, 1, 0,
+				     "Invalid serial number %s", serial_str);
+			return FALSE;
+		}
+		priv->device = ch_util_get_device_by_serial_number (priv->usb_ctx,
+								    serial_number,
+								    error);
+		if (priv->device == NULL) {
+			/* TRANSLATORS: no colord available */
+			g_prefix_error (error, "%s ", _("No connection to device:"));
+			return FALSE;
+		}
+	} else if (ch_util_device_str_is_list (device_str)) {
+		priv->devices = ch_util_get_devices (priv->usb_ctx, device_str, error);
+		if (priv->devices == NULL) {
+			/* TRANSLATORS: no colord available */
+			g_prefix_error (error, "%s ", _("No connection to device:"));
+			return FALSE;
+		}
+		priv->device = g_object_ref (g_ptr_array_index (priv->devices, 0));
+		if (priv->devices->len == 1)
+			g_clear_pointer (&priv->devices, g_ptr_array_unref);
+	} else if (device_str != NULL || !all_devices) {
+		gint device_idx = -1;
+		if (device_str != NULL) {
+			gchar *endptr = NULL;
+			gint64 tmp = g_ascii_strtoll (device_str, &endptr, 10);
+			if (device_str[0] == '\0' || endptr[0] != '\0' ||
+			    tmp < 0 || tmp > G_MAXINT) {
+				g_set_error (error, 1, 0,
+					     "Invalid device %s", device_str);
+				return FALSE;
+			}
+			device_idx = tmp;
+		}
+		priv->device = ch_util_get_default_device (priv->usb_ctx, device_idx, error);
+		if (priv->device == NULL) {
+			/* TRANSLATORS: no colord available */
+			g_prefix_error (error, "%s ", _("No connection to device:"));
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 static void
 ch_util_ignore_cb (const gchar *log_domain, GLogLevelFlags log_level,
 		   const gchar *message, gpointer user_data)
 {
 }
 
+/* keep sorted by name, as this is searched using bsearch() */
+static const ChUtilItem ch_util_items[] = {
+	{ "benchmark-usb",
+	  /* TRANSLATORS: command description */
+	  N_("Measures the latency and throughput of device requests"),
+	  ch_util_benchmark_usb, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "boot-flash",
+	  /* TRANSLATORS: command description */
+	  N_("Boots from the bootloader into the firmware"),
+	  ch_util_boot_flash, NULL, CH_UTIL_ITEM_FLAG_RESETS },
+	{ "calibration-export",
+	  /* TRANSLATORS: command description */
+	  N_("Saves all the calibration matrices to a file"),
+	  ch_util_calibration_export, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "calibration-import",
+	  /* TRANSLATORS: command description */
+	  N_("Writes the calibration matrices from a file, keeping other slots"),
+	  ch_util_calibration_import, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "ccmx-upload",
+	  /* TRANSLATORS: command description */
+	  N_("Uploads a correction matrix"),
+	  ch_util_ccmx_upload, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "clear-calibration",
+	  /* TRANSLATORS: command description */
+	  N_("Clear the sensor calibration matrix"),
+	  NULL, ch_util_clear_calibration, CH_UTIL_ITEM_FLAG_NONE },
+	{ "eeprom-erase",
+	  /* TRANSLATORS: command description */
+	  N_("Erase EEPROM at a specified address"),
+	  ch_util_eeprom_erase, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "eeprom-read",
+	  /* TRANSLATORS: command description */
+	  N_("Read EEPROM at a specified address"),
+	  ch_util_eeprom_read, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "eeprom-write",
+	  /* TRANSLATORS: command description */
+	  N_("Write EEPROM at a specified address"),
+	  ch_util_eeprom_write, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "flash-dump",
+	  /* TRANSLATORS: command description */
+	  N_("Saves a range of the flash to a file"),
+	  ch_util_flash_dump, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "flash-firmware",
+	  /* TRANSLATORS: command description */
+	  N_("Flash firmware into the processor"),
+	  ch_util_flash_firmware, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "flash-firmware-all",
+	  /* TRANSLATORS: command description */
+	  N_("Flash firmware into all attached devices at once"),
+	  ch_util_flash_firmware_all, NULL, CH_UTIL_ITEM_FLAG_ALL_DEVICES },
+	{ "flash-firmware-diff",
+	  /* TRANSLATORS: command description */
+	  N_("Flash only the parts of the firmware that have changed"),
+	  ch_util_flash_firmware_diff_cmd, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "flash-firmware-force",
+	  /* TRANSLATORS: command description */
+	  N_("Flash firmware into the processor"),
+	  ch_util_flash_firmware_force, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "flash-restore",
+	  /* TRANSLATORS: command description */
+	  N_("Writes a file to the flash and verifies it"),
+	  ch_util_flash_restore, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-adc-vrefs",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the ADC Vref values"),
+	  NULL, ch_util_get_adc_vrefs, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-calibration",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor calibration matrix"),
+	  NULL, ch_util_get_calibration, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-calibration-map",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor calibration map"),
+	  NULL, ch_util_get_calibration_map, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-ccd-calibration",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the CCD calibration values"),
+	  ch_util_get_ccd_calibration, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-color-select",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor color filter"),
+	  NULL, ch_util_get_color_select, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-dac-value",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the DAC value"),
+	  NULL, ch_util_get_dac_value, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-dark-offsets",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the dark offset values"),
+	  NULL, ch_util_get_dark_offsets, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-firmware-version",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor firmware version"),
+	  NULL, ch_util_get_firmware_ver, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-hardware-version",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the hardware version"),
+	  NULL, ch_util_get_hardware_version, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-illuminants",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the illuminant values"),
+	  ch_util_get_illuminants, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-integral-time",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor sample read time"),
+	  ch_util_get_integral_time, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-leds",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the LED values"),
+	  ch_util_get_leds, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-measure-mode",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor measurement mode"),
+	  NULL, ch_util_get_measure_mode, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-multiplier",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor multiplier"),
+	  NULL, ch_util_get_multiplier, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-owner-email",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the owner's email address"),
+	  NULL, ch_util_get_owner_email, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-owner-name",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the owner's name"),
+	  NULL, ch_util_get_owner_name, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-pcb-errata",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the PCB errata"),
+	  ch_util_get_pcb_errata, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-post-scale",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the post scale constant"),
+	  NULL, ch_util_get_post_scale, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-pre-scale",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the pre scale constant"),
+	  NULL, ch_util_get_pre_scale, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-remote-hash",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the remote profile SHA1 hash"),
+	  NULL, ch_util_get_remote_hash, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-serial-number",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor serial number"),
+	  ch_util_get_serial_number, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "get-temperature",
+	  /* TRANSLATORS: command description */
+	  N_("Gets the sensor temperature"),
+	  ch_util_get_temperature, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "inhx32-to-bin",
+	  /* TRANSLATORS: command description */
+	  N_("Converts Intel HEX to BIN, where ColorHugALS firmware needs "
+	     "the runcode address or --device"),
+	  ch_util_inhx32_to_bin, NULL, CH_UTIL_ITEM_FLAG_NO_DEVICE },
+	{ "list-calibration",
+	  /* TRANSLATORS: command description */
+	  N_("List the sensor calibration matrices"),
+	  ch_util_list_calibration, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "remote-profile-download",
+	  /* TRANSLATORS: command description */
+	  N_("Downloads a remote profile"),
+	  ch_util_remote_profile_download, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "remote-profile-upload",
+	  /* TRANSLATORS: command description */
+	  N_("Uploads a remote profile"),
+	  ch_util_remote_profile_upload, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "reset",
+	  /* TRANSLATORS: command description */
+	  N_("Reset the processor back to the bootloader"),
+	  ch_util_reset, NULL, CH_UTIL_ITEM_FLAG_RESETS },
+	{ "self-test",
+	  /* TRANSLATORS: command description */
+	  N_("Does a quick self test on the device"),
+	  ch_util_self_test, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-calibration",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor calibration matrix"),
+	  NULL, ch_util_set_calibration, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-calibration-ccmx",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor calibration matrix from a CCMX file"),
+	  NULL, ch_util_set_calibration_ccmx, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-calibration-map",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor calibration map"),
+	  NULL, ch_util_set_calibration_map, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-ccd-calibration",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the CCD calibration values"),
+	  ch_util_set_ccd_calibration, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-color-select",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor color filter"),
+	  NULL, ch_util_set_color_select, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-crypto-key",
+	  /* TRANSLATORS: command description */
+	  N_("Sets a secret key on the device"),
+	  ch_util_set_crypto_key, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-dac-value",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the DAC value"),
+	  NULL, ch_util_set_dac_value, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-dark-offsets",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the dark offset values"),
+	  ch_util_set_dark_offsets, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-flash-success",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the flash success"),
+	  NULL, ch_util_set_flash_success, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-illuminants",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the illuminants"),
+	  ch_util_set_illuminants, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-integral-time",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor sample read time"),
+	  ch_util_set_integral_time, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-leds",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the LEDs"),
+	  ch_util_set_leds, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-measure-mode",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor measurement mode"),
+	  NULL, ch_util_set_measure_mode, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-multiplier",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor multiplier"),
+	  NULL, ch_util_set_multiplier, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-owner-email",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the owner's email address"),
+	  NULL, ch_util_set_owner_email, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-owner-name",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the owner's name"),
+	  NULL, ch_util_set_owner_name, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-pcb-errata",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the PCB errata"),
+	  ch_util_set_pcb_errata, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-post-scale",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the post scale constant"),
+	  NULL, ch_util_set_post_scale, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-pre-scale",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the pre scale constant"),
+	  NULL, ch_util_set_pre_scale, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-remote-hash",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the remote profile SHA1 hash"),
+	  NULL, ch_util_set_remote_hash, CH_UTIL_ITEM_FLAG_NONE },
+	{ "set-serial-number",
+	  /* TRANSLATORS: command description */
+	  N_("Sets the sensor serial number"),
+	  ch_util_set_serial_number, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "sram-dump",
+	  /* TRANSLATORS: command description */
+	  N_("Saves a range of the SRAM to a file"),
+	  ch_util_sram_dump, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "sram-load",
+	  /* TRANSLATORS: command description */
+	  N_("Loads the SRAM from the EEPROM"),
+	  ch_util_sram_load, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "sram-read",
+	  /* TRANSLATORS: command description */
+	  N_("Read SRAM at a specified address"),
+	  ch_util_sram_read, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "sram-save",
+	  /* TRANSLATORS: command description */
+	  N_("Save the SRAM to the EEPROM"),
+	  ch_util_sram_save, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "sram-upload",
+	  /* TRANSLATORS: command description */
+	  N_("Writes a file to the SRAM"),
+	  ch_util_sram_upload, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "sram-write",
+	  /* TRANSLATORS: command description */
+	  N_("Write SRAM at a specified address"),
+	  ch_util_sram_write, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-reading-array",
+	  /* TRANSLATORS: command description */
+	  N_("Gets an array of raw samples"),
+	  ch_util_take_reading_array, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-reading-raw",
+	  /* TRANSLATORS: command description */
+	  N_("Takes a reading"),
+	  ch_util_take_reading_raw, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-reading-spectral",
+	  /* TRANSLATORS: command description */
+	  N_("Takes a spectral reading (saving to SRAM)"),
+	  ch_util_take_reading_spectral, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-readings",
+	  /* TRANSLATORS: command description */
+	  N_("Takes all color readings (to device RGB)"),
+	  ch_util_take_readings, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-readings-stream",
+	  /* TRANSLATORS: command description */
+	  N_("Takes XYZ readings at a fixed rate until interrupted"),
+	  ch_util_take_readings_stream, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-readings-xyz",
+	  /* TRANSLATORS: command description */
+	  N_("Takes all color readings (to XYZ)"),
+	  ch_util_take_readings_xyz, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-readings-xyz-auto",
+	  /* TRANSLATORS: command description */
+	  N_("Takes XYZ readings using the shortest usable sample time"),
+	  ch_util_take_readings_xyz_auto, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "take-readings-xyz-average",
+	  /* TRANSLATORS: command description */
+	  N_("Takes XYZ readings until the average is accurate enough"),
+	  ch_util_take_readings_xyz_average, NULL, CH_UTIL_ITEM_FLAG_NONE },
+	{ "write-eeprom",
+	  /* TRANSLATORS: command description */
+	  N_("Writes the EEPROM with updated values"),
+	  NULL, ch_util_write_eeprom, CH_UTIL_ITEM_FLAG_NONE },
+};
+
 int
 main (int argc, char *argv[])
 {
 	ChUtilPrivate *priv;
+	gboolean batch = FALSE;
+	gboolean json = FALSE;
+	gboolean pipeline = FALSE;
+	gboolean ret;
 	gboolean verbose = FALSE;
-	gint device_idx = -1;
+	g_autofree gchar *device_str = NULL;
+	g_autofree gchar *serial_str = NULL;
+	g_autofree gchar *trace_fn = NULL;
+	ChUtilItemFlags item_flags = CH_UTIL_ITEM_FLAG_NONE;
 	guint retval = 1;
 	g_autoptr(GError) error = NULL;
+	g_autoptr(GTimer) timer = NULL;
 	g_autofree gchar *cmd_descriptions = NULL;
 	const GOptionEntry options[] = {
 		{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
 			/* TRANSLATORS: command line option */
 			_("Show extra debugging information"), NULL },
-		{ "device", 'd', 0, G_OPTION_ARG_INT, &device_idx,
+		{ "device", 'd', 0, G_OPTION_ARG_STRING, &device_str,
+			/* TRANSLATORS: command line option */
+			_("Use this device index when multiple are available, "
+			  "or 'all' or a comma separated list of N, index:N "
+			  "or serial:N"), NULL },
+		{ "serial", 's', 0, G_OPTION_ARG_STRING, &serial_str,
+			/* TRANSLATORS: command line option */
+			_("Use the device with this serial number"), NULL },
+		{ "batch", 'b', 0, G_OPTION_ARG_NONE, &batch,
+			/* TRANSLATORS: command line option */
+			_("Run commands read from standard input"), NULL },
+		{ "pipeline", 'p', 0, G_OPTION_ARG_NONE, &pipeline,
 			/* TRANSLATORS: command line option */
-			_("Use this device when multiple are available"), NULL },
+			_("Send consecutive batch commands to the device together"), NULL },
+		{ "json", 'j', 0, G_OPTION_ARG_NONE, &json,
+			/* TRANSLATORS: command line option */
+			_("Print the result of each command as a JSON object"), NULL },
+		{ "trace", '\0', 0, G_OPTION_ARG_FILENAME, &trace_fn,
+			/* TRANSLATORS: command line option */
+			_("Save the timing of each device request as a Chrome trace"), NULL },
 		{ NULL}
 	};
 
@@ -2716,354 +6654,19 @@ main (int argc, char *argv[])
 #endif
 
 	/* create helper object */
+	timer = g_timer_new ();
 	priv = g_new0 (ChUtilPrivate, 1);
 
 	/* add commands */
-	priv->cmd_array = g_ptr_array_new_with_free_func ((GDestroyNotify) ch_util_item_free);
-	ch_util_add (priv->cmd_array,
-		     "get-color-select",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor color filter"),
-		     ch_util_get_color_select);
-	ch_util_add (priv->cmd_array,
-		     "set-color-select",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor color filter"),
-		     ch_util_set_color_select);
-	ch_util_add (priv->cmd_array,
-		     "get-multiplier",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor multiplier"),
-		     ch_util_get_multiplier);
-	ch_util_add (priv->cmd_array,
-		     "set-multiplier",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor multiplier"),
-		     ch_util_set_multiplier);
-	ch_util_add (priv->cmd_array,
-		     "get-integral-time",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor sample read time"),
-		     ch_util_get_integral_time);
-	ch_util_add (priv->cmd_array,
-		     "set-integral-time",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor sample read time"),
-		     ch_util_set_integral_time);
-	ch_util_add (priv->cmd_array,
-		     "get-firmware-version",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor firmware version"),
-		     ch_util_get_firmware_ver);
-	ch_util_add (priv->cmd_array,
-		     "get-calibration",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor calibration matrix"),
-		     ch_util_get_calibration);
-	ch_util_add (priv->cmd_array,
-		     "set-calibration",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor calibration matrix"),
-		     ch_util_set_calibration);
-	ch_util_add (priv->cmd_array,
-		     "clear-calibration",
-		     /* TRANSLATORS: command description */
-		     _("Clear the sensor calibration matrix"),
-		     ch_util_clear_calibration);
-	ch_util_add (priv->cmd_array,
-		     "list-calibration",
-		     /* TRANSLATORS: command description */
-		     _("List the sensor calibration matrices"),
-		     ch_util_list_calibration);
-	ch_util_add (priv->cmd_array,
-		     "set-calibration-ccmx",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor calibration matrix from a CCMX file"),
-		     ch_util_set_calibration_ccmx);
-	ch_util_add (priv->cmd_array,
-		     "get-serial-number",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor serial number"),
-		     ch_util_get_serial_number);
-	ch_util_add (priv->cmd_array,
-		     "set-serial-number",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor serial number"),
-		     ch_util_set_serial_number);
-	ch_util_add (priv->cmd_array,
-		     "get-owner-name",
-		     /* TRANSLATORS: command description */
-		     _("Gets the owner's name"),
-		     ch_util_get_owner_name);
-	ch_util_add (priv->cmd_array,
-		     "set-owner-name",
-		     /* TRANSLATORS: command description */
-		     _("Sets the owner's name"),
-		     ch_util_set_owner_name);
-	ch_util_add (priv->cmd_array,
-		     "get-owner-email",
-		     /* TRANSLATORS: command description */
-		     _("Gets the owner's email address"),
-		     ch_util_get_owner_email);
-	ch_util_add (priv->cmd_array,
-		     "set-owner-email",
-		     /* TRANSLATORS: command description */
-		     _("Sets the owner's email address"),
-		     ch_util_set_owner_email);
-	ch_util_add (priv->cmd_array,
-		     "get-leds",
-		     /* TRANSLATORS: command description */
-		     _("Gets the LED values"),
-		     ch_util_get_leds);
-	ch_util_add (priv->cmd_array,
-		     "set-leds",
-		     /* TRANSLATORS: command description */
-		     _("Sets the LEDs"),
-		     ch_util_set_leds);
-	ch_util_add (priv->cmd_array,
-		     "get-illuminants",
-		     /* TRANSLATORS: command description */
-		     _("Gets the illuminant values"),
-		     ch_util_get_illuminants);
-	ch_util_add (priv->cmd_array,
-		     "set-illuminants",
-		     /* TRANSLATORS: command description */
-		     _("Sets the illuminants"),
-		     ch_util_set_illuminants);
-	ch_util_add (priv->cmd_array,
-		     "get-pcb-errata",
-		     /* TRANSLATORS: command description */
-		     _("Gets the PCB errata"),
-		     ch_util_get_pcb_errata);
-	ch_util_add (priv->cmd_array,
-		     "set-pcb-errata",
-		     /* TRANSLATORS: command description */
-		     _("Sets the PCB errata"),
-		     ch_util_set_pcb_errata);
-	ch_util_add (priv->cmd_array,
-		     "get-remote-hash",
-		     /* TRANSLATORS: command description */
-		     _("Gets the remote profile SHA1 hash"),
-		     ch_util_get_remote_hash);
-	ch_util_add (priv->cmd_array,
-		     "set-remote-hash",
-		     /* TRANSLATORS: command description */
-		     _("Sets the remote profile SHA1 hash"),
-		     ch_util_set_remote_hash);
-	ch_util_add (priv->cmd_array,
-		     "get-dark-offsets",
-		     /* TRANSLATORS: command description */
-		     _("Gets the dark offset values"),
-		     ch_util_get_dark_offsets);
-	ch_util_add (priv->cmd_array,
-		     "set-dark-offsets",
-		     /* TRANSLATORS: command description */
-		     _("Sets the dark offset values"),
-		     ch_util_set_dark_offsets);
-	ch_util_add (priv->cmd_array,
-		     "write-eeprom",
-		     /* TRANSLATORS: command description */
-		     _("Writes the EEPROM with updated values"),
-		     ch_util_write_eeprom);
-	ch_util_add (priv->cmd_array,
-		     "take-reading-raw",
-		     /* TRANSLATORS: command description */
-		     _("Takes a reading"),
-		     ch_util_take_reading_raw);
-	ch_util_add (priv->cmd_array,
-		     "take-readings",
-		     /* TRANSLATORS: command description */
-		     _("Takes all color readings (to device RGB)"),
-		     ch_util_take_readings);
-	ch_util_add (priv->cmd_array,
-		     "take-readings-xyz",
-		     /* TRANSLATORS: command description */
-		     _("Takes all color readings (to XYZ)"),
-		     ch_util_take_readings_xyz);
-	ch_util_add (priv->cmd_array,
-		     "take-reading-spectral",
-		     /* TRANSLATORS: command description */
-		     _("Takes a spectral reading (saving to SRAM)"),
-		     ch_util_take_reading_spectral);
-	ch_util_add (priv->cmd_array,
-		     "reset",
-		     /* TRANSLATORS: command description */
-		     _("Reset the processor back to the bootloader"),
-		     ch_util_reset);
-	ch_util_add (priv->cmd_array,
-		     "flash-firmware",
-		     /* TRANSLATORS: command description */
-		     _("Flash firmware into the processor"),
-		     ch_util_flash_firmware);
-	ch_util_add (priv->cmd_array,
-		     "flash-firmware-force",
-		     /* TRANSLATORS: command description */
-		     _("Flash firmware into the processor"),
-		     ch_util_flash_firmware_force);
-	ch_util_add (priv->cmd_array,
-		     "eeprom-read",
-		     /* TRANSLATORS: command description */
-		     _("Read EEPROM at a specified address"),
-		     ch_util_eeprom_read);
-	ch_util_add (priv->cmd_array,
-		     "eeprom-erase",
-		     /* TRANSLATORS: command description */
-		     _("Erase EEPROM at a specified address"),
-		     ch_util_eeprom_erase);
-	ch_util_add (priv->cmd_array,
-		     "eeprom-write",
-		     /* TRANSLATORS: command description */
-		     _("Write EEPROM at a specified address"),
-		     ch_util_eeprom_write);
-	ch_util_add (priv->cmd_array,
-		     "get-pre-scale",
-		     /* TRANSLATORS: command description */
-		     _("Gets the pre scale constant"),
-		     ch_util_get_pre_scale);
-	ch_util_add (priv->cmd_array,
-		     "set-pre-scale",
-		     /* TRANSLATORS: command description */
-		     _("Sets the pre scale constant"),
-		     ch_util_set_pre_scale);
-	ch_util_add (priv->cmd_array,
-		     "get-dac-value",
-		     /* TRANSLATORS: command description */
-		     _("Gets the DAC value"),
-		     ch_util_get_dac_value);
-	ch_util_add (priv->cmd_array,
-		     "set-dac-value",
-		     /* TRANSLATORS: command description */
-		     _("Sets the DAC value"),
-		     ch_util_set_dac_value);
-	ch_util_add (priv->cmd_array,
-		     "get-post-scale",
-		     /* TRANSLATORS: command description */
-		     _("Gets the post scale constant"),
-		     ch_util_get_post_scale);
-	ch_util_add (priv->cmd_array,
-		     "set-post-scale",
-		     /* TRANSLATORS: command description */
-		     _("Sets the post scale constant"),
-		     ch_util_set_post_scale);
-	ch_util_add (priv->cmd_array,
-		     "set-flash-success",
-		     /* TRANSLATORS: command description */
-		     _("Sets the flash success"),
-		     ch_util_set_flash_success);
-	ch_util_add (priv->cmd_array,
-		     "boot-flash",
-		     /* TRANSLATORS: command description */
-		     _("Boots from the bootloader into the firmware"),
-		     ch_util_boot_flash);
-	ch_util_add (priv->cmd_array,
-		     "get-calibration-map",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor calibration map"),
-		     ch_util_get_calibration_map);
-	ch_util_add (priv->cmd_array,
-		     "set-calibration-map",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor calibration map"),
-		     ch_util_set_calibration_map);
-	ch_util_add (priv->cmd_array,
-		     "get-hardware-version",
-		     /* TRANSLATORS: command description */
-		     _("Gets the hardware version"),
-		     ch_util_get_hardware_version);
-	ch_util_add (priv->cmd_array,
-		     "take-reading-array",
-		     /* TRANSLATORS: command description */
-		     _("Gets an array of raw samples"),
-		     ch_util_take_reading_array);
-	ch_util_add (priv->cmd_array,
-		     "remote-profile-download",
-		     /* TRANSLATORS: command description */
-		     _("Downloads a remote profile"),
-		     ch_util_remote_profile_download);
-	ch_util_add (priv->cmd_array,
-		     "remote-profile-upload",
-		     /* TRANSLATORS: command description */
-		     _("Uploads a remote profile"),
-		     ch_util_remote_profile_upload);
-	ch_util_add (priv->cmd_array,
-		     "ccmx-upload",
-		     /* TRANSLATORS: command description */
-		     _("Uploads a correction matrix"),
-		     ch_util_ccmx_upload);
-	ch_util_add (priv->cmd_array,
-		     "self-test",
-		     /* TRANSLATORS: command description */
-		     _("Does a quick self test on the device"),
-		     ch_util_self_test);
-	ch_util_add (priv->cmd_array,
-		     "get-measure-mode",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor measurement mode"),
-		     ch_util_get_measure_mode);
-	ch_util_add (priv->cmd_array,
-		     "set-measure-mode",
-		     /* TRANSLATORS: command description */
-		     _("Sets the sensor measurement mode"),
-		     ch_util_set_measure_mode);
-	ch_util_add (priv->cmd_array,
-		     "sram-read",
-		     /* TRANSLATORS: command description */
-		     _("Read SRAM at a specified address"),
-		     ch_util_sram_read);
-	ch_util_add (priv->cmd_array,
-		     "sram-write",
-		     /* TRANSLATORS: command description */
-		     _("Write SRAM at a specified address"),
-		     ch_util_sram_write);
-	ch_util_add (priv->cmd_array,
-		     "sram-load",
-		     /* TRANSLATORS: command description */
-		     _("Loads the SRAM from the EEPROM"),
-		     ch_util_sram_load);
-	ch_util_add (priv->cmd_array,
-		     "sram-save",
-		     /* TRANSLATORS: command description */
-		     _("Save the SRAM to the EEPROM"),
-		     ch_util_sram_save);
-	ch_util_add (priv->cmd_array,
-		     "get-temperature",
-		     /* TRANSLATORS: command description */
-		     _("Gets the sensor temperature"),
-		     ch_util_get_temperature);
-	ch_util_add (priv->cmd_array,
-		     "get-adc-vrefs",
-		     /* TRANSLATORS: command description */
-		     _("Gets the ADC Vref values"),
-		     ch_util_get_adc_vrefs);
-	ch_util_add (priv->cmd_array,
-		     "get-ccd-calibration",
-		     /* TRANSLATORS: command description */
-		     _("Gets the CCD calibration values"),
-		     ch_util_get_ccd_calibration);
-	ch_util_add (priv->cmd_array,
-		     "set-ccd-calibration",
-		     /* TRANSLATORS: command description */
-		     _("Sets the CCD calibration values"),
-		     ch_util_set_ccd_calibration);
-	ch_util_add (priv->cmd_array,
-		     "inhx32-to-bin",
-		     /* TRANSLATORS: command description */
-		     _("Converts Intel HEX to BIN"),
-		     ch_util_inhx32_to_bin);
-	ch_util_add (priv->cmd_array,
-		     "set-crypto-key",
-		     /* TRANSLATORS: command description */
-		     _("Sets a secret key on the device"),
-		     ch_util_set_crypto_key);
-
-	/* sort by command name */
-	g_ptr_array_sort (priv->cmd_array,
-			  (GCompareFunc) cd_sort_command_name_cb);
+	priv->cmd_items = ch_util_items;
+	priv->cmd_items_len = G_N_ELEMENTS (ch_util_items);
 
 	/* get a list of the commands */
 	priv->context = g_option_context_new (NULL);
-	cmd_descriptions = ch_util_get_descriptions (priv->cmd_array);
-	g_option_context_set_summary (priv->context, cmd_descriptions);
+	if (ch_util_wants_help (argc, argv)) {
+		cmd_descriptions = ch_util_get_descriptions (priv);
+		g_option_context_set_summary (priv->context, cmd_descriptions);
+	}
 
 	/* TRANSLATORS: program name */
 	g_set_application_name (_("Color Management"));
@@ -3081,32 +6684,70 @@ main (int argc, char *argv[])
 				   ch_util_ignore_cb, NULL);
 	}
 
+	/* pipelining only makes sense for a script */
+	priv->json = json;
+	priv->pipeline = pipeline;
+	if (pipeline)
+		batch = TRUE;
+
 	/* get connection to colord */
 	priv->device_queue = ch_device_queue_new ();
-	priv->device = ch_util_get_default_device (device_idx, &error);
-	if (priv->device == NULL) {
-		/* TRANSLATORS: no colord available */
-		g_print ("%s %s\n", _("No connection to device:"), error->message);
-		goto out;
+	if (trace_fn != NULL) {
+		priv->trace = ch_util_trace_new ();
+		priv->trace_span = ch_util_trace_span_new (priv->trace, 0);
+		g_signal_connect (priv->device_queue, "progress-changed",
+				  G_CALLBACK (ch_util_trace_progress_cb),
+				  priv->trace_span);
 	}
 
-	/* setup the session */
-	priv->session = soup_session_new_with_options (SOUP_SESSION_USER_AGENT, "colorhug",
-							    SOUP_SESSION_TIMEOUT, 5000,
-							    NULL);
-	if (priv->session == NULL) {
-		/* TRANSLATORS: internal error when setting up HTTP */
-		g_print ("%s\n", _("Failed to setup networking"));
+	/* some commands find every attached device themselves, and some
+	 * do not need one at all */
+	if (!batch && argc > 1) {
+		const ChUtilItem *item = ch_util_find_item (priv, argv[1], NULL);
+		if (item != NULL)
+			item_flags = item->flags;
+	}
+	if ((item_flags & CH_UTIL_ITEM_FLAG_NO_DEVICE) > 0 &&
+	    device_str == NULL && serial_str == NULL) {
+		g_debug ("not opening a device for %s", argv[1]);
+	} else if (!ch_util_open_device (priv, device_str, serial_str,
+				  (item_flags & CH_UTIL_ITEM_FLAG_ALL_DEVICES) > 0,
+				  &error)) {
+		g_print ("%s\n", error->message);
 		goto out;
 	}
+	if (priv->devices != NULL && priv->pipeline) {
+		g_print ("%s\n", "--pipeline cannot be used with multiple devices");
+		goto out;
+	}
+	if (batch) {
+		g_printerr ("Opened device in %.2fms\n",
+			    g_timer_elapsed (timer, NULL) * 1000);
+	}
 
-	/* automatically use the correct proxies */
-	soup_session_add_feature_by_type (priv->session,
-					  SOUP_TYPE_PROXY_RESOLVER_DEFAULT);
+	g_debug ("startup took %.2fms", g_timer_elapsed (timer, NULL) * 1000);
+
+	/* run a script of commands using the same device */
+	if (batch) {
+		GIOChannel *channel = g_io_channel_unix_new (fileno (stdin));
+		ret = ch_util_run_batch (priv, channel, &error);
+		g_io_channel_unref (channel);
+		if (!ret) {
+			if (json)
+				g_printerr ("%s\n", error->message);
+			else
+				g_print ("%s\n", error->message);
+			goto out;
+		}
+		retval = 0;
+		goto out;
+	}
 
 	/* run the specified command */
 	if (!ch_util_run (priv, argv[1], (gchar**) &argv[2], &error)) {
-		g_print ("%s\n", error->message);
+		/* already included in the output */
+		if (!json)
+			g_print ("%s\n", error->message);
 		goto out;
 	}
 
@@ -3114,12 +6755,21 @@ main (int argc, char *argv[])
 	retval = 0;
 out:
 	if (priv != NULL) {
+		if (priv->trace != NULL) {
+			g_autoptr(GError) error_trace = NULL;
+			if (!ch_util_trace_save (priv->trace, trace_fn, &error_trace))
+				g_printerr ("%s\n", error_trace->message);
+			ch_util_trace_span_free (priv->trace_span);
+			ch_util_trace_free (priv->trace);
+		}
 		if (priv->session != NULL)
 			g_object_unref (priv->session);
-		if (priv->cmd_array != NULL)
-			g_ptr_array_unref (priv->cmd_array);
 		if (priv->device != NULL)
 			g_object_unref (priv->device);
+		if (priv->devices != NULL)
+			g_ptr_array_unref (priv->devices);
+		if (priv->usb_ctx != NULL)
+			g_object_unref (priv->usb_ctx);
 		if (priv->device_queue != NULL)
 			g_object_unref (priv->device_queue);
 		g_option_context_free (priv->context);
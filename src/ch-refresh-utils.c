@@ -23,16 +23,18 @@
 
 #include <colord.h>
 #include <glib/gi18n.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "ch-refresh-utils.h"
+#include "ch-stats.h"
+
 gdouble
 ch_refresh_calc_average (const gdouble *data, guint data_len)
 {
-	gdouble tmp = 0.f;
-	guint i;
-	for (i = 0; i < data_len; i++)
-		tmp += data[i];
-	return tmp / (gdouble) data_len;
+	return ch_stats_mean (data, data_len);
 }
 
 gdouble
@@ -50,283 +52,849 @@ ch_refresh_calc_jitter (const gdouble *data, guint data_len)
 	}
 	return jitter;
 }
-static void
-ch_refresh_sort (gdouble *data, guint data_len)
+
+ChRefreshAverage
+ch_refresh_average_from_string (const gchar *average)
 {
-	gboolean sorted;
-	gdouble tmp;
-	guint i;
+	if (g_strcmp0 (average, "trimmed-mean") == 0)
+		return CH_REFRESH_AVERAGE_TRIMMED_MEAN;
+	if (g_strcmp0 (average, "median") == 0)
+		return CH_REFRESH_AVERAGE_MEDIAN;
+	return CH_REFRESH_AVERAGE_MEAN;
+}
 
-	/* simple bubble sort */
-	do {
-		sorted = TRUE;
-		for (i = 0; i < data_len - 1; i++) {
-			if (data[i] > data[i + 1]) {
-				tmp = data[i];
-				data[i] = data[i + 1];
-				data[i + 1] = tmp;
-				sorted = FALSE;
-				break;
-			}
-		}
-	} while (!sorted);
+ChRefreshJitter
+ch_refresh_jitter_from_string (const gchar *jitter)
+{
+	if (g_strcmp0 (jitter, "std-dev") == 0)
+		return CH_REFRESH_JITTER_STD_DEV;
+	if (g_strcmp0 (jitter, "percentile") == 0)
+		return CH_REFRESH_JITTER_PERCENTILE;
+	return CH_REFRESH_JITTER_MAX_DEVIATION;
 }
 
-gboolean
-ch_refresh_get_rise (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+/* the kernels below process two samples at a time when SSE2 is available,
+ * and the trailing loops are the scalar fallback for everything else */
+
+/* returns the first index in [start,end) where data*scale > threshold,
+ * or @end if there is none */
+guint
+ch_refresh_find_above (const gdouble *data,
+		       guint start,
+		       guint end,
+		       gdouble scale,
+		       gdouble threshold)
 {
-	gdouble pulse_data[NR_PULSES];
-	gdouble tmp;
-	guint i;
-	guint idx_start;
-	guint j;
-	guint size;
+	guint i = start;
+#ifdef __SSE2__
+	const __m128d s = _mm_set1_pd (scale);
+	const __m128d t = _mm_set1_pd (threshold);
+	for (; i + 2 <= end; i += 2) {
+		__m128d v = _mm_mul_pd (_mm_loadu_pd (data + i), s);
+		gint mask = _mm_movemask_pd (_mm_cmpgt_pd (v, t));
+		if (mask != 0)
+			return i + g_bit_nth_lsf (mask, -1);
+	}
+#endif
+	for (; i < end; i++) {
+		if (data[i] * scale > threshold)
+			return i;
+	}
+	return end;
+}
 
-	/* calcluate the time per sample */
-	size = cd_spectrum_get_size (sp) / NR_PULSES;
-	if (size == 0) {
-		g_set_error_literal (error, 1, 0, "No data");
-		return FALSE;
+/* returns the first index in [start,end) where data*scale < threshold,
+ * or @end if there is none */
+guint
+ch_refresh_find_below (const gdouble *data,
+		       guint start,
+		       guint end,
+		       gdouble scale,
+		       gdouble threshold)
+{
+	guint i = start;
+#ifdef __SSE2__
+	const __m128d s = _mm_set1_pd (scale);
+	const __m128d t = _mm_set1_pd (threshold);
+	for (; i + 2 <= end; i += 2) {
+		__m128d v = _mm_mul_pd (_mm_loadu_pd (data + i), s);
+		gint mask = _mm_movemask_pd (_mm_cmplt_pd (v, t));
+		if (mask != 0)
+			return i + g_bit_nth_lsf (mask, -1);
 	}
+#endif
+	for (; i < end; i++) {
+		if (data[i] * scale < threshold)
+			return i;
+	}
+	return end;
+}
 
-	/* set to default value */
-	for (j = 0; j < NR_PULSES; j++)
-		pulse_data[j] = -1.f;
+/* returns the last index in [start,end) where data*scale > threshold,
+ * or @end if there is none */
+guint
+ch_refresh_find_last_above (const gdouble *data,
+			    guint start,
+			    guint end,
+			    gdouble scale,
+			    gdouble threshold)
+{
+	guint i = end;
+#ifdef __SSE2__
+	const __m128d s = _mm_set1_pd (scale);
+	const __m128d t = _mm_set1_pd (threshold);
+	for (; i >= start + 2; i -= 2) {
+		__m128d v = _mm_mul_pd (_mm_loadu_pd (data + i - 2), s);
+		gint mask = _mm_movemask_pd (_mm_cmpgt_pd (v, t));
+		if (mask != 0)
+			return i - 2 + g_bit_nth_msf (mask, -1);
+	}
+#endif
+	while (i-- > start) {
+		if (data[i] * scale > threshold)
+			return i;
+	}
+	return end;
+}
 
-	/* work on each pulse in turn */
-	for (j = 0; j < NR_PULSES; j++) {
-		idx_start = 0;
-		for (i = j * size; i < (j + 1) * size; i++) {
-			tmp = cd_spectrum_get_value (sp, i);
-
-			/* first time > 10% */
-			if (tmp > 0.1 && idx_start == 0) {
-				idx_start = i;
-				continue;
-			}
+/* scales the data so the largest value is @value, giving the same numbers
+ * as cd_spectrum_normalize_max() followed by cd_spectrum_get_value() */
+void
+ch_refresh_normalize_max (gdouble *data, guint data_len, gdouble value)
+{
+	gdouble max = 0.f;
+	gdouble norm;
+	guint i = 0;
+#ifdef __SSE2__
+	__m128d m = _mm_setzero_pd ();
+	gdouble tmp[2];
+	for (; i + 2 <= data_len; i += 2)
+		m = _mm_max_pd (m, _mm_loadu_pd (data + i));
+	_mm_storeu_pd (tmp, m);
+	max = MAX (tmp[0], tmp[1]);
+#endif
+	for (; i < data_len; i++) {
+		if (data[i] > max)
+			max = data[i];
+	}
+	if (max <= 0.f)
+		return;
 
-			/* first time > 90% */
-			if (tmp > 0.9 && idx_start > 0) {
-				pulse_data[j] = i - idx_start;
-				break;
+	norm = value / max;
+	i = 0;
+#ifdef __SSE2__
+	m = _mm_set1_pd (norm);
+	for (; i + 2 <= data_len; i += 2)
+		_mm_storeu_pd (data + i, _mm_mul_pd (_mm_loadu_pd (data + i), m));
+#endif
+	for (; i < data_len; i++)
+		data[i] *= norm;
+}
+
+/* for each point inside the pulse, if the point is less than 95% of the
+ * previous point, then copy 99% of the previous point value to this one */
+void
+ch_refresh_fill_envelope (gdouble *data, guint start, guint end)
+{
+	gboolean fix_idx = 0;
+	gdouble cutoff;
+	gdouble old_value = -1.f;
+	gdouble tmp;
+	guint i = start;
+
+	/* if we got 90% the way through without fixing up a data point then
+	 * don't bother now */
+	cutoff = start + ((gdouble) (end - start) * 0.9f);
+	while (i < end) {
+#ifdef __SSE2__
+		/* skip two samples at once when neither needs filling */
+		if (i + 2 <= end && (fix_idx != 0 || i + 1 <= cutoff)) {
+			__m128d v = _mm_loadu_pd (data + i);
+			__m128d prev = _mm_set_pd (data[i] * 0.99f, old_value);
+			prev = _mm_mul_pd (prev, _mm_set1_pd (0.95f));
+			if (_mm_movemask_pd (_mm_cmplt_pd (v, prev)) == 0) {
+				old_value = data[i + 1] * 0.99f;
+				i += 2;
+				continue;
 			}
 		}
+#endif
+		if (fix_idx == 0 && i > cutoff) {
+			g_debug ("no PWM fixup after %i, ignoring", i);
+			break;
+		}
+		tmp = data[i];
+		if (tmp < old_value * 0.95f) {
+			data[i] = old_value;
+			fix_idx = i;
+			i++;
+			continue;
+		}
+		old_value = tmp * 0.99f;
+		i++;
 	}
+}
 
-	/* check values */
-	for (j = 0; j < NR_PULSES; j++) {
-		if (pulse_data[j] < 0.f) {
-			g_set_error (error, 1, 0, "No edge on pulse %i", j + 1);
-			return FALSE;
-		}
+void
+ch_refresh_capture_plan_init (ChRefreshCapturePlan *plan)
+{
+	plan->samples = NR_DATA_POINTS;
+	plan->pulses = NR_PULSES;
+	plan->pulse_gap = NR_PULSE_GAP;
+	plan->channels = NR_CHANNELS;
+	plan->sample_time = NR_SAMPLE_TIME;
+}
+
+gboolean
+ch_refresh_capture_plan_check (const ChRefreshCapturePlan *plan, GError **error)
+{
+	gdouble window;
+
+	if (plan->pulses == 0 || plan->pulses > NR_PULSES_MAX) {
+		g_set_error (error, 1, 0,
+			     "Pulse count %u invalid, expected 1-%i",
+			     plan->pulses, NR_PULSES_MAX);
+		return FALSE;
+	}
+	if (plan->pulse_gap == 0) {
+		g_set_error_literal (error, 1, 0, "No gap between pulses");
+		return FALSE;
+	}
+	if (plan->channels == 0 ||
+	    plan->samples * plan->channels > NR_SRAM_SAMPLES) {
+		g_set_error (error, 1, 0,
+			     "%u samples of %u channels do not fit in SRAM",
+			     plan->samples, plan->channels);
+		return FALSE;
 	}
 
-	/* multiply by the resolution */
-	for (j = 0; j < NR_PULSES; j++)
-		pulse_data[j] *= cd_spectrum_get_resolution (sp);
+	/* each pulse needs a rising and a falling sample */
+	if (plan->samples / plan->pulses < 2) {
+		g_set_error (error, 1, 0,
+			     "%u samples are too few for %u pulses",
+			     plan->samples, plan->pulses);
+		return FALSE;
+	}
 
-	/* print debugging */
-	for (i = 0; i < NR_PULSES; i++)
-		g_debug ("peak %i: %f", i + 1, pulse_data[i]);
+	/* the sample time is only an estimate until a capture is timed */
+	window = plan->samples * plan->sample_time;
+	return ch_refresh_capture_plan_check_window (plan, window, error);
+}
 
-	/* success */
-	if (value != NULL)
-		*value = ch_refresh_calc_average (pulse_data, NR_PULSES);
-	if (jitter != NULL)
-		*jitter = ch_refresh_calc_jitter (pulse_data, NR_PULSES);
+/* @window is how long the capture took, in ms */
+gboolean
+ch_refresh_capture_plan_check_window (const ChRefreshCapturePlan *plan,
+				      gdouble window,
+				      GError **error)
+{
+	/* the last flash and as much dark again have to be captured, which
+	 * the default plan only just manages */
+	if ((plan->pulses - 1) * plan->pulse_gap + plan->pulse_gap / 2 > window) {
+		g_set_error (error, 1, 0,
+			     "%u pulses %ums apart do not fit in %.0fms",
+			     plan->pulses, plan->pulse_gap, window);
+		return FALSE;
+	}
 	return TRUE;
 }
 
+/* the number of samples from one flash to the next */
+gdouble
+ch_refresh_capture_plan_get_pulse_len (const ChRefreshCapturePlan *plan,
+				       gdouble resolution)
+{
+	return (gdouble) plan->pulse_gap / 1000.f / resolution;
+}
+
+/* copies one channel out of the interleaved SRAM readings */
+void
+ch_refresh_capture_plan_decode (const ChRefreshCapturePlan *plan,
+				const guint16 *sram,
+				guint channel,
+				gdouble *values)
+{
+	guint i;
+	for (i = 0; i < plan->samples; i++)
+		values[i] = sram[i * plan->channels + channel];
+}
+
+/* walks the trace once, finding every edge of every pulse, where pulse
+ * @j starts @j * @pulse_len samples in and the last may be cut short */
 gboolean
-ch_refresh_get_fall (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+ch_refresh_edges_scan (ChRefreshEdges *edges,
+		       const gdouble *data,
+		       guint data_len,
+		       guint pulses,
+		       gdouble pulse_len,
+		       gdouble scale,
+		       gdouble resolution,
+		       GError **error)
 {
 	guint i;
+	guint idx;
 	guint j;
-	guint idx_start;
 	guint size;
-	gdouble pulse_data[NR_PULSES];
-	gdouble tmp;
 
-	/* calcluate the time per sample */
-	size = cd_spectrum_get_size (sp) / NR_PULSES;
-	if (size == 0) {
-		g_set_error_literal (error, 1, 0, "No data");
+	if (pulses == 0 || pulses > NR_PULSES_MAX) {
+		g_set_error (error, 1, 0, "Pulse count %u invalid", pulses);
 		return FALSE;
 	}
 
-	/* set to default value */
-	for (j = 0; j < NR_PULSES; j++)
-		pulse_data[j] = -1.f;
+	/* calcluate the samples per pulse */
+	size = pulse_len > 0.f ? (guint) pulse_len : 0;
+	if (size == 0 || data_len == 0) {
+		g_set_error_literal (error, 1, 0, "No data");
+		return FALSE;
+	}
+	for (j = 0; j < pulses; j++) {
+		edges->window_start[j] = (guint) floor (j * pulse_len + 0.5f);
+		edges->window_end[j] = MIN (edges->window_start[j] + size, data_len);
+		if (edges->window_start[j] >= data_len ||
+		    edges->window_end[j] - edges->window_start[j] < size / 2) {
+			g_set_error (error, 1, 0,
+				     "Pulse %u is outside the capture", j + 1);
+			return FALSE;
+		}
+	}
+	edges->resolution = resolution;
+	edges->pulses = pulses;
+	edges->interp = CH_REFRESH_INTERP_NONE;
+	edges->average = CH_REFRESH_AVERAGE_MEAN;
+	edges->jitter = CH_REFRESH_JITTER_MAX_DEVIATION;
 
 	/* work on each pulse in turn */
-	for (j = 0; j < NR_PULSES; j++) {
-		idx_start = 0;
-		for (i = j * size; i < (j + 1) * size; i++) {
-			tmp = cd_spectrum_get_value (sp, i);
-
-			/* last time > 90% */
-			if (tmp > 0.9) {
-				idx_start = i;
-				continue;
-			}
+	for (j = 0; j < pulses; j++) {
+		const guint start = edges->window_start[j];
+		const guint end = edges->window_end[j];
+		guint first;
+		guint hi;
+		guint lo;
+
+		/* set to default value */
+		edges->rise[j] = -1;
+		edges->fall[j] = -1;
+		edges->latency[j] = -1;
+		edges->pwm_start[j] = 0;
+		edges->pwm_end[j] = 0;
+		edges->rise_start[j] = 0;
+		edges->fall_start[j] = 0;
+
+		/* latency: first time > 10% */
+		idx = ch_refresh_find_above (data, start, end, scale, 0.1f);
+		if (idx < end)
+			edges->latency[j] = idx - start;
+
+		/* index zero means 'unset' for the other edges, so the very
+		 * first sample of the trace never starts one */
+		first = MAX (start, 1);
+
+		/* pwm: first time > 10% until last time > 50% */
+		idx = ch_refresh_find_above (data, first, end, scale, 0.1f);
+		if (idx < end) {
+			edges->pwm_start[j] = idx;
+			idx = ch_refresh_find_last_above (data, start, end, scale, 0.5f);
+			if (idx < end && idx != edges->pwm_start[j])
+				edges->pwm_end[j] = idx;
+		}
 
-			/* last time > 10% */
-			if (tmp < 0.1 && idx_start > 0) {
-				pulse_data[j] = i - idx_start;
-				idx_start = 0;
-			}
+		/* rise: first time > 10% until first time > 90% */
+		lo = ch_refresh_find_above (data, first, end, scale, 0.1);
+		if (lo < end) {
+			hi = ch_refresh_find_above (data, lo + 1, end, scale, 0.9);
+			edges->rise_start[j] = lo;
+			if (hi < end)
+				edges->rise[j] = hi - lo;
 		}
-	}
 
-	/* check values */
-	for (j = 0; j < NR_PULSES; j++) {
-		if (pulse_data[j] < 0.f) {
-			g_set_error (error, 1, 0, "No edge on pulse %i", j + 1);
-			return FALSE;
+		/* fall: last time > 90% until next time < 10%, where the last
+		 * such transition in the pulse wins */
+		for (i = start; i < end; i = lo + 1) {
+			hi = ch_refresh_find_above (data, i, end, scale, 0.9);
+			if (hi == end)
+				break;
+			lo = ch_refresh_find_below (data, hi + 1, end, scale, 0.1);
+			if (lo == end)
+				break;
+			hi = ch_refresh_find_last_above (data, hi, lo, scale, 0.9);
+			if (hi > 0) {
+				edges->fall_start[j] = hi;
+				edges->fall[j] = lo - hi;
+			}
 		}
-	}
 
-	/* multiply by the resolution */
-	for (j = 0; j < NR_PULSES; j++)
-		pulse_data[j] *= cd_spectrum_get_resolution (sp);
+		/* until refined */
+		edges->rise_fine[j] = edges->rise[j];
+		edges->fall_fine[j] = edges->fall[j];
+		edges->latency_fine[j] = edges->latency[j];
+	}
+	return TRUE;
+}
 
-	/* print debugging */
-	for (i = 0; i < NR_PULSES; i++)
-		g_debug ("peak %i: %f", i + 1, pulse_data[i]);
+/* least-squares line through the samples [first,last] */
+static gboolean
+ch_refresh_fit_line (const gdouble *data,
+		     guint first,
+		     guint last,
+		     gdouble scale,
+		     gdouble *x_mean,
+		     gdouble *y_mean,
+		     gdouble *slope)
+{
+	gdouble sxx = 0.f;
+	gdouble sxy = 0.f;
+	gdouble xm;
+	gdouble ym = 0.f;
+	guint i;
+	guint n = last - first + 1;
 
-	/* success */
-	if (value != NULL)
-		*value = ch_refresh_calc_average (pulse_data, NR_PULSES);
-	if (jitter != NULL)
-		*jitter = ch_refresh_calc_jitter (pulse_data, NR_PULSES);
+	if (last <= first)
+		return FALSE;
+	xm = (first + last) / 2.f;
+	for (i = first; i <= last; i++)
+		ym += data[i] * scale;
+	ym /= n;
+	for (i = first; i <= last; i++) {
+		sxx += (i - xm) * (i - xm);
+		sxy += (i - xm) * (data[i] * scale - ym);
+	}
+	if (sxy == 0.f)
+		return FALSE;
+	*x_mean = xm;
+	*y_mean = ym;
+	*slope = sxy / sxx;
 	return TRUE;
 }
 
-gboolean
-ch_refresh_get_input_latency (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+/* returns where the data crosses @threshold between samples @idx - 1 and
+ * @idx, in samples */
+static gdouble
+ch_refresh_interp_crossing (const gdouble *data,
+			    guint start,
+			    guint end,
+			    guint idx,
+			    gdouble scale,
+			    gdouble threshold,
+			    ChRefreshInterp interp)
 {
+	gdouble lower = 0.f;
+	gdouble m;
+	gdouble p0;
+	gdouble p1;
+	gdouble p2;
+	gdouble p3;
+	gdouble upper = 1.f;
+	gdouble u = 0.f;
+	gdouble xm;
+	gdouble ym;
 	guint i;
-	guint j;
-	guint size;
-	gdouble pulse_data[NR_PULSES];
-	gdouble tmp;
 
-	/* calcluate the time per sample */
-	size = cd_spectrum_get_size (sp) / NR_PULSES;
-	if (size == 0) {
-		g_set_error_literal (error, 1, 0, "No data");
-		return FALSE;
+	/* nothing before the crossing to interpolate with */
+	if (idx <= start || idx >= end)
+		return idx;
+	p1 = data[idx - 1] * scale;
+	p2 = data[idx] * scale;
+	if (p1 == p2)
+		return idx;
+
+	/* line through two samples each side, which averages out some of
+	 * the noise while still following a curved edge; the crossing has
+	 * to stay between the samples that bracket it */
+	if (interp == CH_REFRESH_INTERP_FIT &&
+	    ch_refresh_fit_line (data,
+				 MAX (idx, start + 2) - 2,
+				 MIN (idx + 1, end - 1),
+				 scale, &xm, &ym, &m)) {
+		return CLAMP (xm + (threshold - ym) / m, idx - 1, idx);
+	}
+
+	/* straight line between the two samples */
+	if (interp != CH_REFRESH_INTERP_CUBIC)
+		return idx - 1 + (threshold - p1) / (p2 - p1);
+
+	/* Catmull-Rom through the neighbours, repeating the end points, and
+	 * bisected as the threshold is bracketed by p1 and p2 */
+	p0 = idx >= start + 2 ? data[idx - 2] * scale : p1;
+	p3 = idx + 1 < end ? data[idx + 1] * scale : p2;
+	for (i = 0; i < 40; i++) {
+		gdouble tmp;
+		u = (lower + upper) / 2.f;
+		tmp = 0.5f * ((2.f * p1) +
+			      (-p0 + p2) * u +
+			      (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * u * u +
+			      (-p0 + 3.f * p1 - 3.f * p2 + p3) * u * u * u);
+		if ((tmp < threshold) == (p1 < p2))
+			lower = u;
+		else
+			upper = u;
 	}
+	return idx - 1 + u;
+}
 
-	/* set to default value */
-	for (j = 0; j < NR_PULSES; j++)
-		pulse_data[j] = -1.f;
+void
+ch_refresh_edges_refine (ChRefreshEdges *edges,
+			 const gdouble *data,
+			 gdouble scale,
+			 ChRefreshInterp interp)
+{
+	gdouble t10;
+	gdouble t90;
+	guint j;
 
-	/* work on each pulse in turn */
-	for (j = 0; j < NR_PULSES; j++) {
-		for (i = j * size; i < (j + 1) * size; i++) {
-			tmp = cd_spectrum_get_value (sp, i);
+	edges->interp = interp;
+	for (j = 0; j < edges->pulses; j++) {
+		const guint start = edges->window_start[j];
+		const guint end = edges->window_end[j];
+		guint idx;
+
+		/* the whole sample values */
+		edges->rise_fine[j] = edges->rise[j];
+		edges->fall_fine[j] = edges->fall[j];
+		edges->latency_fine[j] = edges->latency[j];
+		if (interp == CH_REFRESH_INTERP_NONE)
+			continue;
+
+		/* latency: the 10% crossing */
+		if (edges->latency[j] >= 0) {
+			idx = start + edges->latency[j];
+			t10 = ch_refresh_interp_crossing (data, start, end, idx,
+							  scale, 0.1f, interp);
+			edges->latency_fine[j] = t10 - start;
+		}
 
-			/* first time > 10% */
-			if (tmp > 0.1f) {
-				pulse_data[j] = i - (j * size);
-				break;
-			}
+		/* rise: the 10% and the 90% crossing */
+		if (edges->rise[j] >= 0) {
+			idx = ch_refresh_find_above (data, edges->rise_start[j],
+						     end, scale, 0.9);
+			t10 = ch_refresh_interp_crossing (data, start, end,
+							  edges->rise_start[j],
+							  scale, 0.1, interp);
+			t90 = ch_refresh_interp_crossing (data, start, end, idx,
+							  scale, 0.9, interp);
+			edges->rise_fine[j] = t90 - t10;
+		}
+
+		/* fall: the 90% and then the 10% crossing */
+		if (edges->fall[j] >= 0) {
+			idx = edges->fall_start[j] + edges->fall[j];
+			t90 = ch_refresh_interp_crossing (data, start, end,
+							  edges->fall_start[j] + 1,
+							  scale, 0.9, interp);
+			t10 = ch_refresh_interp_crossing (data, start, end, idx,
+							  scale, 0.1, interp);
+			edges->fall_fine[j] = t10 - t90;
 		}
 	}
+}
+
+void
+ch_refresh_edges_refine_spectrum (ChRefreshEdges *edges,
+				  CdSpectrum *sp,
+				  ChRefreshInterp interp)
+{
+	GArray *data = cd_spectrum_get_data (sp);
+	ch_refresh_edges_refine (edges,
+				 (const gdouble *) data->data,
+				 cd_spectrum_get_norm (sp),
+				 interp);
+}
+
+gboolean
+ch_refresh_edges_from_spectrum (ChRefreshEdges *edges,
+				CdSpectrum *sp,
+				const ChRefreshCapturePlan *plan,
+				GError **error)
+{
+	GArray *data = cd_spectrum_get_data (sp);
+	gdouble resolution = cd_spectrum_get_resolution (sp);
+
+	/* the thresholds apply to the normalized values */
+	return ch_refresh_edges_scan (edges,
+				      (const gdouble *) data->data,
+				      data->len,
+				      plan->pulses,
+				      ch_refresh_capture_plan_get_pulse_len (plan, resolution),
+				      cd_spectrum_get_norm (sp),
+				      resolution,
+				      error);
+}
+
+/* the default number of pulses spread evenly over the whole capture */
+static gboolean
+ch_refresh_edges_from_spectrum_even (ChRefreshEdges *edges,
+				     CdSpectrum *sp,
+				     GError **error)
+{
+	GArray *data = cd_spectrum_get_data (sp);
+	return ch_refresh_edges_scan (edges,
+				      (const gdouble *) data->data,
+				      data->len,
+				      NR_PULSES,
+				      data->len / NR_PULSES,
+				      cd_spectrum_get_norm (sp),
+				      cd_spectrum_get_resolution (sp),
+				      error);
+}
+
+void
+ch_refresh_edges_set_statistics (ChRefreshEdges *edges,
+				 ChRefreshAverage average,
+				 ChRefreshJitter jitter)
+{
+	edges->average = average;
+	edges->jitter = jitter;
+}
+
+/* the plain mean ignores the fastest and slowest pulse where asked, the
+ * other averages are robust to them anyway */
+static guint
+ch_refresh_edges_trim (const ChRefreshEdges *edges,
+		       gdouble *data,
+		       guint data_len,
+		       gboolean trim)
+{
+	if (!trim || edges->average != CH_REFRESH_AVERAGE_MEAN || data_len < 3)
+		return 0;
+	ch_stats_sort (data, data_len);
+	return 1;
+}
+
+static gdouble
+ch_refresh_edges_average (const ChRefreshEdges *edges,
+			  const gdouble *data,
+			  guint data_len)
+{
+	switch (edges->average) {
+	case CH_REFRESH_AVERAGE_TRIMMED_MEAN:
+		return ch_stats_trimmed_mean (data, data_len, 0.2f);
+	case CH_REFRESH_AVERAGE_MEDIAN:
+		return ch_stats_median (data, data_len);
+	default:
+		return ch_refresh_calc_average (data, data_len);
+	}
+}
+
+static gdouble
+ch_refresh_edges_jitter (const ChRefreshEdges *edges,
+			 const gdouble *data,
+			 guint data_len)
+{
+	switch (edges->jitter) {
+	case CH_REFRESH_JITTER_STD_DEV:
+		return ch_stats_std_dev (data, data_len);
+	case CH_REFRESH_JITTER_PERCENTILE:
+		return ch_stats_percentile_jitter (data, data_len, 95.f);
+	default:
+		return ch_refresh_calc_jitter (data, data_len);
+	}
+}
+
+/* uses the sub-sample edges, which are the whole samples until
+ * ch_refresh_edges_refine() is called, so the value and the jitter always
+ * come from the same edges */
+static gboolean
+ch_refresh_edges_reduce (const ChRefreshEdges *edges,
+			 const gdouble *samples,
+			 gboolean trim,
+			 gdouble *value,
+			 gdouble *jitter,
+			 GError **error)
+{
+	gdouble pulse_data[NR_PULSES_MAX];
+	guint j;
+	guint len = edges->pulses;
+	guint skip;
 
 	/* check values */
-	for (j = 0; j < NR_PULSES; j++) {
-		if (pulse_data[j] < 0.f) {
+	for (j = 0; j < edges->pulses; j++) {
+		if (samples[j] < 0.f) {
 			g_set_error (error, 1, 0, "No edge on pulse %i", j + 1);
 			return FALSE;
 		}
 	}
 
 	/* multiply by the resolution */
-	for (j = 0; j < NR_PULSES; j++)
-		pulse_data[j] *= cd_spectrum_get_resolution (sp);
-
-	/* print debugging */
-	for (i = 0; i < NR_PULSES; i++)
-		g_debug ("peak %i: %f", i + 1, pulse_data[i]);
+	for (j = 0; j < edges->pulses; j++) {
+		pulse_data[j] = samples[j] * edges->resolution;
+		g_debug ("peak %i: %f", j + 1, pulse_data[j]);
+	}
 
 	/* success */
-	ch_refresh_sort (pulse_data, NR_PULSES);
+	skip = ch_refresh_edges_trim (edges, pulse_data, len, trim);
+	len -= skip * 2;
 	if (value != NULL)
-		*value = ch_refresh_calc_average (pulse_data + 1, NR_PULSES - 2);
+		*value = ch_refresh_edges_average (edges, pulse_data + skip, len);
 	if (jitter != NULL)
-		*jitter = ch_refresh_calc_jitter (pulse_data + 1, NR_PULSES - 2);
+		*jitter = ch_refresh_edges_jitter (edges, pulse_data + skip, len);
 	return TRUE;
 }
 
 gboolean
-ch_refresh_remove_pwm (CdSpectrum *sp, GError **error)
+ch_refresh_edges_get_rise (const ChRefreshEdges *edges,
+			   gdouble *value,
+			   gdouble *jitter,
+			   GError **error)
 {
-	guint i;
-	guint j;
-	guint size;
+	return ch_refresh_edges_reduce (edges, edges->rise_fine, FALSE,
+					value, jitter, error);
+}
+
+gboolean
+ch_refresh_edges_get_fall (const ChRefreshEdges *edges,
+			   gdouble *value,
+			   gdouble *jitter,
+			   GError **error)
+{
+	return ch_refresh_edges_reduce (edges, edges->fall_fine, FALSE,
+					value, jitter, error);
+}
+
+gboolean
+ch_refresh_edges_get_input_latency (const ChRefreshEdges *edges,
+				    gdouble *value,
+				    gdouble *jitter,
+				    GError **error)
+{
+	return ch_refresh_edges_reduce (edges, edges->latency_fine, TRUE,
+					value, jitter, error);
+}
+
+static gboolean
+ch_refresh_edges_reduce_fine (const ChRefreshEdges *edges,
+			      const gdouble *samples,
+			      gboolean trim,
+			      gdouble *value,
+			      gdouble *uncertainty,
+			      GError **error)
+{
+	gdouble pulse_data[NR_PULSES_MAX];
+	gdouble *data;
 	gdouble tmp;
+	guint len = edges->pulses;
+	guint j;
+	guint skip;
 
-	/* calcluate the time per sample */
-	size = cd_spectrum_get_size (sp) / NR_PULSES;
-	if (size == 0) {
-		g_set_error_literal (error, 1, 0, "No data");
-		return FALSE;
+	/* check values */
+	for (j = 0; j < edges->pulses; j++) {
+		if (samples[j] < 0.f) {
+			g_set_error (error, 1, 0, "No edge on pulse %i", j + 1);
+			return FALSE;
+		}
+		pulse_data[j] = samples[j] * edges->resolution;
 	}
 
+	skip = ch_refresh_edges_trim (edges, pulse_data, len, trim);
+	data = pulse_data + skip;
+	len -= skip * 2;
+	if (value != NULL)
+		*value = ch_refresh_edges_average (edges, data, len);
+
+	/* standard error of the mean, plus the rounding error of whole
+	 * samples if they were not interpolated; the median of normally
+	 * distributed data is sqrt(pi/2) times less efficient */
+	if (uncertainty != NULL) {
+		tmp = pow (ch_stats_std_dev (data, len), 2.f) / len;
+		if (edges->average == CH_REFRESH_AVERAGE_MEDIAN)
+			tmp *= G_PI / 2.f;
+		if (edges->interp == CH_REFRESH_INTERP_NONE)
+			tmp += pow (edges->resolution, 2.f) / 12.f / len;
+		*uncertainty = sqrt (tmp);
+	}
+	return TRUE;
+}
+
+gboolean
+ch_refresh_edges_get_rise_fine (const ChRefreshEdges *edges,
+				gdouble *value,
+				gdouble *uncertainty,
+				GError **error)
+{
+	return ch_refresh_edges_reduce_fine (edges, edges->rise_fine, FALSE,
+					     value, uncertainty, error);
+}
+
+gboolean
+ch_refresh_edges_get_fall_fine (const ChRefreshEdges *edges,
+				gdouble *value,
+				gdouble *uncertainty,
+				GError **error)
+{
+	return ch_refresh_edges_reduce_fine (edges, edges->fall_fine, FALSE,
+					     value, uncertainty, error);
+}
+
+gboolean
+ch_refresh_edges_get_input_latency_fine (const ChRefreshEdges *edges,
+					 gdouble *value,
+					 gdouble *uncertainty,
+					 GError **error)
+{
+	return ch_refresh_edges_reduce_fine (edges, edges->latency_fine, TRUE,
+					     value, uncertainty, error);
+}
+
+gboolean
+ch_refresh_edges_remove_pwm (const ChRefreshEdges *edges,
+			     gdouble *data,
+			     GError **error)
+{
+	guint j;
+
 	/* work on each pulse in turn */
-	for (j = 0; j < NR_PULSES; j++) {
-		guint pulse_start = 0;
-		guint pulse_end = 0;
-		gboolean fix_idx = 0;
-		gdouble old_value = -1.f;
-
-		for (i = j * size; i < (j + 1) * size; i++) {
-			tmp = cd_spectrum_get_value (sp, i);
-
-			/* first time > 10% */
-			if (tmp > 0.1f && pulse_start == 0) {
-				pulse_start = i;
-				continue;
-			}
+	for (j = 0; j < edges->pulses; j++) {
+		guint pulse_start = edges->pwm_start[j];
+		guint pulse_end = edges->pwm_end[j];
 
-			/* last time > 50% */
-			if (tmp > 0.5f) {
-				pulse_end = i;
-				continue;
-			}
-		}
 		if (pulse_start == 0 || pulse_end == 0) {
 			g_set_error (error, 1, 0, "No edge on pulse %i", j + 1);
 			return FALSE;
 		}
-
-		/* for each point inside the pulse, if the point is less than
-		 * previous point, then copy 95% of the previous point value
-		 * to this one */
 		g_debug ("removing PWM from %i to %i", pulse_start, pulse_end);
-		for (i = pulse_start; i < pulse_end; i++) {
-			/* if we got 90% the way through without fixing up a
-			 * data point then don't bother now */
-			tmp = pulse_start + ((gdouble) (pulse_end - pulse_start) * 0.9f);
-			if (fix_idx == 0 && i > tmp) {
-				g_debug ("no PWM fixup after %i, ignoring", i);
-				break;
-			}
-			tmp = cd_spectrum_get_value (sp, i);
-			if (tmp < old_value * 0.95f) {
-				cd_spectrum_set_value (sp, i, old_value);
-				fix_idx = i;
-				continue;
-			}
-			old_value = tmp * 0.99f;
-		}
+		ch_refresh_fill_envelope (data, pulse_start, pulse_end);
 	}
 
 	return TRUE;
 }
 
+gboolean
+ch_refresh_get_rise (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+{
+	ChRefreshEdges edges;
+	if (!ch_refresh_edges_from_spectrum_even (&edges, sp, error))
+		return FALSE;
+	return ch_refresh_edges_get_rise (&edges, value, jitter, error);
+}
+
+gboolean
+ch_refresh_get_fall (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+{
+	ChRefreshEdges edges;
+	if (!ch_refresh_edges_from_spectrum_even (&edges, sp, error))
+		return FALSE;
+	return ch_refresh_edges_get_fall (&edges, value, jitter, error);
+}
+
+gboolean
+ch_refresh_get_input_latency (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+{
+	ChRefreshEdges edges;
+	if (!ch_refresh_edges_from_spectrum_even (&edges, sp, error))
+		return FALSE;
+	return ch_refresh_edges_get_input_latency (&edges, value, jitter, error);
+}
+
+gboolean
+ch_refresh_remove_pwm (CdSpectrum *sp, GError **error)
+{
+	ChRefreshEdges edges;
+	GArray *data = cd_spectrum_get_data (sp);
+
+	/* the spectrum owns a contiguous array so fix it up in place; the
+	 * fill is relative so it works on the raw values */
+	if (!ch_refresh_edges_from_spectrum_even (&edges, sp, error))
+		return FALSE;
+	return ch_refresh_edges_remove_pwm (&edges, (gdouble *) data->data, error);
+}
+
 void
 ch_refresh_result_add (GHashTable *results, const gchar *key, const gchar *value)
 {
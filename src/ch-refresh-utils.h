@@ -27,10 +27,157 @@
 
 G_BEGIN_DECLS
 
+/* the default capture plan */
 #define NR_DATA_POINTS		1365
 #define NR_PULSES		5
 #define NR_PULSE_GAP		400	/* ms */
+#define NR_CHANNELS		3
+#define NR_SAMPLE_TIME		1.458	/* ms, estimate from the 1.989s span of data/tests/*.ccss */
 
+#define NR_PULSES_MAX		32
+#define NR_SRAM_SAMPLES		4096
+
+/* how the display is flashed and how the device fills its SRAM */
+typedef struct {
+	guint		 samples;	/* per channel */
+	guint		 pulses;
+	guint		 pulse_gap;	/* ms */
+	guint		 channels;	/* interleaved */
+	gdouble		 sample_time;	/* ms, nominal */
+} ChRefreshCapturePlan;
+
+void		 ch_refresh_capture_plan_init	(ChRefreshCapturePlan	*plan);
+gboolean	 ch_refresh_capture_plan_check	(const ChRefreshCapturePlan *plan,
+						 GError			**error);
+gboolean	 ch_refresh_capture_plan_check_window (const ChRefreshCapturePlan *plan,
+						 gdouble		 window,
+						 GError			**error);
+gdouble		 ch_refresh_capture_plan_get_pulse_len (const ChRefreshCapturePlan *plan,
+						 gdouble		 resolution);
+void		 ch_refresh_capture_plan_decode	(const ChRefreshCapturePlan *plan,
+						 const guint16		*sram,
+						 guint			 channel,
+						 gdouble		*values);
+
+guint		 ch_refresh_find_above		(const gdouble		*data,
+						 guint			 start,
+						 guint			 end,
+						 gdouble		 scale,
+						 gdouble		 threshold);
+guint		 ch_refresh_find_below		(const gdouble		*data,
+						 guint			 start,
+						 guint			 end,
+						 gdouble		 scale,
+						 gdouble		 threshold);
+guint		 ch_refresh_find_last_above	(const gdouble		*data,
+						 guint			 start,
+						 guint			 end,
+						 gdouble		 scale,
+						 gdouble		 threshold);
+void		 ch_refresh_normalize_max	(gdouble		*data,
+						 guint			 data_len,
+						 gdouble		 value);
+void		 ch_refresh_fill_envelope	(gdouble		*data,
+						 guint			 start,
+						 guint			 end);
+
+typedef enum {
+	CH_REFRESH_INTERP_NONE,		/* whole samples */
+	CH_REFRESH_INTERP_LINEAR,	/* between the two samples either side */
+	CH_REFRESH_INTERP_CUBIC,	/* Catmull-Rom through four samples */
+	CH_REFRESH_INTERP_FIT,		/* least-squares line through four samples */
+	CH_REFRESH_INTERP_LAST
+} ChRefreshInterp;
+
+typedef enum {
+	CH_REFRESH_AVERAGE_MEAN,	/* of all but the extremes for latency */
+	CH_REFRESH_AVERAGE_TRIMMED_MEAN, /* of the middle 60% */
+	CH_REFRESH_AVERAGE_MEDIAN,
+	CH_REFRESH_AVERAGE_LAST
+} ChRefreshAverage;
+
+typedef enum {
+	CH_REFRESH_JITTER_MAX_DEVIATION, /* from the mean */
+	CH_REFRESH_JITTER_STD_DEV,
+	CH_REFRESH_JITTER_PERCENTILE,	/* half the 5th to 95th percentile range */
+	CH_REFRESH_JITTER_LAST
+} ChRefreshJitter;
+
+ChRefreshAverage ch_refresh_average_from_string	(const gchar		*average);
+ChRefreshJitter	 ch_refresh_jitter_from_string	(const gchar		*jitter);
+
+/* edge positions of each pulse in samples, -1 where there is no edge */
+typedef struct {
+	gdouble		 resolution;
+	guint		 pulses;
+	guint		 window_start[NR_PULSES_MAX];
+	guint		 window_end[NR_PULSES_MAX];
+	gint		 rise[NR_PULSES_MAX];
+	gint		 fall[NR_PULSES_MAX];
+	gint		 latency[NR_PULSES_MAX];
+	guint		 pwm_start[NR_PULSES_MAX];
+	guint		 pwm_end[NR_PULSES_MAX];
+	guint		 rise_start[NR_PULSES_MAX];
+	guint		 fall_start[NR_PULSES_MAX];
+	/* sub-sample versions, set by ch_refresh_edges_refine() */
+	ChRefreshInterp	 interp;
+	gdouble		 rise_fine[NR_PULSES_MAX];
+	gdouble		 fall_fine[NR_PULSES_MAX];
+	gdouble		 latency_fine[NR_PULSES_MAX];
+	/* how the pulses are combined, set by ch_refresh_edges_set_statistics() */
+	ChRefreshAverage average;
+	ChRefreshJitter	 jitter;
+} ChRefreshEdges;
+
+gboolean	 ch_refresh_edges_scan		(ChRefreshEdges		*edges,
+						 const gdouble		*data,
+						 guint			 data_len,
+						 guint			 pulses,
+						 gdouble		 pulse_len,
+						 gdouble		 scale,
+						 gdouble		 resolution,
+						 GError			**error);
+gboolean	 ch_refresh_edges_from_spectrum	(ChRefreshEdges		*edges,
+						 CdSpectrum		*sp,
+						 const ChRefreshCapturePlan *plan,
+						 GError			**error);
+void		 ch_refresh_edges_set_statistics (ChRefreshEdges	*edges,
+						 ChRefreshAverage	 average,
+						 ChRefreshJitter	 jitter);
+void		 ch_refresh_edges_refine	(ChRefreshEdges		*edges,
+						 const gdouble		*data,
+						 gdouble		 scale,
+						 ChRefreshInterp	 interp);
+void		 ch_refresh_edges_refine_spectrum (ChRefreshEdges	*edges,
+						 CdSpectrum		*sp,
+						 ChRefreshInterp	 interp);
+gboolean	 ch_refresh_edges_get_rise	(const ChRefreshEdges	*edges,
+						 gdouble		*value,
+						 gdouble		*jitter,
+						 GError			**error);
+gboolean	 ch_refresh_edges_get_fall	(const ChRefreshEdges	*edges,
+						 gdouble		*value,
+						 gdouble		*jitter,
+						 GError			**error);
+gboolean	 ch_refresh_edges_get_input_latency (const ChRefreshEdges *edges,
+						 gdouble		*value,
+						 gdouble		*jitter,
+						 GError			**error);
+gboolean	 ch_refresh_edges_get_rise_fine	(const ChRefreshEdges	*edges,
+						 gdouble		*value,
+						 gdouble		*uncertainty,
+						 GError			**error);
+gboolean	 ch_refresh_edges_get_fall_fine	(const ChRefreshEdges	*edges,
+						 gdouble		*value,
+						 gdouble		*uncertainty,
+						 GError			**error);
+gboolean	 ch_refresh_edges_get_input_latency_fine (const ChRefreshEdges *edges,
+						 gdouble		*value,
+						 gdouble		*uncertainty,
+						 GError			**error);
+gboolean	 ch_refresh_edges_remove_pwm	(const ChRefreshEdges	*edges,
+						 gdouble		*data,
+						 GError			**error);
 gboolean	 ch_refresh_get_rise		(CdSpectrum		*sp,
 						 gdouble		*value,
 						 gdouble		*jitter,
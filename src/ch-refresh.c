@@ -49,6 +49,7 @@ typedef struct {
 	GUsbContext		*usb_ctx;
 	GUsbDevice		*device;
 	GHashTable		*results;
+	ChRefreshCapturePlan	 plan;		/* of the samples */
 } ChRefreshPrivate;
 
 typedef struct {
@@ -64,6 +65,7 @@ typedef struct {
 	gdouble			 usb_latency;		/* s */
 	guint8			*reading_array;		/* not used (SRAM) */
 	guint			 sample_idx;
+	ChRefreshCapturePlan	 plan;
 } ChRefreshMeasureHelper;
 
 static void
@@ -121,7 +123,7 @@ ch_refresh_sample_set_white_cb (gpointer user_data)
 		 g_timer_elapsed (helper->measured, NULL) * 1000.f);
 
 	/* set a timeout set the patch black again */
-	g_timeout_add (100, ch_refresh_sample_set_black_cb, helper);
+	g_timeout_add (helper->plan.pulse_gap / 4, ch_refresh_sample_set_black_cb, helper);
 	return FALSE;
 }
 
@@ -167,12 +169,13 @@ ch_refresh_get_data_from_sram (ChRefreshMeasureHelper *helper)
 	const gchar *ids[] = { "X", "Y", "Z", NULL };
 	const gchar *title;
 	gboolean ret;
-	guint16 buffer[4096];
+	guint16 buffer[NR_SRAM_SAMPLES];
 	guint i;
 	guint j;
+	g_autofree gdouble *values = NULL;
 	g_autoptr(GError) error = NULL;
 
-	/* get 3694 samples from the sram */
+	/* get all the samples from the sram */
 	ch_device_queue_read_sram (helper->priv->device_queue,
 				   helper->priv->device,
 				   0x0000,
@@ -190,18 +193,22 @@ ch_refresh_get_data_from_sram (ChRefreshMeasureHelper *helper)
 	}
 
 	/* extract data */
-	for (j = 0; j < 3; j++) {
+	values = g_new0 (gdouble, helper->plan.samples);
+	for (j = 0; j < MIN (helper->plan.channels, 3); j++) {
 		sp = cd_spectrum_new ();
 		cd_spectrum_set_id (sp, ids[j]);
 		cd_spectrum_set_start (sp, 0.f);
 		cd_spectrum_set_end (sp, helper->sample_duration);
-		for (i = 0; i < NR_DATA_POINTS; i++)
-			cd_spectrum_add_value (sp, buffer[i * 3 + j]);
-		cd_spectrum_normalize_max (sp, 1.f);
+		ch_refresh_capture_plan_decode (&helper->plan, buffer, j, values);
+		ch_refresh_normalize_max (values, helper->plan.samples, 1.f);
+		for (i = 0; i < helper->plan.samples; i++)
+			cd_spectrum_add_value (sp, values[i]);
 		cd_it8_add_spectrum (helper->priv->samples, sp);
 		cd_spectrum_free (sp);
 	}
 
+	/* the analysis needs to know how the samples were taken */
+	helper->priv->plan = helper->plan;
 }
 
 static void
@@ -231,9 +238,15 @@ ch_refresh_update_graph (ChRefreshPrivate *priv)
 	/* optionally remove pwm */
 	filter_pwm = gtk_switch_get_active (GTK_SWITCH (priv->switch_pwm));
 	for (j = 0; j < 3; j++) {
+		ChRefreshEdges edges;
+		GArray *data;
 		sp_tmp = cd_it8_get_spectrum_by_id (priv->samples, ids[j]);
 		sp_graph[j] = cd_spectrum_dup (sp_tmp);
-		if (filter_pwm && !ch_refresh_remove_pwm (sp_graph[j], &error)) {
+		data = cd_spectrum_get_data (sp_graph[j]);
+		if (filter_pwm &&
+		    (!ch_refresh_edges_from_spectrum (&edges, sp_graph[j],
+						      &priv->plan, &error) ||
+		     !ch_refresh_edges_remove_pwm (&edges, (gdouble *) data->data, &error))) {
 			/* TRANSLATORS: PWM is pulse-width-modulation? */
 			title = _("Failed to remove PWM");
 			ch_refresh_error_dialog (priv, title, error->message);
@@ -247,7 +260,7 @@ ch_refresh_update_graph (ChRefreshPrivate *priv)
 		for (j = 0; j < 3; j++) {
 			g_autoptr(GPtrArray) array = NULL;
 			array = g_ptr_array_new_with_free_func ((GDestroyNotify) egg_graph_point_free);
-			for (i = 0; i < NR_DATA_POINTS; i++) {
+			for (i = 0; i < priv->plan.samples; i++) {
 				point = egg_graph_point_new ();
 				point->x = ((gdouble) i) * cd_spectrum_get_resolution (sp_graph[j]);
 				point->y = cd_spectrum_get_value (sp_graph[j], i) * 100.f;
@@ -261,7 +274,7 @@ ch_refresh_update_graph (ChRefreshPrivate *priv)
 	} else {
 		g_autoptr(GPtrArray) array = NULL;
 		array = g_ptr_array_new_with_free_func ((GDestroyNotify) egg_graph_point_free);
-		for (i = 0; i < NR_DATA_POINTS; i++) {
+		for (i = 0; i < priv->plan.samples; i++) {
 			/* get maximum value */
 			gdouble max = 0.f;
 			for (j = 0; j < 3; j++) {
@@ -282,20 +295,20 @@ ch_refresh_update_graph (ChRefreshPrivate *priv)
 
 	/* add trigger lines */
 	if (!gtk_switch_get_active (GTK_SWITCH (priv->switch_zoom))) {
-		for (j = 1; j < NR_PULSES; j++) {
+		for (j = 1; j < priv->plan.pulses; j++) {
 			g_autoptr(GPtrArray) array = NULL;
 			array = g_ptr_array_new_with_free_func ((GDestroyNotify) egg_graph_point_free);
 
 			/* bottom */
 			point = egg_graph_point_new ();
-			point->x = ((gdouble) j) * (gdouble) NR_PULSE_GAP / 1000.f;
+			point->x = ((gdouble) j) * (gdouble) priv->plan.pulse_gap / 1000.f;
 			point->y = 0.f;
 			point->color = 0xfff000;
 			g_ptr_array_add (array, point);
 
 			/* top */
 			point = egg_graph_point_new ();
-			point->x = ((gdouble) j) * (gdouble) NR_PULSE_GAP / 1000.f;
+			point->x = ((gdouble) j) * (gdouble) priv->plan.pulse_gap / 1000.f;
 			point->y = 100.f;
 			point->color = 0xffb000;
 			g_ptr_array_add (array, point);
@@ -337,14 +350,18 @@ static void
 ch_refresh_update_ui (ChRefreshPrivate *priv)
 {
 	CdSpectrum *sp_tmp;
+	ChRefreshEdges edges;
 	GAction *action;
 	gboolean ret;
 	gboolean zoom;
 	gdouble jitter;
 	gdouble tmp;
+	gdouble uncertainty;
 	gdouble value;
 	gdouble duration;
 	GtkWidget *w;
+	g_autofree gchar *average = NULL;
+	g_autofree gchar *jitter_kind = NULL;
 	g_autoptr(GError) error = NULL;
 
 	/* enable export */
@@ -365,12 +382,12 @@ ch_refresh_update_ui (ChRefreshPrivate *priv)
 
 	/* set the graph x scale */
 	zoom = gtk_switch_get_active (GTK_SWITCH (priv->switch_zoom));
-	duration = cd_spectrum_get_resolution (sp_tmp) * (gdouble) NR_DATA_POINTS;
-	tmp = zoom ? duration / 5 : duration;
-	if (zoom) {
+	duration = cd_spectrum_get_resolution (sp_tmp) * (gdouble) priv->plan.samples;
+	tmp = zoom ? duration / priv->plan.pulses : duration;
+	if (zoom && priv->plan.pulses > 1) {
 		g_object_set (priv->graph,
 			      "start-x", ch_refresh_round_fraction (tmp),
-			      "stop-x", ch_refresh_round_fraction (tmp + (duration / 5.f)),
+			      "stop-x", ch_refresh_round_fraction (tmp * 2.f),
 			      NULL);
 	} else {
 		g_object_set (priv->graph,
@@ -379,24 +396,51 @@ ch_refresh_update_ui (ChRefreshPrivate *priv)
 			      NULL);
 	}
 
+	/* find all the edges in one pass */
+	if (!ch_refresh_edges_from_spectrum (&edges, sp_tmp, &priv->plan, &error)) {
+		ch_refresh_result_add (priv->results, "label_rise", error->message);
+		ch_refresh_result_add (priv->results, "label_fall", error->message);
+		ch_refresh_result_add (priv->results, "label_display_latency", error->message);
+		ch_refresh_update_graph (priv);
+		return;
+	}
+
+	/* the edges are only a few samples long, so interpolate them; each
+	 * value is shown with the uncertainty of the average and then the
+	 * pulse-to-pulse jitter, both from the refined edges */
+	ch_refresh_edges_refine_spectrum (&edges, sp_tmp, CH_REFRESH_INTERP_LINEAR);
+
+	/* combine the pulses the way the user asked */
+	average = g_settings_get_string (priv->settings, "refresh-average");
+	jitter_kind = g_settings_get_string (priv->settings, "refresh-jitter");
+	ch_refresh_edges_set_statistics (&edges,
+					 ch_refresh_average_from_string (average),
+					 ch_refresh_jitter_from_string (jitter_kind));
+
 	/* find rise time (10% -> 90% transition) */
-	ret = ch_refresh_get_rise (sp_tmp, &value, &jitter, &error);
+	ret = ch_refresh_edges_get_rise_fine (&edges, &value, &uncertainty, &error);
+	if (ret)
+		ret = ch_refresh_edges_get_rise (&edges, NULL, &jitter, &error);
 	if (ret) {
 		g_autofree gchar *str = NULL;
-		str = g_strdup_printf ("<b>%.0fms</b> ±%.1fms",
-				       value * 1000.f, jitter * 1000.f);
+		str = g_strdup_printf ("<b>%.2fms</b> ±%.2fms, jitter %.1fms",
+				       value * 1000.f, uncertainty * 1000.f,
+				       jitter * 1000.f);
 		ch_refresh_result_add (priv->results, "label_rise", str);
 	} else {
 		ch_refresh_result_add (priv->results, "label_rise", error->message);
 		g_clear_error (&error);
 	}
 
-	/* find rise time (10% -> 90% transition) */
-	ret = ch_refresh_get_fall (sp_tmp, &value, &jitter, &error);
+	/* find fall time (90% -> 10% transition) */
+	ret = ch_refresh_edges_get_fall_fine (&edges, &value, &uncertainty, &error);
+	if (ret)
+		ret = ch_refresh_edges_get_fall (&edges, NULL, &jitter, &error);
 	if (ret) {
 		g_autofree gchar *str = NULL;
-		str = g_strdup_printf ("<b>%.0fms</b> ±%.1fms",
-				       value * 1000.f, jitter * 1000.f);
+		str = g_strdup_printf ("<b>%.2fms</b> ±%.2fms, jitter %.1fms",
+				       value * 1000.f, uncertainty * 1000.f,
+				       jitter * 1000.f);
 		ch_refresh_result_add (priv->results, "label_fall", str);
 	} else {
 		ch_refresh_result_add (priv->results, "label_fall", error->message);
@@ -404,11 +448,14 @@ ch_refresh_update_ui (ChRefreshPrivate *priv)
 	}
 
 	/* find display latency */
-	ret = ch_refresh_get_input_latency (sp_tmp, &value, &jitter, &error);
+	ret = ch_refresh_edges_get_input_latency_fine (&edges, &value, &uncertainty, &error);
+	if (ret)
+		ret = ch_refresh_edges_get_input_latency (&edges, NULL, &jitter, &error);
 	if (ret) {
 		g_autofree gchar *str = NULL;
-		str = g_strdup_printf ("<b>%.0fms</b> ±%.1fms",
-				       value * 1000.f, jitter * 1000.f);
+		str = g_strdup_printf ("<b>%.2fms</b> ±%.2fms, jitter %.1fms",
+				       value * 1000.f, uncertainty * 1000.f,
+				       jitter * 1000.f);
 		ch_refresh_result_add (priv->results, "label_display_latency", str);
 	} else {
 		ch_refresh_result_add (priv->results, "label_display_latency", error->message);
@@ -693,7 +740,11 @@ ch_refresh_take_reading_array_cb (GObject *source, GAsyncResult *res, gpointer d
 	/* calculate how long each sample took */
 	helper->sample_duration = g_timer_elapsed (helper->measured, NULL) - helper->usb_latency;
 	g_debug ("taking sample took %.2fs", helper->sample_duration);
-	g_debug ("each sample took %.2fms", (helper->sample_duration / (gdouble) NR_DATA_POINTS) * 1000);
+	g_debug ("each sample took %.2fms", (helper->sample_duration / (gdouble) helper->plan.samples) * 1000);
+	if (!ch_refresh_capture_plan_check_window (&helper->plan,
+						   helper->sample_duration * 1000,
+						   &error))
+		g_warning ("capture too short: %s", error->message);
 
 	/* measure the color performance of the display */
 	ch_refresh_ti3_show_patch (helper);
@@ -736,10 +787,12 @@ ch_refresh_get_readings_cb (gpointer user_data)
 	guint i;
 	g_autoptr(GError) error = NULL;
 
-	/* do NR_PULSES white flashes, 350ms apart */
+	/* do the planned number of white flashes, evenly spaced */
 	g_idle_add (ch_refresh_sample_set_white_cb, helper);
-	for (i = 1; i < NR_PULSES; i++)
-		g_timeout_add (NR_PULSE_GAP * i, ch_refresh_sample_set_white_cb, helper);
+	for (i = 1; i < helper->plan.pulses; i++) {
+		g_timeout_add (helper->plan.pulse_gap * i,
+			       ch_refresh_sample_set_white_cb, helper);
+	}
 
 	/* start taking a reading */
 	g_timer_reset (helper->measured);
@@ -890,10 +943,25 @@ ch_refresh_colord_find_device_cb (GObject *source, GAsyncResult *res, gpointer u
 static void
 ch_refresh_refresh_button_cb (GtkWidget *widget, ChRefreshPrivate *priv)
 {
+	ChRefreshCapturePlan plan;
 	ChRefreshMeasureHelper *helper;
+	const gchar *title;
+	g_autoptr(GError) error = NULL;
+
+	/* the samples and channels are fixed by the firmware */
+	ch_refresh_capture_plan_init (&plan);
+	plan.pulses = g_settings_get_uint (priv->settings, "capture-pulses");
+	plan.pulse_gap = g_settings_get_uint (priv->settings, "capture-pulse-gap");
+	if (!ch_refresh_capture_plan_check (&plan, &error)) {
+		/* TRANSLATORS: the pulse count or gap in the settings is wrong */
+		title = _("Invalid capture settings");
+		ch_refresh_error_dialog (priv, title, error->message);
+		return;
+	}
 
 	/* get the display name for the current window */
 	helper = g_new0 (ChRefreshMeasureHelper, 1);
+	helper->plan = plan;
 	helper->cancellable = g_cancellable_new ();
 	helper->measured = g_timer_new ();
 	helper->priv = priv;
@@ -1070,6 +1138,18 @@ ch_refresh_zoom_changed_cb (GObject *object, GParamSpec *pspec, ChRefreshPrivate
 	ch_refresh_update_ui (priv);
 }
 
+static void
+ch_refresh_statistics_changed_cb (GSettings *settings,
+				  const gchar *key,
+				  ChRefreshPrivate *priv)
+{
+	/* nothing measured yet */
+	if (cd_it8_get_spectrum_by_id (priv->samples, "Y") == NULL)
+		return;
+	ch_refresh_update_ui (priv);
+	ch_refresh_update_labels_from_results (priv->builder, priv->results);
+}
+
 static void
 ch_refresh_update_ui_for_device (ChRefreshPrivate *priv)
 {
@@ -1386,6 +1466,7 @@ main (int argc, char **argv)
 
 	priv = g_new0 (ChRefreshPrivate, 1);
 	priv->settings = g_settings_new ("com.hughski.ColorHug.DisplayAnalysis");
+	ch_refresh_capture_plan_init (&priv->plan);
 	priv->usb_ctx = g_usb_context_new (NULL);
 	priv->client = cd_client_new ();
 	priv->results = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
@@ -1428,6 +1509,10 @@ main (int argc, char **argv)
 	g_settings_bind (priv->settings, "graph-pwm-fixup",
 			 priv->switch_pwm, "active",
 			 G_SETTINGS_BIND_DEFAULT);
+	g_signal_connect (priv->settings, "changed::refresh-average",
+			  G_CALLBACK (ch_refresh_statistics_changed_cb), priv);
+	g_signal_connect (priv->settings, "changed::refresh-jitter",
+			  G_CALLBACK (ch_refresh_statistics_changed_cb), priv);
 
 	/* ensure single instance */
 	priv->application = gtk_application_new ("com.hughski.ColorHug.DisplayAnalysis", 0);
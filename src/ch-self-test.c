@@ -25,8 +25,10 @@
 #include <glib-object.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ch-refresh-utils.h"
+#include "ch-stats.h"
 
 static gchar *
 cd_test_get_filename (const gchar *filename)
@@ -149,6 +151,737 @@ ch_test_refresh_pwm_func (void)
 	}
 }
 
+static void
+ch_test_refresh_edges_func (void)
+{
+	ChRefreshEdges edges;
+	gboolean ret;
+	gdouble data[NR_PULSES * 100];
+	gdouble jitter = -1.f;
+	gdouble value = -1.f;
+	guint i;
+	guint j;
+	g_autoptr(GError) error = NULL;
+
+	/* five identical pulses with a 4 sample rise and 2 sample fall */
+	for (j = 0; j < NR_PULSES; j++) {
+		for (i = 0; i < 100; i++) {
+			gdouble tmp = 0.f;
+			if (i >= 20 && i < 24)
+				tmp = (i - 19) * 0.2f;
+			else if (i >= 24 && i < 70)
+				tmp = 1.f;
+			else if (i == 70)
+				tmp = 0.5f;
+			data[j * 100 + i] = tmp;
+		}
+	}
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), NR_PULSES, 100.f, 1.f, 0.01f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (j = 0; j < NR_PULSES; j++) {
+		g_assert_cmpint (edges.rise[j], ==, 4);
+		g_assert_cmpint (edges.fall[j], ==, 2);
+		g_assert_cmpint (edges.latency[j], ==, 20);
+		g_assert_cmpint (edges.pwm_start[j], ==, j * 100 + 20);
+		g_assert_cmpint (edges.pwm_end[j], ==, j * 100 + 69);
+	}
+	ret = ch_refresh_edges_get_rise (&edges, &value, &jitter, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (value - 0.04f), <, 0.0001f);
+	g_assert_cmpfloat (jitter, <, 0.0001f);
+	ret = ch_refresh_edges_get_input_latency (&edges, &value, &jitter, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (value - 0.2f), <, 0.0001f);
+
+	/* a missing pulse is reported */
+	for (i = 300; i < 400; i++)
+		data[i] = 0.f;
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), NR_PULSES, 100.f, 1.f, 0.01f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = ch_refresh_edges_get_fall (&edges, &value, &jitter, &error);
+	g_assert_error (error, 1, 0);
+	g_assert_cmpstr (error->message, ==, "No edge on pulse 4");
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* too short */
+	ret = ch_refresh_edges_scan (&edges, data, NR_PULSES - 1, NR_PULSES, 100.f, 1.f, 0.01f, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+}
+
+static void
+ch_test_refresh_capture_plan_func (void)
+{
+	ChRefreshCapturePlan plan;
+	ChRefreshEdges edges;
+	gboolean ret;
+	gdouble data[20 * 25];
+	gdouble value = -1.f;
+	guint16 sram[] = { 1, 10, 100, 2, 20, 200, 3, 30, 300 };
+	guint i;
+	guint j;
+	g_autoptr(GError) error = NULL;
+
+	/* the default plan fits */
+	ch_refresh_capture_plan_init (&plan);
+	g_assert_cmpint (plan.samples, ==, NR_DATA_POINTS);
+	g_assert_cmpint (plan.pulses, ==, NR_PULSES);
+	g_assert_cmpint (plan.pulse_gap, ==, NR_PULSE_GAP);
+	ret = ch_refresh_capture_plan_check (&plan, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the last flash needs half a gap of dark after it */
+	ret = ch_refresh_capture_plan_check_window (&plan, 1990.f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = ch_refresh_capture_plan_check_window (&plan, 1700.f, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* too many pulses */
+	plan.pulses = NR_PULSES_MAX + 1;
+	ret = ch_refresh_capture_plan_check (&plan, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* the flashes outlast the capture */
+	plan.pulses = NR_PULSES_MAX;
+	plan.pulse_gap = 2000;
+	ret = ch_refresh_capture_plan_check (&plan, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* too many samples */
+	ch_refresh_capture_plan_init (&plan);
+	plan.channels = 4;
+	ret = ch_refresh_capture_plan_check (&plan, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* one channel out of the interleaved readings */
+	plan.samples = 3;
+	plan.channels = 3;
+	ch_refresh_capture_plan_decode (&plan, sram, 1, data);
+	g_assert_cmpfloat (data[0], ==, 10.f);
+	g_assert_cmpfloat (data[1], ==, 20.f);
+	g_assert_cmpfloat (data[2], ==, 30.f);
+
+	/* twenty short pulses with a 2 sample rise */
+	for (j = 0; j < 20; j++) {
+		for (i = 0; i < 25; i++) {
+			gdouble tmp = 0.f;
+			if (i == 5)
+				tmp = 0.5f;
+			else if (i >= 6 && i < 15)
+				tmp = 1.f;
+			data[j * 25 + i] = tmp;
+		}
+	}
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), 20, 25.f, 1.f, 0.01f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (edges.pulses, ==, 20);
+	g_assert_cmpint (edges.rise[19], ==, 1);
+	g_assert_cmpint (edges.fall[19], ==, 1);
+	ret = ch_refresh_edges_get_input_latency (&edges, &value, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (value - 0.05f), <, 0.0001f);
+
+	/* no pulses at all */
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), 0, 25.f, 1.f, 0.01f, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* two pulses a second apart, leaving three seconds spare */
+	ch_refresh_capture_plan_init (&plan);
+	plan.samples = G_N_ELEMENTS (data);
+	plan.sample_time = 10.f;
+	plan.pulses = 2;
+	plan.pulse_gap = 1000;
+	ret = ch_refresh_capture_plan_check (&plan, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (i = 0; i < G_N_ELEMENTS (data); i++)
+		data[i] = i < 200 && i % 100 >= 20 && i % 100 < 70 ? 1.f : 0.f;
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), plan.pulses,
+				     ch_refresh_capture_plan_get_pulse_len (&plan, 0.01f),
+				     1.f, 0.01f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (edges.window_start[1], ==, 100);
+	g_assert_cmpint (edges.window_end[1], ==, 200);
+	ret = ch_refresh_edges_get_input_latency (&edges, &value, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (value - 0.2f), <, 0.0001f);
+
+	/* splitting the whole capture misses the second pulse */
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), plan.pulses,
+				     G_N_ELEMENTS (data) / plan.pulses,
+				     1.f, 0.01f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = ch_refresh_edges_get_input_latency (&edges, &value, NULL, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* the last pulse starts after the end of the capture */
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), 6, 100.f,
+				     1.f, 0.01f, &error);
+	g_assert_error (error, 1, 0);
+	g_assert (!ret);
+}
+
+static void
+ch_test_refresh_statistics_func (void)
+{
+	ChRefreshEdges edges;
+	const guint latency[] = { 22, 20, 60, 21, 23 };
+	gboolean ret;
+	gdouble data[NR_PULSES * 100];
+	gdouble jitter = -1.f;
+	gdouble value = -1.f;
+	guint i;
+	guint j;
+	g_autoptr(GError) error = NULL;
+
+	/* five pulses, one of them very late */
+	for (j = 0; j < NR_PULSES; j++) {
+		for (i = 0; i < 100; i++)
+			data[j * 100 + i] = i >= latency[j] && i < 70 ? 1.f : 0.f;
+	}
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), NR_PULSES, 100.f, 1.f, 0.01f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the mean drops the fastest and slowest pulse */
+	ret = ch_refresh_edges_get_input_latency (&edges, &value, &jitter, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (value - 0.22f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (jitter - 0.01f), <, 0.0001f);
+
+	/* the median uses every pulse */
+	ch_refresh_edges_set_statistics (&edges,
+					 ch_refresh_average_from_string ("median"),
+					 ch_refresh_jitter_from_string ("std-dev"));
+	ret = ch_refresh_edges_get_input_latency (&edges, &value, &jitter, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (value - 0.22f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (jitter - 0.172540f), <, 0.0001f);
+
+	/* the trimmed mean and the percentile range */
+	ch_refresh_edges_set_statistics (&edges,
+					 CH_REFRESH_AVERAGE_TRIMMED_MEAN,
+					 CH_REFRESH_JITTER_PERCENTILE);
+	ret = ch_refresh_edges_get_input_latency (&edges, &value, &jitter, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (fabs (value - 0.22f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (jitter - 0.162f), <, 0.0001f);
+
+	/* unknown names fall back to the defaults */
+	g_assert_cmpint (ch_refresh_average_from_string ("mode"), ==, CH_REFRESH_AVERAGE_MEAN);
+	g_assert_cmpint (ch_refresh_jitter_from_string (NULL), ==, CH_REFRESH_JITTER_MAX_DEVIATION);
+}
+
+/* the per-function edge search as it was before the single pass scanner,
+ * kept here to check the scanner against and to time it */
+static gboolean
+ch_test_refresh_reduce (CdSpectrum *sp, gdouble *pulse_data, gboolean trim,
+			gdouble *value, gdouble *jitter, GError **error)
+{
+	gdouble tmp;
+	guint i;
+	guint j;
+
+	/* check values */
+	for (j = 0; j < NR_PULSES; j++) {
+		if (pulse_data[j] < 0.f) {
+			g_set_error (error, 1, 0, "No edge on pulse %i", j + 1);
+			return FALSE;
+		}
+	}
+
+	/* multiply by the resolution */
+	for (j = 0; j < NR_PULSES; j++)
+		pulse_data[j] *= cd_spectrum_get_resolution (sp);
+
+	/* drop the fastest and slowest pulse */
+	if (trim) {
+		for (i = 1; i < NR_PULSES; i++) {
+			for (j = i; j > 0 && pulse_data[j - 1] > pulse_data[j]; j--) {
+				tmp = pulse_data[j];
+				pulse_data[j] = pulse_data[j - 1];
+				pulse_data[j - 1] = tmp;
+			}
+		}
+		pulse_data++;
+	}
+	if (value != NULL)
+		*value = ch_refresh_calc_average (pulse_data, trim ? NR_PULSES - 2 : NR_PULSES);
+	if (jitter != NULL)
+		*jitter = ch_refresh_calc_jitter (pulse_data, trim ? NR_PULSES - 2 : NR_PULSES);
+	return TRUE;
+}
+
+static gboolean
+ch_test_refresh_get_rise (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+{
+	gdouble pulse_data[NR_PULSES];
+	gdouble tmp;
+	guint i;
+	guint idx_start;
+	guint j;
+	guint size;
+
+	size = cd_spectrum_get_size (sp) / NR_PULSES;
+	for (j = 0; j < NR_PULSES; j++) {
+		pulse_data[j] = -1.f;
+		idx_start = 0;
+		for (i = j * size; i < (j + 1) * size; i++) {
+			tmp = cd_spectrum_get_value (sp, i);
+
+			/* first time > 10% */
+			if (tmp > 0.1 && idx_start == 0) {
+				idx_start = i;
+				continue;
+			}
+
+			/* first time > 90% */
+			if (tmp > 0.9 && idx_start > 0) {
+				pulse_data[j] = i - idx_start;
+				break;
+			}
+		}
+	}
+	return ch_test_refresh_reduce (sp, pulse_data, FALSE, value, jitter, error);
+}
+
+static gboolean
+ch_test_refresh_get_fall (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+{
+	gdouble pulse_data[NR_PULSES];
+	gdouble tmp;
+	guint i;
+	guint idx_start;
+	guint j;
+	guint size;
+
+	size = cd_spectrum_get_size (sp) / NR_PULSES;
+	for (j = 0; j < NR_PULSES; j++) {
+		pulse_data[j] = -1.f;
+		idx_start = 0;
+		for (i = j * size; i < (j + 1) * size; i++) {
+			tmp = cd_spectrum_get_value (sp, i);
+
+			/* last time > 90% */
+			if (tmp > 0.9) {
+				idx_start = i;
+				continue;
+			}
+
+			/* last time > 10% */
+			if (tmp < 0.1 && idx_start > 0) {
+				pulse_data[j] = i - idx_start;
+				idx_start = 0;
+			}
+		}
+	}
+	return ch_test_refresh_reduce (sp, pulse_data, FALSE, value, jitter, error);
+}
+
+static gboolean
+ch_test_refresh_get_input_latency (CdSpectrum *sp, gdouble *value, gdouble *jitter, GError **error)
+{
+	gdouble pulse_data[NR_PULSES];
+	guint i;
+	guint j;
+	guint size;
+
+	size = cd_spectrum_get_size (sp) / NR_PULSES;
+	for (j = 0; j < NR_PULSES; j++) {
+		pulse_data[j] = -1.f;
+		for (i = j * size; i < (j + 1) * size; i++) {
+
+			/* first time > 10% */
+			if (cd_spectrum_get_value (sp, i) > 0.1f) {
+				pulse_data[j] = i - (j * size);
+				break;
+			}
+		}
+	}
+	return ch_test_refresh_reduce (sp, pulse_data, TRUE, value, jitter, error);
+}
+
+static CdIt8 *
+ch_test_refresh_load (const gchar *basename)
+{
+	CdIt8 *samples;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	samples = cd_it8_new ();
+	filename = cd_test_get_filename (basename);
+	g_assert (filename != NULL);
+	file = g_file_new_for_path (filename);
+	g_assert (cd_it8_load_from_file (samples, file, &error));
+	g_assert_no_error (error);
+	return samples;
+}
+
+static const gchar *ch_test_refresh_captures[] = { "eco-off.ccss", "eco1.ccss",
+						   "eco2.ccss", "lenovo.ccss", NULL };
+
+static void
+ch_test_refresh_edges_compat_func (void)
+{
+	gboolean ret;
+	gboolean ret_ref;
+	gdouble jitter;
+	gdouble jitter_ref;
+	gdouble value;
+	gdouble value_ref;
+	guint i;
+
+	for (i = 0; ch_test_refresh_captures[i] != NULL; i++) {
+		CdSpectrum *sp;
+		g_autoptr(CdIt8) samples = NULL;
+
+		samples = ch_test_refresh_load (ch_test_refresh_captures[i]);
+		sp = cd_it8_get_spectrum_by_id (samples, "Y");
+		cd_spectrum_normalize_max (sp, 1.f);
+
+		/* the scanner finds exactly the same edges */
+		ret_ref = ch_test_refresh_get_rise (sp, &value_ref, &jitter_ref, NULL);
+		ret = ch_refresh_get_rise (sp, &value, &jitter, NULL);
+		g_assert_cmpint (ret, ==, ret_ref);
+		if (ret) {
+			g_assert_cmpfloat (value, ==, value_ref);
+			g_assert_cmpfloat (jitter, ==, jitter_ref);
+		}
+		ret_ref = ch_test_refresh_get_fall (sp, &value_ref, &jitter_ref, NULL);
+		ret = ch_refresh_get_fall (sp, &value, &jitter, NULL);
+		g_assert_cmpint (ret, ==, ret_ref);
+		if (ret) {
+			g_assert_cmpfloat (value, ==, value_ref);
+			g_assert_cmpfloat (jitter, ==, jitter_ref);
+		}
+		ret_ref = ch_test_refresh_get_input_latency (sp, &value_ref, &jitter_ref, NULL);
+		ret = ch_refresh_get_input_latency (sp, &value, &jitter, NULL);
+		g_assert_cmpint (ret, ==, ret_ref);
+		if (ret) {
+			g_assert_cmpfloat (value, ==, value_ref);
+			g_assert_cmpfloat (jitter, ==, jitter_ref);
+		}
+	}
+}
+
+static void
+ch_test_refresh_edges_perf_func (void)
+{
+	const guint loops = 10000;
+	gdouble elapsed_edges = 0.f;
+	gdouble elapsed_ref = 0.f;
+	gdouble jitter;
+	gdouble value;
+	guint i;
+	guint j;
+	g_autoptr(GTimer) timer = g_timer_new ();
+
+	if (!g_test_perf ())
+		return;
+
+	for (i = 0; ch_test_refresh_captures[i] != NULL; i++) {
+		ChRefreshEdges edges;
+		CdSpectrum *sp;
+		GArray *raw;
+		g_autoptr(CdIt8) samples = NULL;
+
+		samples = ch_test_refresh_load (ch_test_refresh_captures[i]);
+		sp = cd_it8_get_spectrum_by_id (samples, "Y");
+		cd_spectrum_normalize_max (sp, 1.f);
+		raw = cd_spectrum_get_data (sp);
+
+		/* one walk for each result */
+		g_timer_reset (timer);
+		for (j = 0; j < loops; j++) {
+			ch_test_refresh_get_rise (sp, &value, &jitter, NULL);
+			ch_test_refresh_get_fall (sp, &value, &jitter, NULL);
+			ch_test_refresh_get_input_latency (sp, &value, &jitter, NULL);
+		}
+		elapsed_ref += g_timer_elapsed (timer, NULL);
+
+		/* one walk for everything */
+		g_timer_reset (timer);
+		for (j = 0; j < loops; j++) {
+			ch_refresh_edges_scan (&edges, (const gdouble *) raw->data,
+					       raw->len, NR_PULSES, raw->len / NR_PULSES,
+					       cd_spectrum_get_norm (sp),
+					       cd_spectrum_get_resolution (sp), NULL);
+			ch_refresh_edges_get_rise (&edges, &value, &jitter, NULL);
+			ch_refresh_edges_get_fall (&edges, &value, &jitter, NULL);
+			ch_refresh_edges_get_input_latency (&edges, &value, &jitter, NULL);
+		}
+		elapsed_edges += g_timer_elapsed (timer, NULL);
+	}
+	g_test_message ("separate: %.2fus per capture", elapsed_ref * 1e6 / (loops * i));
+	g_test_minimized_result (elapsed_edges * 1e6 / (loops * i),
+				 "single pass: %.2fus per capture",
+				 elapsed_edges * 1e6 / (loops * i));
+}
+
+static void
+ch_test_refresh_interp_func (void)
+{
+	ChRefreshEdges edges;
+	gboolean ret;
+	gdouble data[NR_PULSES * 100];
+	gdouble uncertainty = -1.f;
+	gdouble value = -1.f;
+	guint i;
+	guint j;
+	g_autoptr(GError) error = NULL;
+
+	/* ramps 20 samples long, so both edges are 16 samples between the
+	 * 10% and 90% points and the rise starts at 22.3 */
+	for (j = 0; j < NR_PULSES; j++) {
+		for (i = 0; i < 100; i++) {
+			gdouble tmp = MIN ((i - 20.3f) / 20.f, 1.f);
+			tmp = MIN (tmp, (80.6f - i) / 20.f);
+			data[j * 100 + i] = MAX (tmp, 0.f);
+		}
+	}
+	ret = ch_refresh_edges_scan (&edges, data, G_N_ELEMENTS (data), NR_PULSES, 100.f, 1.f, 1.f, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* whole samples are quantized */
+	ch_refresh_edges_refine (&edges, data, 1.f, CH_REFRESH_INTERP_NONE);
+	ret = ch_refresh_edges_get_rise_fine (&edges, &value, &uncertainty, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (value, ==, 16.f);
+	g_assert_cmpfloat (fabs (uncertainty - 1.f / sqrt (12.f * NR_PULSES)), <, 0.0001f);
+	ret = ch_refresh_edges_get_fall_fine (&edges, &value, &uncertainty, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (value, ==, 17.f);
+
+	/* a linear ramp is recovered exactly */
+	for (i = CH_REFRESH_INTERP_LINEAR; i < CH_REFRESH_INTERP_LAST; i++) {
+		ch_refresh_edges_refine (&edges, data, 1.f, i);
+		ret = ch_refresh_edges_get_rise_fine (&edges, &value, &uncertainty, &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+		g_assert_cmpfloat (fabs (value - 16.f), <, 0.0001f);
+		g_assert_cmpfloat (uncertainty, <, 0.0001f);
+		ret = ch_refresh_edges_get_fall_fine (&edges, &value, &uncertainty, &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+		g_assert_cmpfloat (fabs (value - 16.f), <, 0.0001f);
+		ret = ch_refresh_edges_get_input_latency_fine (&edges, &value, &uncertainty, &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+		g_assert_cmpfloat (fabs (value - 22.3f), <, 0.0001f);
+	}
+}
+
+/* plain versions of the vectorised kernels to check them against */
+static guint
+ch_test_find_above (const gdouble *data, guint start, guint end,
+		    gdouble scale, gdouble threshold)
+{
+	guint i;
+	for (i = start; i < end; i++) {
+		if (data[i] * scale > threshold)
+			return i;
+	}
+	return end;
+}
+
+static guint
+ch_test_find_below (const gdouble *data, guint start, guint end,
+		    gdouble scale, gdouble threshold)
+{
+	guint i;
+	for (i = start; i < end; i++) {
+		if (data[i] * scale < threshold)
+			return i;
+	}
+	return end;
+}
+
+static guint
+ch_test_find_last_above (const gdouble *data, guint start, guint end,
+			 gdouble scale, gdouble threshold)
+{
+	guint i;
+	for (i = end; i > start; i--) {
+		if (data[i - 1] * scale > threshold)
+			return i - 1;
+	}
+	return end;
+}
+
+static void
+ch_test_fill_envelope (gdouble *data, guint start, guint end)
+{
+	gboolean fix_idx = 0;
+	gdouble old_value = -1.f;
+	gdouble tmp;
+	guint i;
+
+	for (i = start; i < end; i++) {
+		tmp = start + ((gdouble) (end - start) * 0.9f);
+		if (fix_idx == 0 && i > tmp)
+			break;
+		tmp = data[i];
+		if (tmp < old_value * 0.95f) {
+			data[i] = old_value;
+			fix_idx = i;
+			continue;
+		}
+		old_value = tmp * 0.99f;
+	}
+}
+
+static void
+ch_test_refresh_kernels_func (void)
+{
+	const gdouble thresholds[] = { 0.1f, 0.5f, 0.9f, 0.1, 0.9 };
+	gdouble data[64];
+	gdouble data_tmp[64];
+	gdouble max;
+	guint i;
+	guint j;
+	guint k;
+	guint len;
+	guint start;
+	g_autoptr(GRand) rand = g_rand_new_with_seed (0x1234);
+
+	for (k = 0; k < 2000; k++) {
+		gdouble scale = k % 3 == 0 ? 1.f : g_rand_double_range (rand, 0.5f, 2.f);
+
+		/* a noisy pulse at a random offset and length */
+		len = g_rand_int_range (rand, 0, G_N_ELEMENTS (data) + 1);
+		start = len > 0 ? g_rand_int_range (rand, 0, len + 1) : 0;
+		for (i = 0; i < len; i++)
+			data[i] = g_rand_double (rand);
+
+		/* every search gives exactly the same index */
+		for (j = 0; j < G_N_ELEMENTS (thresholds); j++) {
+			g_assert_cmpint (ch_refresh_find_above (data, start, len, scale, thresholds[j]), ==,
+					 ch_test_find_above (data, start, len, scale, thresholds[j]));
+			g_assert_cmpint (ch_refresh_find_below (data, start, len, scale, thresholds[j]), ==,
+					 ch_test_find_below (data, start, len, scale, thresholds[j]));
+			g_assert_cmpint (ch_refresh_find_last_above (data, start, len, scale, thresholds[j]), ==,
+					 ch_test_find_last_above (data, start, len, scale, thresholds[j]));
+		}
+
+		/* the fill matches bit-for-bit */
+		memcpy (data_tmp, data, sizeof (data));
+		ch_refresh_fill_envelope (data, start, len);
+		ch_test_fill_envelope (data_tmp, start, len);
+		g_assert (memcmp (data, data_tmp, len * sizeof (gdouble)) == 0);
+
+		/* as does the normalization */
+		max = 0.f;
+		for (i = 0; i < len; i++)
+			max = MAX (max, data[i]);
+		memcpy (data_tmp, data, sizeof (data));
+		ch_refresh_normalize_max (data, len, 1.f);
+		for (i = 0; i < len; i++)
+			g_assert_cmpfloat (data[i], ==, data_tmp[i] * (1.f / max));
+	}
+}
+
+static void
+ch_test_stats_func (void)
+{
+	ChStatsSummary summary;
+	ChStatsWelford w = { 0, 0.f, 0.f };
+	const gdouble data[] = { 1.f, 2.f, 3.f, 4.f, 100.f };
+	gdouble kept[5];
+	gdouble wave[1000];
+	guint i;
+	guint len;
+
+	/* basic moments */
+	g_assert_cmpfloat (fabs (ch_stats_mean (data, 5) - 22.f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_std_dev (data, 5) - 43.6177f), <, 0.0001f);
+	g_assert_cmpfloat (ch_stats_mean (data, 0), ==, 0.f);
+
+	/* percentiles interpolate between ranks */
+	g_assert_cmpfloat (fabs (ch_stats_median (data, 5) - 3.f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_percentile (data, 5, 25.f) - 2.f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_percentile (data, 5, 95.f) - 80.8f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_percentile_sorted (data, 5, 95.f) - 80.8f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_mad (data, 5) - 1.f), <, 0.0001f);
+
+	/* selection leaves the smaller values first */
+	memcpy (kept, data, sizeof (kept));
+	kept[0] = 100.f;
+	kept[4] = 1.f;
+	g_assert_cmpfloat (ch_stats_select (kept, 5, 1), ==, 2.f);
+	g_assert_cmpfloat (MAX (kept[0], kept[1]), ==, 2.f);
+	g_assert_cmpfloat (MIN (kept[2], MIN (kept[3], kept[4])), >=, 3.f);
+
+	/* robust alternatives to the mean and the largest deviation */
+	g_assert_cmpfloat (fabs (ch_stats_trimmed_mean (data, 5, 0.2f) - 3.f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_trimmed_mean (data, 5, 0.f) - 22.f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_trimmed_mean (data, 2, 0.5f) - 1.5f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (ch_stats_percentile_jitter (data, 5, 95.f) - 39.8f), <, 0.0001f);
+
+	/* the spike is rejected */
+	len = ch_stats_reject_outliers (data, 5, 3.f, kept);
+	g_assert_cmpint (len, ==, 4);
+	g_assert_cmpfloat (kept[3], ==, 4.f);
+
+	/* welford agrees with the two-pass version */
+	for (i = 0; i < 5; i++)
+		ch_stats_welford_add (&w, data[i]);
+	g_assert_cmpfloat (fabs (w.mean - 22.f), <, 0.0001f);
+	g_assert_cmpfloat (fabs (sqrt (ch_stats_welford_get_variance (&w)) -
+				 ch_stats_std_dev (data, 5)), <, 0.0001f);
+
+	/* few samples need the wider t interval */
+	memset (&w, 0, sizeof (w));
+	for (i = 0; i < 3; i++)
+		ch_stats_welford_add (&w, data[i]);
+	g_assert_cmpfloat (fabs (ch_stats_welford_get_ci95 (&w) - 2.4843f), <, 0.0001f);
+
+	/* 50Hz with a little noise, sampled at 1kHz */
+	for (i = 0; i < 1000; i++) {
+		wave[i] = sin (2 * G_PI * 50 * i / 1000.f) +
+			  0.1f * (((i * 7919) % 13) / 13.f - 0.5f);
+	}
+	g_assert_cmpfloat (fabs (ch_stats_flicker_frequency (wave, 1000, 1000.f) - 50.f), <, 0.1f);
+	g_assert_cmpfloat (ch_stats_flicker_frequency (data, 1, 1000.f), ==, 0.f);
+
+	/* summary ignores the outlier for the moments only */
+	ch_stats_summary_init (&summary, data, 5, 3.f);
+	g_assert_cmpint (summary.outliers, ==, 1);
+	g_assert_cmpfloat (fabs (summary.mean - 2.5f), <, 0.0001f);
+	g_assert_cmpfloat (summary.max, ==, 100.f);
+	g_assert_cmpfloat (summary.mad, ==, 1.f);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -160,6 +893,14 @@ main (int argc, char **argv)
 	/* tests go here */
 	g_test_add_func ("/ChClient/refresh{smooth}", ch_test_refresh_smooth_func);
 	g_test_add_func ("/ChClient/refresh{pwm}", ch_test_refresh_pwm_func);
+	g_test_add_func ("/ChClient/refresh{edges}", ch_test_refresh_edges_func);
+	g_test_add_func ("/ChClient/refresh{edges-compat}", ch_test_refresh_edges_compat_func);
+	g_test_add_func ("/ChClient/refresh{edges-perf}", ch_test_refresh_edges_perf_func);
+	g_test_add_func ("/ChClient/refresh{kernels}", ch_test_refresh_kernels_func);
+	g_test_add_func ("/ChClient/refresh{interp}", ch_test_refresh_interp_func);
+	g_test_add_func ("/ChClient/refresh{capture-plan}", ch_test_refresh_capture_plan_func);
+	g_test_add_func ("/ChClient/refresh{statistics}", ch_test_refresh_statistics_func);
+	g_test_add_func ("/ChClient/stats", ch_test_stats_func);
 
 	return g_test_run ();
 }
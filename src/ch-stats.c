@@ -0,0 +1,397 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ch-stats.h"
+
+gdouble
+ch_stats_mean (const gdouble *data, guint data_len)
+{
+	gdouble tmp = 0.f;
+	guint i;
+	if (data_len == 0)
+		return 0.f;
+	for (i = 0; i < data_len; i++)
+		tmp += data[i];
+	return tmp / (gdouble) data_len;
+}
+
+/* sample standard deviation, i.e. divided by N-1 */
+gdouble
+ch_stats_std_dev (const gdouble *data, guint data_len)
+{
+	gdouble mean;
+	gdouble tmp = 0.f;
+	guint i;
+	if (data_len < 2)
+		return 0.f;
+	mean = ch_stats_mean (data, data_len);
+	for (i = 0; i < data_len; i++)
+		tmp += pow (data[i] - mean, 2);
+	return sqrt (tmp / (data_len - 1));
+}
+
+static gint
+ch_stats_compare_doubles (gconstpointer a, gconstpointer b)
+{
+	gdouble da = *((const gdouble *) a);
+	gdouble db = *((const gdouble *) b);
+	if (da < db)
+		return -1;
+	if (da > db)
+		return 1;
+	return 0;
+}
+
+void
+ch_stats_sort (gdouble *data, guint data_len)
+{
+	qsort (data, data_len, sizeof (gdouble), ch_stats_compare_doubles);
+}
+
+static gdouble *
+ch_stats_sorted_copy (const gdouble *data, guint data_len)
+{
+	gdouble *sorted = g_memdup (data, data_len * sizeof (gdouble));
+	ch_stats_sort (sorted, data_len);
+	return sorted;
+}
+
+/**
+ * ch_stats_select:
+ *
+ * Finds the @k'th smallest value in linear time on average, reordering
+ * @data so that nothing before @k is larger and nothing after is smaller.
+ *
+ * Returns: the value, which is also left in data[@k]
+ **/
+gdouble
+ch_stats_select (gdouble *data, guint data_len, guint k)
+{
+	gdouble pivot;
+	gdouble tmp;
+	gint hi = (gint) data_len - 1;
+	gint i;
+	gint j;
+	gint lo = 0;
+
+	/* Hoare partition around the middle value until only @k is left */
+	while (lo < hi) {
+		pivot = data[lo + (hi - lo) / 2];
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (data[i] < pivot)
+				i++;
+			while (data[j] > pivot)
+				j--;
+			if (i <= j) {
+				tmp = data[i];
+				data[i++] = data[j];
+				data[j--] = tmp;
+			}
+		}
+		if ((gint) k <= j)
+			hi = j;
+		else if ((gint) k >= i)
+			lo = i;
+		else
+			break;
+	}
+	return data[k];
+}
+
+/**
+ * ch_stats_percentile_sorted:
+ *
+ * Like ch_stats_percentile() but for data that is already sorted, so many
+ * percentiles can be read from one sort. This interpolates linearly
+ * between the closest ranks.
+ **/
+gdouble
+ch_stats_percentile_sorted (const gdouble *sorted, guint data_len, gdouble percentile)
+{
+	gdouble rank;
+	guint idx;
+	if (data_len == 0)
+		return 0.f;
+	rank = CLAMP (percentile, 0.f, 100.f) / 100.f * (data_len - 1);
+	idx = (guint) floor (rank);
+	if (idx + 1 >= data_len)
+		return sorted[data_len - 1];
+	return sorted[idx] + (rank - idx) * (sorted[idx + 1] - sorted[idx]);
+}
+
+gdouble
+ch_stats_percentile (const gdouble *data, guint data_len, gdouble percentile)
+{
+	gdouble lower;
+	gdouble rank;
+	gdouble upper;
+	guint i;
+	guint idx;
+	g_autofree gdouble *tmp = NULL;
+
+	if (data_len == 0)
+		return 0.f;
+
+	/* only the two closest ranks are needed, not a full sort */
+	rank = CLAMP (percentile, 0.f, 100.f) / 100.f * (data_len - 1);
+	idx = (guint) floor (rank);
+	tmp = g_memdup (data, data_len * sizeof (gdouble));
+	lower = ch_stats_select (tmp, data_len, idx);
+	if (idx + 1 >= data_len)
+		return lower;
+	upper = tmp[idx + 1];
+	for (i = idx + 2; i < data_len; i++) {
+		if (tmp[i] < upper)
+			upper = tmp[i];
+	}
+	return lower + (rank - idx) * (upper - lower);
+}
+
+gdouble
+ch_stats_median (const gdouble *data, guint data_len)
+{
+	return ch_stats_percentile (data, data_len, 50.f);
+}
+
+/* mean of what is left after dropping @fraction of the samples from each
+ * end, so 0.2 of five samples ignores the smallest and the largest */
+gdouble
+ch_stats_trimmed_mean (const gdouble *data, guint data_len, gdouble fraction)
+{
+	guint trim;
+	g_autofree gdouble *sorted = NULL;
+
+	if (data_len == 0)
+		return 0.f;
+	trim = (guint) floor (data_len * CLAMP (fraction, 0.f, 0.5f));
+	if (trim * 2 >= data_len)
+		return ch_stats_median (data, data_len);
+	sorted = ch_stats_sorted_copy (data, data_len);
+	return ch_stats_mean (sorted + trim, data_len - trim * 2);
+}
+
+/* half the range between the @percentile and the 100-@percentile values,
+ * which unlike the largest deviation does not grow with the sample count */
+gdouble
+ch_stats_percentile_jitter (const gdouble *data, guint data_len, gdouble percentile)
+{
+	gdouble hi;
+	gdouble lo;
+	hi = ch_stats_percentile (data, data_len, percentile);
+	lo = ch_stats_percentile (data, data_len, 100.f - percentile);
+	return fabs (hi - lo) / 2.f;
+}
+
+/* median absolute deviation from the median */
+gdouble
+ch_stats_mad (const gdouble *data, guint data_len)
+{
+	gdouble median;
+	guint i;
+	g_autofree gdouble *dev = NULL;
+	if (data_len == 0)
+		return 0.f;
+	median = ch_stats_median (data, data_len);
+	dev = g_new (gdouble, data_len);
+	for (i = 0; i < data_len; i++)
+		dev[i] = fabs (data[i] - median);
+	return ch_stats_median (dev, data_len);
+}
+
+/**
+ * ch_stats_reject_outliers:
+ *
+ * Copies the samples within @threshold robust standard deviations of the
+ * median into @out, which must be at least @data_len long. Nothing is
+ * rejected if more than half the samples are identical.
+ *
+ * Returns: the number of samples copied
+ **/
+guint
+ch_stats_reject_outliers (const gdouble *data,
+			  guint data_len,
+			  gdouble threshold,
+			  gdouble *out)
+{
+	gdouble limit;
+	gdouble median;
+	guint i;
+	guint len = 0;
+
+	if (data_len == 0)
+		return 0;
+	median = ch_stats_median (data, data_len);
+	limit = threshold * CH_STATS_MAD_TO_STD_DEV * ch_stats_mad (data, data_len);
+	for (i = 0; i < data_len; i++) {
+		if (limit > 0.f && fabs (data[i] - median) > limit)
+			continue;
+		out[len++] = data[i];
+	}
+	return len;
+}
+
+/**
+ * ch_stats_flicker_frequency:
+ *
+ * Estimates the dominant frequency in Hz from the rising crossings of the
+ * mean, using a little hysteresis so that noise is not counted.
+ *
+ * Returns: the frequency, or 0 if fewer than two cycles were seen
+ **/
+gdouble
+ch_stats_flicker_frequency (const gdouble *data,
+			    guint data_len,
+			    gdouble sample_rate)
+{
+	gboolean above = FALSE;
+	gboolean armed = FALSE;
+	gdouble first = -1.f;
+	gdouble hysteresis;
+	gdouble last = -1.f;
+	gdouble mean;
+	guint crossings = 0;
+	guint i;
+
+	if (data_len < 2 || sample_rate <= 0.f)
+		return 0.f;
+	mean = ch_stats_mean (data, data_len);
+	hysteresis = ch_stats_std_dev (data, data_len) / 4.f;
+	if (hysteresis == 0.f)
+		return 0.f;
+	for (i = 1; i < data_len; i++) {
+		gdouble pos;
+		if (data[i] < mean - hysteresis) {
+			armed = TRUE;
+			above = FALSE;
+			continue;
+		}
+		if (above || !armed || data[i] < mean ||
+		    data[i - 1] >= mean)
+			continue;
+
+		/* interpolate where the mean was crossed */
+		pos = (i - 1) + (mean - data[i - 1]) / (data[i] - data[i - 1]);
+		if (first < 0.f)
+			first = pos;
+		last = pos;
+		above = TRUE;
+		crossings++;
+	}
+	if (crossings < 2 || last <= first)
+		return 0.f;
+	return (crossings - 1) * sample_rate / (last - first);
+}
+
+void
+ch_stats_welford_add (ChStatsWelford *w, gdouble value)
+{
+	gdouble delta = value - w->mean;
+	w->n++;
+	w->mean += delta / w->n;
+	w->m2 += delta * (value - w->mean);
+}
+
+gdouble
+ch_stats_welford_get_variance (const ChStatsWelford *w)
+{
+	if (w->n < 2)
+		return 0.f;
+	return w->m2 / (w->n - 1);
+}
+
+/* two-sided 95% quantile of Student's t distribution */
+static gdouble
+ch_stats_t95 (guint df)
+{
+	const gdouble table[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+		2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+		2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+		2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+	if (df == 0)
+		return G_MAXDOUBLE;
+	if (df <= G_N_ELEMENTS (table))
+		return table[df - 1];
+
+	/* within 0.002 of the real value from here on */
+	return 1.96f + 2.4f / df;
+}
+
+/* half-width of the 95% confidence interval of the mean, using the t
+ * distribution as the variance is itself only an estimate */
+gdouble
+ch_stats_welford_get_ci95 (const ChStatsWelford *w)
+{
+	if (w->n < 2)
+		return G_MAXDOUBLE;
+	return ch_stats_t95 (w->n - 1) *
+	       sqrt (ch_stats_welford_get_variance (w) / w->n);
+}
+
+/**
+ * ch_stats_summary_init:
+ *
+ * Works out everything in @summary in one go, sorting only once. The mean
+ * and standard deviation are of the samples left after outlier rejection
+ * with @threshold, or of all samples if @threshold is zero.
+ **/
+void
+ch_stats_summary_init (ChStatsSummary *summary,
+		       const gdouble *data,
+		       guint data_len,
+		       gdouble threshold)
+{
+	guint len;
+	g_autofree gdouble *kept = NULL;
+	g_autofree gdouble *sorted = NULL;
+
+	memset (summary, 0, sizeof (ChStatsSummary));
+	summary->len = data_len;
+	if (data_len == 0)
+		return;
+	sorted = ch_stats_sorted_copy (data, data_len);
+	summary->min = sorted[0];
+	summary->max = sorted[data_len - 1];
+	summary->p5 = ch_stats_percentile_sorted (sorted, data_len, 5.f);
+	summary->median = ch_stats_percentile_sorted (sorted, data_len, 50.f);
+	summary->p95 = ch_stats_percentile_sorted (sorted, data_len, 95.f);
+	summary->mad = ch_stats_mad (data, data_len);
+
+	/* drop the outliers before the moments */
+	kept = g_new (gdouble, data_len);
+	if (threshold > 0.f) {
+		len = ch_stats_reject_outliers (data, data_len, threshold, kept);
+	} else {
+		memcpy (kept, data, data_len * sizeof (gdouble));
+		len = data_len;
+	}
+	summary->outliers = data_len - len;
+	summary->mean = ch_stats_mean (kept, len);
+	summary->std_dev = ch_stats_std_dev (kept, len);
+}
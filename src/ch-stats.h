@@ -0,0 +1,96 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_STATS_H__
+#define __CH_STATS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* scales the MAD so it estimates the std dev of normally distributed data */
+#define CH_STATS_MAD_TO_STD_DEV		1.4826
+
+typedef struct {
+	guint		 n;
+	gdouble		 mean;
+	gdouble		 m2;
+} ChStatsWelford;
+
+typedef struct {
+	guint		 len;
+	guint		 outliers;
+	gdouble		 mean;
+	gdouble		 std_dev;
+	gdouble		 min;
+	gdouble		 max;
+	gdouble		 p5;
+	gdouble		 median;
+	gdouble		 p95;
+	gdouble		 mad;
+} ChStatsSummary;
+
+gdouble		 ch_stats_mean			(const gdouble		*data,
+						 guint			 data_len);
+gdouble		 ch_stats_std_dev		(const gdouble		*data,
+						 guint			 data_len);
+void		 ch_stats_sort			(gdouble		*data,
+						 guint			 data_len);
+gdouble		 ch_stats_select		(gdouble		*data,
+						 guint			 data_len,
+						 guint			 k);
+gdouble		 ch_stats_percentile		(const gdouble		*data,
+						 guint			 data_len,
+						 gdouble		 percentile);
+gdouble		 ch_stats_percentile_sorted	(const gdouble		*sorted,
+						 guint			 data_len,
+						 gdouble		 percentile);
+gdouble		 ch_stats_median		(const gdouble		*data,
+						 guint			 data_len);
+gdouble		 ch_stats_trimmed_mean		(const gdouble		*data,
+						 guint			 data_len,
+						 gdouble		 fraction);
+gdouble		 ch_stats_percentile_jitter	(const gdouble		*data,
+						 guint			 data_len,
+						 gdouble		 percentile);
+gdouble		 ch_stats_mad			(const gdouble		*data,
+						 guint			 data_len);
+guint		 ch_stats_reject_outliers	(const gdouble		*data,
+						 guint			 data_len,
+						 gdouble		 threshold,
+						 gdouble		*out);
+gdouble		 ch_stats_flicker_frequency	(const gdouble		*data,
+						 guint			 data_len,
+						 gdouble		 sample_rate);
+
+void		 ch_stats_welford_add		(ChStatsWelford		*w,
+						 gdouble		 value);
+gdouble		 ch_stats_welford_get_variance	(const ChStatsWelford	*w);
+gdouble		 ch_stats_welford_get_ci95	(const ChStatsWelford	*w);
+
+void		 ch_stats_summary_init		(ChStatsSummary		*summary,
+						 const gdouble		*data,
+						 guint			 data_len,
+						 gdouble		 threshold);
+
+G_END_DECLS
+
+#endif